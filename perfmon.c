@@ -2,6 +2,17 @@
 
 //To use this library, first call pmu_enable()
 
+//Internal state
+
+    //Cortex-A53 implementation-defined events, see EVT_A53_*
+    static const unsigned char a53_events[] = {
+        0x60, 0x61, 0x7A, 0x86, 0x87,
+        0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xCB, 0xCC,
+        0xD0, 0xD1, 0xD2,
+        0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8,
+    };
+
+
 //Helper Functions
 
     //Determine which bits are set
@@ -13,38 +24,70 @@
 
     }
 
-    //Find open bits, return error if none available
-    int pmcnten_get_open(unsigned flags) {
+    //Reserve an open register, or an aligned even/odd pair for a chained event
+    //Lock-free, so it can be called from interrupts: a CAS on the CPU's slot bitmap,
+    //retried only when another reservation got in first
+    //Registers enabled without going through here (e.g. pmu_load) also count as taken
+    //Return the (low) register index, or error if none available
+    int pmu_slot_reserve(unsigned flags) {
 
-        unsigned set = pmcnten_get();
+        unsigned * slots = &pmu_state_this()->slots;
         unsigned nevents = pmu_nevents();
+        if (nevents > NEVENTS_ARCH_MAX) nevents = NEVENTS_ARCH_MAX;
+        unsigned enabled = pmcnten_get();
+        unsigned reserved = __atomic_load_n(slots, __ATOMIC_RELAXED);
+
+        for (;;) {
+
+            unsigned open = ~(reserved | enabled) & ((1 << nevents) - 1);
+            unsigned i;
+            unsigned mask;
+
+            //Need to chain two registers, starting at an even one
+            if (flags & PMU_EVENTFLAG_64BIT) {
+                unsigned pairs = open & (open >> 1) & 0x55555555;
+                if (!pairs) return PMU_RETURN_NO_OPEN_SLOT;
+                i = __builtin_ctz(pairs);
+                mask = 0b11 << i;
+            }
 
-        //Need to chain two registers
-        if (flags & PMU_EVENTFLAG_64BIT) {
-
-            //Check sets of two registers
-            for (int i = 0; i < nevents; i+=2) {
-                if (set & (0b11 << i) == 0) return i;
+            //Need a single open register
+            else {
+                if (!open) return PMU_RETURN_NO_OPEN_SLOT;
+                i = __builtin_ctz(open);
+                mask = 1 << i;
             }
+
+            //On failure reserved is reloaded, so the search reruns on the current bitmap
+            if (__atomic_compare_exchange_n(slots, &reserved, reserved | mask, 1,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return i;
         }
 
-        //Check for a single open register
-        else {
-            for (int i = 0; i < nevents; i++) {
-                if (set & (1 << i) == 0) return i;
+    }
+
+    //Find the low registers of chained pairs among the enabled registers in set
+    unsigned pmu_chained_get(unsigned set, unsigned nevents) {
+
+        unsigned chained = 0;
+        for (int i = 0; i + 1 < nevents; i += 2) {
+            if ((set & (0b11 << i)) == (0b11 << i) && pmevtyper_get(i + 1) == EVT_CHAIN) {
+                chained |= 1 << i;
             }
         }
+        return chained;
 
-        return PMU_RETURN_NO_OPEN_SLOT;
     }
 
-    //Find which bit corresponds to provided event, return error if none
-    //Does not check if event is available on this platform
-    int pmcnten_get_event_bit(unsigned event) {
+    //Release registers reserved by pmu_slot_reserve
+    void pmu_slot_release(unsigned mask) {
+        __atomic_fetch_and(&pmu_state_this()->slots, ~mask, __ATOMIC_RELEASE);
+    }
+
+    //Find which bit corresponds to provided event among enabled counters not in skip, return error if none
+    static int pmcnten_get_event_bit_other(unsigned event, unsigned skip) {
 
-        unsigned set = pmcnten_get();        
+        unsigned set = pmcnten_get() & ~skip;
         unsigned nevents = pmu_nevents();
-        unsigned event_get;
 
         for (int i = 0; i < nevents; i++) {
             //Is this counter enabled?
@@ -58,29 +101,125 @@
 
     }
 
+    //Find which bit corresponds to provided event, return error if none
+    //Does not check if event is available on this platform
+    int pmcnten_get_event_bit(unsigned event) {
+        return pmcnten_get_event_bit_other(event, 0);
+    }
+
+
+    //Fill in a handle for a monitored event, without checking the event set generation
+    //Return event counter register index, or error if not monitored
+    static int pmu_event_lookup(const struct pmu_state * state, unsigned event, struct pmu_event_handle * handle) {
+
+        //Check if event is being monitored
+        int bit = pmcnten_get_event_bit(event);
+        if (bit < 0) return bit;
+
+        handle->slot = bit;
+        handle->event = event;
+
+        //Check if 64-bit chaining is defined
+        handle->chained = (
+            bit % 2 == 0 //Bit must be even
+            && bit + 1 < pmu_nevents() //Next bit must be in range
+            && pmevtyper_get(bit + 1) == EVT_CHAIN //Next bit is event chain
+        );
+
+        handle->extended = (state->ext.mask >> bit) & 1;
+
+        return bit;
+    }
+
+
+    //pmu_event_handle_get with the calling CPU's state already looked up
+    static int pmu_event_handle_get_on(const struct pmu_state * state, unsigned event, struct pmu_event_handle * handle) {
+
+        struct pmu_event_handle found;
+
+        for (unsigned tries = 0; tries < PMU_CONFIG_RETRIES; tries++) {
+
+            unsigned seq = pmu_config_read_begin(state);
+            int bit = pmu_event_lookup(state, event, &found);
+            if (pmu_config_read_retry(state, seq)) continue;
+
+            if (bit < 0) return bit;
+            if (!handle) return PMU_RETURN_BAD_PTR;
+
+            found.config = seq;
+            *handle = found;
+            return bit;
+        }
+
+        return PMU_RETURN_CONFIG_BUSY;
+
+    }
+
+    //Start extending counter n to 64 bits in software, from a high word of 0
+    void pmu_ext_start(unsigned n) {
+        struct pmu_ext_state * ext = &pmu_state_this()->ext;
+        __atomic_add_fetch(&ext->seq, 1, __ATOMIC_ACQUIRE);
+        pmovsr_clear(n);
+        ext->high[n] = 0;
+        ext->mask |= 1 << n;
+        if (ext->interrupt) pminten_enable(n);
+        __atomic_add_fetch(&ext->seq, 1, __ATOMIC_RELEASE);
+    }
+
+    //Stop extending counter n
+    void pmu_ext_stop(unsigned n) {
+        struct pmu_ext_state * ext = &pmu_state_this()->ext;
+        if (!(ext->mask & (1 << n))) return;
+        pminten_disable(n);
+        ext->mask &= ~(1 << n);
+    }
+
 
 //Public Functions
     
+    //Work out which events the calling CPU implements, once, so pmu_event_available is a bit test
+    //Common events 0x00-0x3F come from PMCEID0/1, implementation-defined ones from the MIDR part number
+    //Called on every core by the module at load, or on the first pmu_event_available on the CPU
+    void pmu_event_available_init(void) {
+
+        struct pmu_state * state = pmu_state_this();
+        unsigned available[PMU_EVENT_SPACE / 32] = { pmceid0_read(), pmceid1_read() };
+
+        if (midr_is_cortex_a53()) {
+            for (unsigned i = 0; i < sizeof(a53_events); i++) {
+                available[a53_events[i] >> 5] |= 1u << (a53_events[i] & 31);
+            }
+        }
+
+        for (unsigned i = 0; i < PMU_EVENT_SPACE / 32; i++) state->available[i] = available[i];
+        __atomic_store_n(&state->available_init, 1, __ATOMIC_RELEASE);
+
+    }
+
     //Check if event is available on this platform
     char pmu_event_available(unsigned event) {
 
-        //Only 64 events can be defined
-        if (event > 63) return 0;
+        if (event >= PMU_EVENT_SPACE) return 0;
 
-        //Event availability in PMCEID1 register
-        if (event > 31) {
-            event -= 31;
-            return pmceid1_isset(1<<event);
-        }
+        struct pmu_state * state = pmu_state_this();
+        if (!__atomic_load_n(&state->available_init, __ATOMIC_ACQUIRE)) pmu_event_available_init();
+
+        return (state->available[event >> 5] >> (event & 31)) & 1;
 
-        //Event availability in PMCEID0 register
-        else {
-            return pmceid0_isset(1<<event);
-        }
     }
 
     //Adds event to monitoring
 	int pmu_event_add(unsigned event, unsigned flags) {
+        return pmu_event_add_handle(event, flags, 0);
+    }
+
+    //Adds event to monitoring, filling in a handle for fast reads
+    //Handle may be null
+	int pmu_event_add_handle(unsigned event, unsigned flags, struct pmu_event_handle * handle) {
+
+        //Check there is a PMU at all
+        int ret = pmu_backend_check();
+        if (ret < 0) return ret;
 
         //Check if event is available on this platform
         if (!pmu_event_available(event)) return PMU_RETURN_EVENT_NO_AVAIL;
@@ -88,9 +227,13 @@
         //Check if event is already monitored
         if (pmcnten_get_event_bit(event) >= 0) return PMU_RETURN_EVENT_ALREADY;
 
-        //Check if there is an open register
-        int i = pmcnten_get_open(flags);
+        //Reserve an open register
+        int i = pmu_slot_reserve(flags);
         if (i < 0) return i;
+        unsigned mask = (flags & PMU_EVENTFLAG_64BIT ? 0b11 : 0b1) << i;
+
+        struct pmu_state * state = pmu_state_this();
+        pmu_config_write_begin(state);
 
         //Monitor event
         pmu_event_set(i, event);
@@ -100,9 +243,96 @@
             pmu_event_set(i+1, EVT_CHAIN);
         }
 
+        //An add of the same event that interrupted this one passed the check above too:
+        //whichever finds the other's counter enabled once its own is backs off
+        if (pmcnten_get_event_bit_other(event, mask) >= 0) {
+            pmcntenclr_write(mask);
+            pmu_config_write_end(state);
+            pmu_slot_release(mask);
+            return PMU_RETURN_EVENT_ALREADY;
+        }
+
+        //Extend to 64 bits in software if defined as flag, and not chained
+        if (!(flags & PMU_EVENTFLAG_64BIT) && (flags & PMU_EVENTFLAG_64BIT_SW)) {
+            pmu_ext_start(i);
+        }
+
+        unsigned config = pmu_config_write_end(state);
+
+        if (handle) {
+            handle->slot = i;
+            handle->chained = flags & PMU_EVENTFLAG_64BIT ? 1 : 0;
+            handle->event = event;
+            handle->extended = !handle->chained && (flags & PMU_EVENTFLAG_64BIT_SW) ? 1 : 0;
+            handle->config = config;
+        }
+
         return PMU_RETURN_SUCCESS;
     }
 
+    //Adds n events at once, all of them or none, filling in handles if not null
+    //Chained events go first so they get aligned pairs before single counters fragment them
+    //Each event's PMEVTYPER filter bits are set as given, replacing any left by a previous event
+    int pmu_event_add_batch(const struct pmu_event_spec * specs, unsigned n, struct pmu_event_handle * handles) {
+
+        if (!specs) return PMU_RETURN_BAD_PTR;
+        if (n > NEVENTS_ARCH_MAX) return PMU_RETURN_GROUP_TOO_LARGE;
+
+        struct pmu_event_handle added[NEVENTS_ARCH_MAX];
+        unsigned done = 0;
+        int ret = PMU_RETURN_SUCCESS;
+
+        for (unsigned pass = 0; pass < 2 && ret == PMU_RETURN_SUCCESS; pass++) {
+            for (unsigned i = 0; i < n; i++) {
+                unsigned chained = specs[i].flags & PMU_EVENTFLAG_64BIT ? 1 : 0;
+                if (chained != !pass) continue;
+                ret = pmu_event_add_handle(specs[i].event, specs[i].flags, &added[i]);
+                if (ret < 0) break;
+                done |= 1 << i;
+            }
+        }
+
+        if (ret < 0) {
+            for (unsigned pending = done; pending; pending &= pending - 1) {
+                unsigned i = __builtin_ctz(pending);
+                pmu_event_remove(specs[i].event, specs[i].flags);
+            }
+            return ret;
+        }
+
+        //Filter, then restart the counts so none of them saw the unfiltered event
+        struct pmu_state * state = pmu_state_this();
+        pmu_config_write_begin(state);
+        for (unsigned i = 0; i < n; i++) {
+            unsigned slot = added[i].slot;
+            pmevtyper_write(slot, specs[i].event | specs[i].filter);
+            if (added[i].chained) pmevtyper_write(slot + 1, EVT_CHAIN | specs[i].filter);
+        }
+        for (unsigned i = 0; i < n; i++) {
+            pmevcntr_reset(added[i].slot);
+            if (added[i].chained) pmevcntr_reset(added[i].slot + 1);
+        }
+        pmu_config_write_end(state);
+
+        if (handles) {
+            for (unsigned i = 0; i < n; i++) {
+                ret = pmu_event_handle_get(specs[i].event, &handles[i]);
+                if (ret < 0) return ret;
+            }
+        }
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    //Look up a handle for a monitored event
+    //Pays for the slot search once so later reads don't have to
+    //Retries if the event set changes during the search
+    //On success, return event counter register index
+    int pmu_event_handle_get(unsigned event, struct pmu_event_handle * handle) {
+        return pmu_event_handle_get_on(pmu_state_this(), event, handle);
+    }
+
     //Remove event from monitoring
     //We do not reset the count here in case we want to read the count after removal    
 	int pmu_event_remove(unsigned event, unsigned flags) {
@@ -111,8 +341,13 @@
         int bit = pmcnten_get_event_bit(event);
         if (bit < 0) return bit;
 
+        struct pmu_state * state = pmu_state_this();
+        pmu_config_write_begin(state);
+
         //Clear monitoring for event
         pmcnten_disable(bit);
+        pmu_ext_stop(bit);
+        unsigned mask = 1 << bit;
 
         //Check if 64-bit chaining is defined
         bit++;
@@ -121,10 +356,16 @@
             if ( pmevtyper_get(bit) == EVT_CHAIN ) {
                 //If so, clear chain register
                 pmcnten_disable(bit);
+                mask |= 1 << bit;
             }
 
         }
 
+        pmu_config_write_end(state);
+
+        //Only hand the registers out again once they are disabled
+        pmu_slot_release(mask);
+
         return PMU_RETURN_SUCCESS;
 
     }
@@ -136,6 +377,9 @@
         int bit = pmcnten_get_event_bit(event);
         if (bit < 0) return bit;
 
+        struct pmu_state * state = pmu_state_this();
+        pmu_config_write_begin(state);
+
         //Check if 64-bit chaining is defined
         bit++;
         if ( bit < pmu_nevents()) {
@@ -150,6 +394,11 @@
         //Reset the primary counter
         pmevcntr_reset(bit-1);
 
+        //Reset the software high word
+        if (state->ext.mask & (1 << (bit-1))) pmu_ext_start(bit-1);
+
+        pmu_config_write_end(state);
+
         return PMU_RETURN_SUCCESS;
 
     }
@@ -158,52 +407,388 @@
     //On success, return event counter register index
 	int pmu_event_read_32(unsigned event, unsigned flags, unsigned * value) {
 
-        //Check if event is being monitored
-        int bit = pmcnten_get_event_bit(event);
-        if (bit < 0) return bit;              
+        struct pmu_state * state = pmu_state_this();
+        struct pmu_event_handle handle;
 
-        if (!value) return PMU_RETURN_BAD_PTR;
+        //Retry if the event set changed under the read
+        for (unsigned tries = 0; tries < PMU_CONFIG_RETRIES; tries++) {
 
-        *value = pmevcntr_read(bit);
+            //Check if event is being monitored
+            int bit = pmu_event_handle_get_on(state, event, &handle);
+            if (bit < 0) return bit;
 
-        return bit;
+            if (!value) return PMU_RETURN_BAD_PTR;
+
+            unsigned count = pmu_handle_read_32(&handle);
+            if (pmu_handle_stale_on(state, &handle)) continue;
+
+            *value = count;
+            return bit;
+        }
+
+        return PMU_RETURN_CONFIG_BUSY;
 
     }
 
     //Get event count value
     //On success, return event counter register index
+    //For repeated reads, use pmu_event_handle_get once and pmu_handle_read
 	int pmu_event_get(unsigned event, unsigned flags, unsigned long long * value) {
 
-        //Check if event is being  monitored        
-        int bit = pmcnten_get_event_bit(event);
-        if (bit < 0) return bit;
+        struct pmu_state * state = pmu_state_this();
+        struct pmu_event_handle handle;
 
-        if (!value) return PMU_RETURN_BAD_PTR;
+        //Retry if the event set changed under the read
+        for (unsigned tries = 0; tries < PMU_CONFIG_RETRIES; tries++) {
 
-        //Check if 64-bit chaining is defined
-        if (
-            bit % 2 == 0 //Bit must be even
-            // bit + 1 < pmu_nevents() //Even bit implies next bit still in range
-            && pmevtyper_get(bit + 1) == EVT_CHAIN //Next bit is event chain
-        )
-        {
-            *value = pmevcntr_read_64(bit);
+            //Check if event is being monitored
+            int bit = pmu_event_handle_get_on(state, event, &handle);
+            if (bit < 0) return bit;
+
+            if (!value) return PMU_RETURN_BAD_PTR;
+
+            unsigned long long count = pmu_handle_read_on(state, &handle);
+            if (pmu_handle_stale_on(state, &handle)) continue;
+
+            *value = count;
+            return bit;
+        }
+
+        return PMU_RETURN_CONFIG_BUSY;
+
+    }
+
+    //Read all event counters and the cycle counter in one straight-line sequence
+    //The switch falls through, so after a single dispatch on the number of
+    //counters every read is a constant-index register read
+    //Skew is measured with the cycle counter, so is in units of 64 cycles
+    //if PMCR_CYCLE_COUNT_EVERY_64 is set, and 0 with PMU_SNAPSHOT_CONSISTENT
+    int pmu_snapshot(struct pmu_snapshot * snap, unsigned flags) {
+
+        if (!snap) return PMU_RETURN_BAD_PTR;
+
+        unsigned pmcr = pmcr_read();
+        unsigned nevents = (pmcr & PMCR_NEVENTS) >> PMCR_NEVENTS_SHIFT;
+        if (nevents > NEVENTS_ARCH_MAX) nevents = NEVENTS_ARCH_MAX;
+        unsigned * count = snap->count;
+        unsigned long long cycles;
+        unsigned start, end;
+
+        snap->enabled = pmcntenset_read();
+        snap->nevents = nevents;
+
+        //Stop counting so every register holds the same instant
+        if (flags & PMU_SNAPSHOT_CONSISTENT) {
+            pmcr_write(pmcr & ~PMCR_ENABLE_COUNTERS);
         }
 
-        //Otherwise, just get the 32-bit value.
-        else {
-            unsigned low = pmevcntr_read(bit);
-            *value = ULL(low, 0);
+        if (pmcr & PMCR_CYCLE_COUNTER_64_BITS) cycles = pmccntr_read_64();
+        else cycles = pmccntr_read_32();
+        start = (unsigned) cycles;
+
+        switch (nevents) {
+#if NEVENTS_ARCH_MAX > 30
+            case 31 :
+                count[30] = pmevcntr_read(30);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 29
+            case 30 :
+                count[29] = pmevcntr_read(29);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 28
+            case 29 :
+                count[28] = pmevcntr_read(28);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 27
+            case 28 :
+                count[27] = pmevcntr_read(27);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 26
+            case 27 :
+                count[26] = pmevcntr_read(26);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 25
+            case 26 :
+                count[25] = pmevcntr_read(25);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 24
+            case 25 :
+                count[24] = pmevcntr_read(24);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 23
+            case 24 :
+                count[23] = pmevcntr_read(23);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 22
+            case 23 :
+                count[22] = pmevcntr_read(22);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 21
+            case 22 :
+                count[21] = pmevcntr_read(21);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 20
+            case 21 :
+                count[20] = pmevcntr_read(20);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 19
+            case 20 :
+                count[19] = pmevcntr_read(19);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 18
+            case 19 :
+                count[18] = pmevcntr_read(18);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 17
+            case 18 :
+                count[17] = pmevcntr_read(17);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 16
+            case 17 :
+                count[16] = pmevcntr_read(16);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 15
+            case 16 :
+                count[15] = pmevcntr_read(15);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 14
+            case 15 :
+                count[14] = pmevcntr_read(14);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 13
+            case 14 :
+                count[13] = pmevcntr_read(13);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 12
+            case 13 :
+                count[12] = pmevcntr_read(12);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 11
+            case 12 :
+                count[11] = pmevcntr_read(11);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 10
+            case 11 :
+                count[10] = pmevcntr_read(10);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 9
+            case 10 :
+                count[9] = pmevcntr_read(9);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 8
+            case 9 :
+                count[8] = pmevcntr_read(8);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 7
+            case 8 :
+                count[7] = pmevcntr_read(7);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 6
+            case 7 :
+                count[6] = pmevcntr_read(6);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 5
+            case 6 :
+                count[5] = pmevcntr_read(5);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 4
+            case 5 :
+                count[4] = pmevcntr_read(4);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 3
+            case 4 :
+                count[3] = pmevcntr_read(3);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 2
+            case 3 :
+                count[2] = pmevcntr_read(2);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 1
+            case 2 :
+                count[1] = pmevcntr_read(1);
+                __attribute__((fallthrough));
+#endif
+#if NEVENTS_ARCH_MAX > 0
+            case 1 :
+                count[0] = pmevcntr_read(0);
+                __attribute__((fallthrough));
+#endif
+            default :
+                break;
         }
-        
-        return bit;
+
+        end = pmccntr_read_32();
+
+        //Resume counting
+        if (flags & PMU_SNAPSHOT_CONSISTENT) {
+            pmcr_write(pmcr);
+        }
+
+        snap->cycles = cycles;
+        snap->skew = end - start;
+
+        return PMU_RETURN_SUCCESS;
 
     }
 
+    //Bias subtracted by pmu_region_end
+    struct pmu_region_bias pmu_region_calibration;
+
+    //Measure the cost of an empty region for every enabled counter
+    //Call after programming events, and again whenever they change
+    //reps of 0 uses PMU_REGION_CALIBRATE_REPS
+    int pmu_region_calibrate(unsigned reps) {
+
+        struct pmu_region_bias * bias = &pmu_region_calibration;
+        struct pmu_region region;
+        struct pmu_region_delta delta;
+
+        if (!reps) reps = PMU_REGION_CALIBRATE_REPS;
+
+        unsigned nevents = pmu_nevents();
+        if (nevents > NEVENTS_ARCH_MAX) nevents = NEVENTS_ARCH_MAX;
+        unsigned set = pmcnten_get();
+
+        //Measure with no bias applied
+        for (int i = 0; i < NEVENTS_ARCH_MAX; i++) bias->count[i] = 0;
+        bias->cycles = 0;
+        bias->chained = pmu_chained_get(set, nevents);
+        bias->enabled = set;
+        bias->reps = 0;
+
+        unsigned long long best[NEVENTS_ARCH_MAX];
+        unsigned long long best_cycles = ~0ULL;
+        for (int i = 0; i < NEVENTS_ARCH_MAX; i++) best[i] = ~0ULL;
+
+        for (unsigned r = 0; r < reps; r++) {
+            pmu_region_begin(&region);
+            pmu_region_end(&region, &delta);
+            for (int i = 0; i < nevents; i++) {
+                if (delta.count[i] < best[i]) best[i] = delta.count[i];
+            }
+            if (delta.cycles < best_cycles) best_cycles = delta.cycles;
+        }
+
+        for (int i = 0; i < nevents; i++) bias->count[i] = best[i];
+        bias->cycles = best_cycles;
+        bias->reps = reps;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    //Start measuring a region
+    //Chained pairs are found before the snapshot, so the PMEVTYPER reads fall outside the region
+    int pmu_region_begin(struct pmu_region * region) {
+
+        if (!region) return PMU_RETURN_BAD_PTR;
+
+        unsigned nevents = pmu_nevents();
+        if (nevents > NEVENTS_ARCH_MAX) nevents = NEVENTS_ARCH_MAX;
+        region->chained = pmu_chained_get(pmcnten_get(), nevents);
+        return pmu_snapshot(&region->start, 0);
+
+    }
+
+    //Finish measuring a region, returning deltas
+    //The calibrated bias is subtracted only if it was measured on the counters and chained pairs
+    //enabled for the whole region, deltas smaller than it are reported as 0
+    int pmu_region_end(struct pmu_region * region, struct pmu_region_delta * delta) {
+
+        if (!region || !delta) return PMU_RETURN_BAD_PTR;
+
+        struct pmu_snapshot end;
+        pmu_snapshot(&end, 0);
+
+        const struct pmu_region_bias * bias = &pmu_region_calibration;
+        const struct pmu_snapshot * start = &region->start;
+        unsigned nevents = end.nevents < start->nevents ? end.nevents : start->nevents;
+        unsigned enabled = start->enabled & end.enabled & ((1 << nevents) - 1);
+        unsigned chained = region->chained & enabled & (enabled >> 1);
+        unsigned long long d;
+
+        //A bias measured on another event set would subtract the wrong costs
+        char corrected = bias->reps && bias->enabled == enabled && bias->chained == chained;
+
+        for (int i = 0; i < nevents; i++) {
+
+            //Chained pair: full 64-bit delta in the low register's entry
+            if (chained & (1 << i)) {
+                d = ULL(end.count[i], end.count[i + 1]);
+                d -= ULL(start->count[i], start->count[i + 1]);
+                if (corrected) d = d > bias->count[i] ? d - bias->count[i] : 0;
+                delta->count[i] = d;
+                delta->count[++i] = 0;
+                continue;
+            }
+
+            //32-bit counters wrap, so take the difference modulo 2^32
+            d = (unsigned) (end.count[i] - start->count[i]);
+            if (corrected) d = d > bias->count[i] ? d - bias->count[i] : 0;
+            delta->count[i] = d;
+        }
+
+        //The 32-bit cycle counter wraps too
+        if ((end.cycles | start->cycles) >> 32) d = end.cycles - start->cycles;
+        else d = (unsigned) (end.cycles - start->cycles);
+        if (corrected) d = d > bias->cycles ? d - bias->cycles : 0;
+        delta->cycles = d;
+
+        delta->enabled = enabled;
+        delta->corrected = corrected;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    //Choose how software-extended counters on this CPU fold overflows
+    //Enable only if an interrupt handler calls pmu_overflow_handler on this CPU
+    //Otherwise, reads fold overflows as they see them
+    void pmu_ext_interrupts(char enable) {
+        struct pmu_ext_state * ext = &pmu_state_this()->ext;
+        ext->interrupt = enable ? 1 : 0;
+        if (enable) pmintenset_write(ext->mask);
+        else pmintenclr_write(ext->mask);
+    }
+
     //Disable and reset everything
     void pmu_disable_all() {
+        struct pmu_state * state = pmu_state_this();
+
         //Disable all event counters
+        pmu_config_write_begin(state);
         pmcntenclr_write(~0);
+        pmu_config_write_end(state);
+        pmu_slot_release(~0);
 
         //Reset all event counters        
         pmevcntr_reset_all();
@@ -7,18 +7,14 @@
 *
 * Provides functions and constant flags
 * for interracting with the ARM Cortex-A53
-* performance monitors in AARCH32 mode.
+* performance monitors in AARCH32 or AARCH64 mode.
 *
 * This is the architecture in use on the Raspberry Pi 3 Model B series.
 *
 * Written October 9, 2020 by Marion Sudvarg
 * 
-* TODO: Add AARCH64 and other ARM versions
-* TODO: Add multicore support (each performance monitor is per-core)
-* TODO: Add overflow interrupt support,
-*		with additional support for resetting event counts to -x
-*		to ensure an interrupt is raised every x occurances
-* TODO: Add appropriate locking semantics
+* TODO: Add other ARM versions
+* TODO: Add appropriate locking semantics (counter slots are reserved lock-free, the rest isn't)
 *
 *
 *** Additional Papers of Interest ***
@@ -30,6 +26,16 @@
 //Architecture dependent max value that can be provided to Op2 assembly instruction to enumerate performance monitor event count registers
 //7 on Arm Cortex-A53 in AARCH32 mode
 #define NEVENTS_ARCH_MAX 8
+
+#ifdef __KERNEL__
+#include <linux/smp.h>
+#include <linux/irqflags.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 const static unsigned SET = 1;
 const static unsigned CLR = 0;
 
@@ -37,6 +43,175 @@ const static unsigned CLR = 0;
 #define ULL(low, high) ( (unsigned long long) low ) | \
 						( ( (unsigned long long) high ) << 32 );
 
+//64-bit unsigned division by shift and subtract
+//Kernel modules on 32-bit ARM can't link libgcc's __aeabi_uldivmod,
+//so library code that divides 64-bit values uses this instead
+static inline unsigned long long pmu_div64(unsigned long long n, unsigned long long d) {
+	unsigned long long q = 0, bit = 1;
+	if (!d) return 0;
+	while (d < n && !(d >> 63)) {
+		d <<= 1;
+		bit <<= 1;
+	}
+	while (bit) {
+		if (n >= d) {
+			n -= d;
+			q |= bit;
+		}
+		d >>= 1;
+		bit >>= 1;
+	}
+	return q;
+}
+
+//Register backends
+//Every register access below goes through PMU_BACKEND_CALL to one of:
+//	cp15: MRC/MCR on the calling core's PMU (default in AARCH32, see perfmon_cp15.h)
+//	a64: MRS/MSR on the calling core's PMU (default in AARCH64, see perfmon_a64.h)
+//	perf: perf events opened for the calling thread (PMU_BACKEND_PERF, see perfmon_perf.h)
+//	emu: registers in memory with injected events, for hosts without a PMU (PMU_BACKEND_EMU, see perfmon_emu.h)
+//	runtime: the first of cp15, a64 and perf that works here, picked at startup by
+//		pmu_backend_select (PMU_BACKEND_RUNTIME, see perfmon_backend.c), or emu by name
+//		If none works, adding events and pmu_load return PMU_RETURN_NO_BACKEND
+//The compile-time backends inline completely
+//The runtime backend calls through struct pmu_backend, except counter reads on cp15/a64, which stay inline
+
+	//Register operations of a backend
+	//Registers with separate set and clear views (PMCNTEN, PMINTEN) have a single read
+	struct pmu_backend {
+		const char * name;
+		int (*probe)(void); //Nonzero if the backend can be used here
+		unsigned (*pmcr_read)(void);
+		void (*pmcr_write)(unsigned x);
+		unsigned (*pmcnten_read)(void);
+		void (*pmcntenset_write)(unsigned x);
+		void (*pmcntenclr_write)(unsigned x);
+		unsigned (*pmevtyper_read)(unsigned n);
+		void (*pmevtyper_write)(unsigned n, unsigned type);
+		unsigned (*pmevcntr_read)(unsigned n);
+		void (*pmevcntr_write)(unsigned n, unsigned count);
+		unsigned long long (*pmccntr_read)(void);
+		void (*pmccntr_write)(unsigned long long count);
+		unsigned (*pmovsr_read)(void);
+		void (*pmovsr_write)(unsigned x);
+		void (*pmovsset_write)(unsigned x);
+		unsigned (*pminten_read)(void);
+		void (*pmintenset_write)(unsigned x);
+		void (*pmintenclr_write)(unsigned x);
+		unsigned (*pmuserenr_read)(void);
+		void (*pmuserenr_write)(unsigned x);
+		unsigned (*mpidr_read)(void);
+		unsigned (*cpu)(void); //Index of the calling CPU's PMU into pmu_state, see pmu_cpu
+		unsigned (*midr_read)(void);
+		unsigned (*pmceid_read)(unsigned n); //PMCEID0 for n = 0, PMCEID1 for n = 1
+	};
+
+	//Encodings for event counter n, valid for all 31 counters
+	//The same CRm and op2 in AARCH32 (MRC/MCR c14) and AARCH64 (MRS/MSR S3_3_C14)
+	//PMEVCNTR<n>: CRm = 0b10:n[4:3], op2 = n[2:0]
+	//PMEVTYPER<n>: CRm = 0b11:n[4:3], op2 = n[2:0]
+	//N must be a compile-time constant, as it is emitted as an immediate
+	#define PMEVCNTR_CRM( N ) ( 0b1000 | ( (N) >> 3 ) )
+	#define PMEVTYPER_CRM( N ) ( 0b1100 | ( (N) >> 3 ) )
+	#define PMEV_OPC2( N ) ( (N) & 0b111 )
+
+	//Number of the calling core, for backends on the calling core's own registers (cp15, a64)
+	//Not from MPIDR: it is PL1-only in AARCH32, and Linux traps EL0 reads in AARCH64
+	//and returns the same value on every core, so neither can index per-CPU state
+#if defined(__KERNEL__)
+	//Callers already run with preemption disabled, as they program one core's PMU
+	static inline unsigned pmu_cpu_core(void) {
+		return smp_processor_id();
+	}
+#else
+	//sched_getcpu() of the calling thread, looked up on its first call (see pmu_cpu_update)
+	extern __thread int pmu_cpu_cached;
+
+	//Look up the calling thread's CPU again, e.g. after pinning it somewhere else
+	unsigned pmu_cpu_update(void);
+
+	static inline unsigned pmu_cpu_core(void) {
+		int cpu = pmu_cpu_cached;
+		return cpu >= 0 ? (unsigned) cpu : pmu_cpu_update();
+	}
+
+	//MIDR for the userspace backends, which don't read the register: it is PL1-only in AARCH32
+	//The value given to pmu_midr_set, else from sysfs (arm64 kernels) or /proc/cpuinfo, 0 if neither has it
+	unsigned pmu_midr_user(void);
+
+	//Override the core userspace takes the PMU to be, e.g. where /proc/cpuinfo doesn't say
+	//The emulated PMU has its own, pmu_emu.midr
+	//Event availability is worked out again on each CPU's next pmu_event_available
+	void pmu_midr_set(unsigned midr);
+#endif
+
+	//Indirect access (PMU_ACCESS_INDIRECT) selects a counter in PMSELR, then accesses it through PMXEV*
+	//An interrupt between the two that accesses counters itself would leave the other selected:
+	//in the kernel the pair runs with interrupts masked, in userspace signal handlers put the
+	//selection back (see pmu_select_save)
+#if defined(__KERNEL__)
+	#define PMU_SELECT_LOCK( FLAGS ) local_irq_save(FLAGS)
+	#define PMU_SELECT_UNLOCK( FLAGS ) local_irq_restore(FLAGS)
+#else
+	#define PMU_SELECT_LOCK( FLAGS ) ( (FLAGS) = 0 )
+	#define PMU_SELECT_UNLOCK( FLAGS ) ( (void) (FLAGS) )
+#endif
+
+#if defined(__aarch64__)
+#include "perfmon_a64.h"
+#else
+#include "perfmon_cp15.h"
+#endif
+#if defined(PMU_BACKEND_PERF) || defined(PMU_BACKEND_RUNTIME)
+#include "perfmon_perf.h"
+#endif
+#if defined(PMU_BACKEND_EMU) || defined(PMU_BACKEND_RUNTIME)
+#include "perfmon_emu.h"
+#endif
+
+#if defined(PMU_BACKEND_RUNTIME)
+
+	extern const struct pmu_backend pmu_backend_cp15;
+	extern const struct pmu_backend pmu_backend_a64;
+	extern const struct pmu_backend pmu_backend_perf;
+	extern const struct pmu_backend pmu_backend_emu;
+	extern const struct pmu_backend pmu_backend_none;
+
+	//Backend in use, pmu_backend_none if none could be selected
+	extern const struct pmu_backend * pmu_backend;
+
+	//Use the named backend, or the first usable one if name is null
+	//Runs at startup with a null name
+	//Returns PMU_RETURN_NO_BACKEND if it can't be used here, keeping the backend in use
+	int pmu_backend_select(const char * name);
+
+	#define PMU_BACKEND_CALL( OP, ... ) ( pmu_backend->OP(__VA_ARGS__) )
+#if defined(__aarch64__)
+	//Keep the cheapest backend's counter reads inline
+	#define PMU_BACKEND_CALL_READ( OP, ... ) \
+		( pmu_backend == &pmu_backend_a64 ? a64_##OP(__VA_ARGS__) : pmu_backend->OP(__VA_ARGS__) )
+#elif defined(__arm__)
+	#define PMU_BACKEND_CALL_READ( OP, ... ) \
+		( pmu_backend == &pmu_backend_cp15 ? cp15_##OP(__VA_ARGS__) : pmu_backend->OP(__VA_ARGS__) )
+#else
+	#define PMU_BACKEND_CALL_READ PMU_BACKEND_CALL
+#endif
+
+#elif defined(PMU_BACKEND_PERF)
+	#define PMU_BACKEND_CALL( OP, ... ) perf_##OP(__VA_ARGS__)
+	#define PMU_BACKEND_CALL_READ PMU_BACKEND_CALL
+#elif defined(PMU_BACKEND_EMU)
+	#define PMU_BACKEND_CALL( OP, ... ) emu_##OP(__VA_ARGS__)
+	#define PMU_BACKEND_CALL_READ PMU_BACKEND_CALL
+#elif defined(__aarch64__)
+	#define PMU_BACKEND_CALL( OP, ... ) a64_##OP(__VA_ARGS__)
+	#define PMU_BACKEND_CALL_READ PMU_BACKEND_CALL
+#else
+	#define PMU_BACKEND_CALL( OP, ... ) cp15_##OP(__VA_ARGS__)
+	#define PMU_BACKEND_CALL_READ PMU_BACKEND_CALL
+#endif
+
+
 //PMCR: Performance Monitor Control Register
 //https://developer.arm.com/documentation/ddi0500/j/Performance-Monitor-Unit/AArch32-PMU-register-descriptions/Performance-Monitors-Control-Register?lang=en
 
@@ -64,14 +239,12 @@ const static unsigned CLR = 0;
 
 	//Get current flags from PMCR
 	static inline unsigned pmcr_read(void) {
-		unsigned x = 0;
-		asm volatile ("MRC p15, 0, %0, c9, c12, 0\t\n" : "=r" (x));
-		return x;
+		return PMU_BACKEND_CALL(pmcr_read);
 	}
 
 	//Write to PMCR register
 	static inline void pmcr_write(unsigned x) {
-		asm volatile ("MCR p15, 0, %0, c9, c12, 0\t\n" :: "r" (x));
+		PMU_BACKEND_CALL(pmcr_write, x);
 	}
 
 	//Set PMCR flags specified, keeping other flags as-is
@@ -127,27 +300,23 @@ const static unsigned CLR = 0;
 	const static unsigned PMCNTEN_CYCLE_CTR = 1 << 31;
 
 	static inline unsigned pmcntenset_read(void) {
-		unsigned x = 0;
-		asm volatile ("MRC p15, 0, %0, c9, c12, 1\t\n" : "=r" (x));
-		return x;
+		return PMU_BACKEND_CALL(pmcnten_read);
 	}
 
 	//Set PMCNTEN flags specified (writing 0 to a bit does nothing)
 	//Set with the PMCNTENSET register
 	static inline void pmcntenset_write(unsigned x) {
-		asm volatile ("MCR p15, 0, %0, c9, c12, 1\t\n" :: "r" (x));
+		PMU_BACKEND_CALL(pmcntenset_write, x);
 	}
 
 	static inline unsigned pmcntenclr_read(void) {
-		unsigned x = 0;
-		asm volatile ("MRC p15, 0, %0, c9, c12, 2\t\n" : "=r" (x));
-		return x;
+		return PMU_BACKEND_CALL(pmcnten_read);
 	}
 
 	//Clear specified PMCNTEN flags (writing 0 to a bit does nothing)
 	//Clear with the PMCNTENCLR register
 	static inline void pmcntenclr_write(unsigned x) {
-		asm volatile ("MCR p15, 0, %0, c9, c12, 2\t\n" :: "r" (x));
+		PMU_BACKEND_CALL(pmcntenclr_write, x);
 	}
 
 	//Set specified events
@@ -211,661 +380,107 @@ const static unsigned CLR = 0;
 	const static unsigned EVT_L1D_CACHE_ALLOCATE = 0x1F;
 	const static unsigned EVT_L2D_CACHE_ALLOCATE = 0x20;
 
-	#define STR(x) #x
-	#define XSTR(s) STR(s)
-	#define PMEVTYPER_READ( N, EVENT ) asm volatile ("MRC p15, 0, %0, c14, c12, " XSTR(N) "\t\n" : "=r" (EVENT))
-	#define PMEVTYPER_WRITE( N, EVENT ) asm volatile ("MRC p15, 0, %0, c14, c12, " XSTR(N) "\t\n" :: "r" (EVENT))
-	#define PMEVCNTR_READ( N, COUNT ) asm volatile ("MRC p15, 0, %0, c14, c8, " XSTR(N) "\t\n" : "=r" (COUNT))
-	#define PMEVCNTR_WRITE( N, COUNT ) asm volatile ("MRC p15, 0, %0, c14, c8, " XSTR(N) "\t\n" :: "r" (COUNT))
+	//Cortex-A53 implementation-defined events
+	//Not listed in PMCEID0/1, available when MIDR says the core is a Cortex-A53 (see pmu_event_available)
+	//https://developer.arm.com/documentation/ddi0500/j/Performance-Monitor-Unit/Events
+	const static unsigned EVT_A53_BUS_ACCESS_RD = 0x60; //Bus access, read
+	const static unsigned EVT_A53_BUS_ACCESS_WR = 0x61; //Bus access, write
+	const static unsigned EVT_A53_BR_INDIRECT_SPEC = 0x7A; //Indirect branch speculatively executed
+	const static unsigned EVT_A53_EXC_IRQ = 0x86; //Exception taken, IRQ
+	const static unsigned EVT_A53_EXC_FIQ = 0x87; //Exception taken, FIQ
+	const static unsigned EVT_A53_EXT_MEM_REQ = 0xC0; //External memory request
+	const static unsigned EVT_A53_EXT_MEM_REQ_NC = 0xC1; //Non-cacheable external memory request
+	const static unsigned EVT_A53_PREFETCH_LINEFILL = 0xC2; //Linefill because of prefetch
+	const static unsigned EVT_A53_ICACHE_THROTTLE = 0xC3; //Instruction cache throttle occurred
+	const static unsigned EVT_A53_READ_ALLOC_ENTER = 0xC4; //Entering read allocate mode
+	const static unsigned EVT_A53_READ_ALLOC = 0xC5; //Read allocate mode
+	const static unsigned EVT_A53_PRE_DECODE_ERR = 0xC6; //Pre-decode error
+	const static unsigned EVT_A53_STALL_SB_FULL = 0xC7; //Data write stalls the pipeline because the store buffer is full
+	const static unsigned EVT_A53_EXT_SNOOP = 0xC8; //SCU snooped data from another CPU for this CPU
+	const static unsigned EVT_A53_BR_COND = 0xC9; //Conditional branch executed
+	const static unsigned EVT_A53_BR_INDIRECT_MISPRED = 0xCA; //Indirect branch mispredicted
+	const static unsigned EVT_A53_BR_INDIRECT_ADDR_MISPRED = 0xCB; //Indirect branch mispredicted because of address miscompare
+	const static unsigned EVT_A53_BR_COND_MISPRED = 0xCC; //Conditional branch mispredicted
+	const static unsigned EVT_A53_L1I_CACHE_ERR = 0xD0; //L1 instruction cache (data or tag) memory error
+	const static unsigned EVT_A53_L1D_CACHE_ERR = 0xD1; //L1 data cache (data, tag or dirty) memory error
+	const static unsigned EVT_A53_TLB_ERR = 0xD2; //TLB memory error
+	const static unsigned EVT_A53_OTHER_IQ_DEP_STALL = 0xE0; //Cycles the issue queue is empty, for no reason below
+	const static unsigned EVT_A53_IC_DEP_STALL = 0xE1; //Cycles the issue queue is empty during an instruction cache miss
+	const static unsigned EVT_A53_IUTLB_DEP_STALL = 0xE2; //Cycles the issue queue is empty during an instruction micro-TLB miss
+	const static unsigned EVT_A53_DECODE_DEP_STALL = 0xE3; //Cycles the issue queue is empty during a pre-decode error
+	const static unsigned EVT_A53_OTHER_INTERLOCK_STALL = 0xE4; //Cycles of interlocks other than the ones below
+	const static unsigned EVT_A53_AGU_DEP_STALL = 0xE5; //Cycles of interlocks on a load/store waiting for its address
+	const static unsigned EVT_A53_SIMD_DEP_STALL = 0xE6; //Cycles of interlocks on an Advanced SIMD or floating-point instruction
+	const static unsigned EVT_A53_LD_DEP_STALL = 0xE7; //Cycles stalled on a load miss
+	const static unsigned EVT_A53_ST_DEP_STALL = 0xE8; //Cycles stalled on a store
+
+	//Events covered by pmu_event_available, 0x00-0xFF
+	#define PMU_EVENT_SPACE 256
+
+	//PMEVTYPER filter bits, at the same positions in the AARCH32 register and the low word of the AARCH64 one
+	//https://developer.arm.com/docs/ddi0595/f/aarch64-system-registers/pmevtypern_el0
+	const static unsigned PMEVTYPER_P = 1u << 31; //Don't count at EL1 (kernel)
+	const static unsigned PMEVTYPER_U = 1 << 30; //Don't count at EL0 (user)
+	const static unsigned PMEVTYPER_NSK = 1 << 29; //Non-secure EL1: count if different from P
+	const static unsigned PMEVTYPER_NSU = 1 << 28; //Non-secure EL0: count if different from U
+	const static unsigned PMEVTYPER_NSH = 1 << 27; //Count at EL2 (hypervisor)
+	const static unsigned PMEVTYPER_EVENT = (1 << 10) - 1; //Event number, bits 9:0
+
+	//Event counters and event type registers of the backend
+	//With the CP15 backend, PMU_ACCESS_INDIRECT picks PMSELR/PMXEV* over the per-counter registers
+	//(see perfmon_cp15.h)
 
 	//Read from event type register n
 	static inline unsigned pmevtyper_read(unsigned n) {
-		unsigned event;
-		switch(n) {
-#if NEVENTS_ARCH_MAX > 0
-			case 0 :
-				PMEVTYPER_READ( 0, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 1
-			case 1 :
-				PMEVTYPER_READ( 1, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 2
-			case 2 :
-				PMEVTYPER_READ( 2, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 3
-			case 3 :
-				PMEVTYPER_READ( 3, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 4
-			case 4 :
-				PMEVTYPER_READ( 4, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 5
-			case 5 :
-				PMEVTYPER_READ( 5, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 6
-			case 6 :
-				PMEVTYPER_READ( 6, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 7
-			case 7 :
-				PMEVTYPER_READ( 7, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 8
-			case 8 :
-				PMEVTYPER_READ( 8, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 9
-			case 9 :
-				PMEVTYPER_READ( 9, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 10
-			case 10 :
-				PMEVTYPER_READ( 10, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 11
-			case 11 :
-				PMEVTYPER_READ( 11, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 12
-			case 12 :
-				PMEVTYPER_READ( 12, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 13
-			case 13 :
-				PMEVTYPER_READ( 13, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 14
-			case 14 :
-				PMEVTYPER_READ( 14, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 15
-			case 15 :
-				PMEVTYPER_READ( 15, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 16
-			case 16 :
-				PMEVTYPER_READ( 16, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 17
-			case 17 :
-				PMEVTYPER_READ( 17, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 18
-			case 18 :
-				PMEVTYPER_READ( 18, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 19
-			case 19 :
-				PMEVTYPER_READ( 19, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 20
-			case 20 :
-				PMEVTYPER_READ( 20, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 21
-			case 21 :
-				PMEVTYPER_READ( 21, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 22
-			case 22 :
-				PMEVTYPER_READ( 22, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 23
-			case 23 :
-				PMEVTYPER_READ( 23, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 24
-			case 24 :
-				PMEVTYPER_READ( 24, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 25
-			case 25 :
-				PMEVTYPER_READ( 25, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 26
-			case 26 :
-				PMEVTYPER_READ( 26, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 27
-			case 27 :
-				PMEVTYPER_READ( 27, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 28
-			case 28 :
-				PMEVTYPER_READ( 28, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 29
-			case 29 :
-				PMEVTYPER_READ( 29, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 30
-			case 30 :
-				PMEVTYPER_READ( 30, event );
-				break;
-#endif
-		}
-
-		return event;
+		return PMU_BACKEND_CALL(pmevtyper_read, n);
 	}
 
 	//Write to event type register n
 	static inline void pmevtyper_write(unsigned n, unsigned event) {
-		switch(n) {
-#if NEVENTS_ARCH_MAX > 0
-			case 0 :
-				PMEVTYPER_WRITE( 0, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 1
-			case 1 :
-				PMEVTYPER_WRITE( 1, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 2
-			case 2 :
-				PMEVTYPER_WRITE( 2, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 3
-			case 3 :
-				PMEVTYPER_WRITE( 3, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 4
-			case 4 :
-				PMEVTYPER_WRITE( 4, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 5
-			case 5 :
-				PMEVTYPER_WRITE( 5, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 6
-			case 6 :
-				PMEVTYPER_WRITE( 6, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 7
-			case 7 :
-				PMEVTYPER_WRITE( 7, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 8
-			case 8 :
-				PMEVTYPER_WRITE( 8, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 9
-			case 9 :
-				PMEVTYPER_WRITE( 9, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 10
-			case 10 :
-				PMEVTYPER_WRITE( 10, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 11
-			case 11 :
-				PMEVTYPER_WRITE( 11, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 12
-			case 12 :
-				PMEVTYPER_WRITE( 12, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 13
-			case 13 :
-				PMEVTYPER_WRITE( 13, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 14
-			case 14 :
-				PMEVTYPER_WRITE( 14, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 15
-			case 15 :
-				PMEVTYPER_WRITE( 15, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 16
-			case 16 :
-				PMEVTYPER_WRITE( 16, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 17
-			case 17 :
-				PMEVTYPER_WRITE( 17, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 18
-			case 18 :
-				PMEVTYPER_WRITE( 18, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 19
-			case 19 :
-				PMEVTYPER_WRITE( 19, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 20
-			case 20 :
-				PMEVTYPER_WRITE( 20, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 21
-			case 21 :
-				PMEVTYPER_WRITE( 21, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 22
-			case 22 :
-				PMEVTYPER_WRITE( 22, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 23
-			case 23 :
-				PMEVTYPER_WRITE( 23, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 24
-			case 24 :
-				PMEVTYPER_WRITE( 24, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 25
-			case 25 :
-				PMEVTYPER_WRITE( 25, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 26
-			case 26 :
-				PMEVTYPER_WRITE( 26, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 27
-			case 27 :
-				PMEVTYPER_WRITE( 27, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 28
-			case 28 :
-				PMEVTYPER_WRITE( 28, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 29
-			case 29 :
-				PMEVTYPER_WRITE( 29, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 30
-			case 30 :
-				PMEVTYPER_WRITE( 30, event );
-				break;
-#endif
-		}
+		PMU_BACKEND_CALL(pmevtyper_write, n, event);
 	}
 
 	//Read from event count register n
 	static inline unsigned pmevcntr_read(unsigned n) {
-		unsigned event;
-		switch(n) {
-#if NEVENTS_ARCH_MAX > 0
-			case 0 :
-				PMEVCNTR_READ( 0, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 1
-			case 1 :
-				PMEVCNTR_READ( 1, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 2
-			case 2 :
-				PMEVCNTR_READ( 2, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 3
-			case 3 :
-				PMEVCNTR_READ( 3, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 4
-			case 4 :
-				PMEVCNTR_READ( 4, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 5
-			case 5 :
-				PMEVCNTR_READ( 5, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 6
-			case 6 :
-				PMEVCNTR_READ( 6, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 7
-			case 7 :
-				PMEVCNTR_READ( 7, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 8
-			case 8 :
-				PMEVCNTR_READ( 8, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 9
-			case 9 :
-				PMEVCNTR_READ( 9, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 10
-			case 10 :
-				PMEVCNTR_READ( 10, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 11
-			case 11 :
-				PMEVCNTR_READ( 11, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 12
-			case 12 :
-				PMEVCNTR_READ( 12, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 13
-			case 13 :
-				PMEVCNTR_READ( 13, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 14
-			case 14 :
-				PMEVCNTR_READ( 14, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 15
-			case 15 :
-				PMEVCNTR_READ( 15, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 16
-			case 16 :
-				PMEVCNTR_READ( 16, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 17
-			case 17 :
-				PMEVCNTR_READ( 17, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 18
-			case 18 :
-				PMEVCNTR_READ( 18, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 19
-			case 19 :
-				PMEVCNTR_READ( 19, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 20
-			case 20 :
-				PMEVCNTR_READ( 20, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 21
-			case 21 :
-				PMEVCNTR_READ( 21, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 22
-			case 22 :
-				PMEVCNTR_READ( 22, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 23
-			case 23 :
-				PMEVCNTR_READ( 23, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 24
-			case 24 :
-				PMEVCNTR_READ( 24, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 25
-			case 25 :
-				PMEVCNTR_READ( 25, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 26
-			case 26 :
-				PMEVCNTR_READ( 26, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 27
-			case 27 :
-				PMEVCNTR_READ( 27, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 28
-			case 28 :
-				PMEVCNTR_READ( 28, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 29
-			case 29 :
-				PMEVCNTR_READ( 29, event );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 30
-			case 30 :
-				PMEVCNTR_READ( 30, event );
-				break;
-#endif
-		}
-
-		return event;
+		return PMU_BACKEND_CALL_READ(pmevcntr_read, n);
 	}
 
 	//Write to event counter register n
 	static inline void pmevcntr_write(unsigned n, unsigned count) {
-		switch(n) {
-#if NEVENTS_ARCH_MAX > 0
-			case 0 :
-				PMEVCNTR_WRITE( 0, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 1
-			case 1 :
-				PMEVCNTR_WRITE( 1, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 2
-			case 2 :
-				PMEVCNTR_WRITE( 2, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 3
-			case 3 :
-				PMEVCNTR_WRITE( 3, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 4
-			case 4 :
-				PMEVCNTR_WRITE( 4, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 5
-			case 5 :
-				PMEVCNTR_WRITE( 5, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 6
-			case 6 :
-				PMEVCNTR_WRITE( 6, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 7
-			case 7 :
-				PMEVCNTR_WRITE( 7, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 8
-			case 8 :
-				PMEVCNTR_WRITE( 8, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 9
-			case 9 :
-				PMEVCNTR_WRITE( 9, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 10
-			case 10 :
-				PMEVCNTR_WRITE( 10, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 11
-			case 11 :
-				PMEVCNTR_WRITE( 11, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 12
-			case 12 :
-				PMEVCNTR_WRITE( 12, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 13
-			case 13 :
-				PMEVCNTR_WRITE( 13, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 14
-			case 14 :
-				PMEVCNTR_WRITE( 14, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 15
-			case 15 :
-				PMEVCNTR_WRITE( 15, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 16
-			case 16 :
-				PMEVCNTR_WRITE( 16, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 17
-			case 17 :
-				PMEVCNTR_WRITE( 17, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 18
-			case 18 :
-				PMEVCNTR_WRITE( 18, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 19
-			case 19 :
-				PMEVCNTR_WRITE( 19, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 20
-			case 20 :
-				PMEVCNTR_WRITE( 20, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 21
-			case 21 :
-				PMEVCNTR_WRITE( 21, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 22
-			case 22 :
-				PMEVCNTR_WRITE( 22, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 23
-			case 23 :
-				PMEVCNTR_WRITE( 23, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 24
-			case 24 :
-				PMEVCNTR_WRITE( 24, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 25
-			case 25 :
-				PMEVCNTR_WRITE( 25, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 26
-			case 26 :
-				PMEVCNTR_WRITE( 26, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 27
-			case 27 :
-				PMEVCNTR_WRITE( 27, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 28
-			case 28 :
-				PMEVCNTR_WRITE( 28, count );
-				break;
-#endif
-#if NEVENTS_ARCH_MAX > 29
-			case 29 :
-				PMEVCNTR_WRITE( 29, count );
-				break;
+		PMU_BACKEND_CALL(pmevcntr_write, n, count);
+	}
+
+	//Save the interrupted code's PMSELR selection on entry to a userspace signal handler
+	//that accesses counters, and put it back with pmu_select_restore on exit
+	//pmu_profile_tick and pmu_mux_rotate do this themselves
+	//Nothing to do without indirect access or in the kernel, where the pair masks interrupts
+#if defined(PMU_ACCESS_INDIRECT) && !defined(__KERNEL__) && !defined(PMU_BACKEND_PERF) && !defined(PMU_BACKEND_EMU) \
+	&& (defined(__arm__) || defined(__aarch64__))
+	#define PMU_SELECT_SAVED 1
+#if defined(PMU_BACKEND_RUNTIME) && defined(__aarch64__)
+	#define PMU_SELECT_BACKEND ( pmu_backend == &pmu_backend_a64 )
+#elif defined(PMU_BACKEND_RUNTIME)
+	#define PMU_SELECT_BACKEND ( pmu_backend == &pmu_backend_cp15 )
+#else
+	#define PMU_SELECT_BACKEND 1
+#endif
+#else
+	#define PMU_SELECT_SAVED 0
+	#define PMU_SELECT_BACKEND 0
+#endif
+
+	static inline unsigned pmu_select_save(void) {
+#if PMU_SELECT_SAVED
+		if (PMU_SELECT_BACKEND) return pmselr_read();
 #endif
-#if NEVENTS_ARCH_MAX > 30
-			case 30 :
-				PMEVCNTR_WRITE( 30, count );
-				break;
+		return 0;
+	}
+
+	static inline void pmu_select_restore(unsigned n) {
+#if PMU_SELECT_SAVED
+		if (PMU_SELECT_BACKEND) pmselr_write(n);
 #endif
-		}
+		(void) n;
 	}
 
 	/*
@@ -884,7 +499,7 @@ const static unsigned CLR = 0;
 		Inspired by similar methods in the Linux Arm global timer driver:
 		https://github.com/torvalds/linux/blob/master/drivers/clocksource/arm_global_timer.c
 	*/
-	static unsigned long long pmevcntr_read_64(unsigned n) {		
+	static inline unsigned long long pmevcntr_read_64(unsigned n) {		
 		unsigned low, high, old_high;
 		high = pmevcntr_read(n + 1);
 		do {
@@ -958,16 +573,22 @@ const static unsigned CLR = 0;
 	
 	//Get lower 32-bits of cycle count
 	static inline unsigned pmccntr_read_32(void) {
-			unsigned cycle_count;
-			asm volatile ("MRC p15, 0, %0, c9, c13, 0" : "=r" (cycle_count));
-			return cycle_count;
+		return PMU_BACKEND_CALL_READ(pmccntr_read);
 	}
 
 	//Get full 64-bits of cycle count
 	static inline unsigned long long pmccntr_read_64(void) {
-			unsigned low, high;
-			asm volatile ("MRRC p15, 0, %0, %1, c9" : "=r" (low), "=r" (high));
-			return ULL(low, high);
+		return PMU_BACKEND_CALL_READ(pmccntr_read);
+	}
+
+	//Set lower 32-bits of cycle count
+	static inline void pmccntr_write_32(unsigned cycle_count) {
+		PMU_BACKEND_CALL(pmccntr_write, ((pmccntr_read_64() >> 32) << 32) | cycle_count);
+	}
+
+	//Set full 64-bits of cycle count
+	static inline void pmccntr_write_64(unsigned long long cycle_count) {
+		PMU_BACKEND_CALL(pmccntr_write, cycle_count);
 	}
 
 	//Get cycle count value
@@ -982,28 +603,134 @@ const static unsigned CLR = 0;
 	}
 
 
+//PMOVSR: Performance Monitors Overflow Flag Status Register
+//https://developer.arm.com/docs/ddi0595/f/aarch32-system-registers/pmovsr
+//Two registers:
+//	PMOVSR: Write 1: clears the corresponding overflow flag
+//	PMOVSSET: Write 1: sets the corresponding overflow flag
+//	Reading either returns overflow flags
+//Bits 0-30 correspond to event counters, bit 31 to the cycle counter, as in PMCNTEN
+
+	static inline unsigned pmovsr_read(void) {
+		return PMU_BACKEND_CALL(pmovsr_read);
+	}
+
+	//Clear specified overflow flags
+	static inline void pmovsr_write(unsigned x) {
+		PMU_BACKEND_CALL(pmovsr_write, x);
+	}
+
+	//Set specified overflow flags
+	static inline void pmovsset_write(unsigned x) {
+		PMU_BACKEND_CALL(pmovsset_write, x);
+	}
+
+	//Check if event counter n has overflowed
+	static inline char pmovsr_isset(unsigned n) {
+		return (pmovsr_read() >> n) & 1;
+	}
+
+	//Clear overflow flag for event counter n
+	static inline void pmovsr_clear(unsigned n) {
+		pmovsr_write(1 << n);
+	}
+
+
+//PMINTEN: Performance Monitors Interrupt Enable
+//https://developer.arm.com/docs/ddi0595/f/aarch32-system-registers/pmintenset
+//Two registers:
+//	PMINTENSET: Write 1: raise an interrupt when the corresponding counter overflows
+//	PMINTENCLR: Write 1: stop raising interrupts for the corresponding counter
+//	Reading either returns interrupts enabled
+//Bits match PMCNTEN
+
+	static inline unsigned pmintenset_read(void) {
+		return PMU_BACKEND_CALL(pminten_read);
+	}
+
+	static inline void pmintenset_write(unsigned x) {
+		PMU_BACKEND_CALL(pmintenset_write, x);
+	}
+
+	static inline unsigned pmintenclr_read(void) {
+		return PMU_BACKEND_CALL(pminten_read);
+	}
+
+	static inline void pmintenclr_write(unsigned x) {
+		PMU_BACKEND_CALL(pmintenclr_write, x);
+	}
+
+	//Raise an interrupt when event counter n overflows
+	static inline void pminten_enable(unsigned n) {
+		pmintenset_write(1 << n);
+	}
+
+	//Stop raising interrupts for event counter n
+	static inline void pminten_disable(unsigned n) {
+		pmintenclr_write(1 << n);
+	}
+
+
 //Miscellaneous functionality based on registers listed on this page:
 //https://developer.arm.com/documentation/ddi0500/j/Performance-Monitor-Unit/AArch32-PMU-register-summary?lang=en
 
 	//PMUSERENR: Performance Monitors User Enable Register
+	//https://developer.arm.com/docs/ddi0595/f/aarch32-system-registers/pmuserenr
 	//Enable and disable performance monitoring from userspace
+	//Only writable at PL1, so userspace needs a kernel module (perfmon_user_mod.ko) to set it
+	//Applies to the core it is written on
+
+	const static unsigned PMUSERENR_ENABLE = 1 << 0; //Userspace access to all PMU registers
+	const static unsigned PMUSERENR_SW_INCREMENT = 1 << 1; //Userspace writes to PMSWINC
+	const static unsigned PMUSERENR_CYCLE_READ = 1 << 2; //Userspace reads of PMCCNTR
+	const static unsigned PMUSERENR_EVENT_READ = 1 << 3; //Userspace reads of the event counters
+	const static unsigned PMUSERENR_USER = PMUSERENR_ENABLE | PMUSERENR_CYCLE_READ | PMUSERENR_EVENT_READ;
 
 	static inline unsigned pmuserenr_read(void) {
-		unsigned x = 0;
-		asm volatile ("MRC p15, 0, %0, c9, c14, 0\t\n" : "=r" (x));
-		return x;
+		return PMU_BACKEND_CALL(pmuserenr_read);
 	}
 
 	static inline void pmuserenr_write(unsigned x) {
-		asm volatile ("MCR p15, 0, %0, c9, c14, 0\t\n" :: "r" (x));
+		PMU_BACKEND_CALL(pmuserenr_write, x);
 	}
 	
 	static inline void pmu_user_enable() {
-		pmcr_write(SET);
+		pmuserenr_write(pmuserenr_read() | PMUSERENR_USER);
 	}
 
 	static inline void pmu_user_disable() {
-		pmcr_write(CLR);
+		pmuserenr_write(pmuserenr_read() & ~PMUSERENR_USER);
+	}
+
+	//MPIDR: Multiprocessor Affinity Register
+	//https://developer.arm.com/documentation/ddi0500/j/System-Control/AArch32-register-descriptions/Multiprocessor-Affinity-Register
+	//Aff0 (bits 7:0) is the core number within the cluster
+	//PL1 only in AARCH32, so pmu_cpu doesn't use it
+
+	static inline unsigned mpidr_read(void) {
+		return PMU_BACKEND_CALL(mpidr_read);
+	}
+
+	//MIDR: Main ID Register
+	//https://developer.arm.com/documentation/ddi0500/j/System-Control/AArch32-register-descriptions/Main-ID-Register
+	//Implementer (bits 31:24) and primary part number (bits 15:4) identify the core
+	//Only the kernel reads the register, userspace goes through pmu_midr_user
+
+	const static unsigned MIDR_IMPLEMENTER_SHIFT = 24;
+	const static unsigned MIDR_PARTNUM_SHIFT = 4;
+	const static unsigned MIDR_PARTNUM = 0xfff << 4;
+	const static unsigned MIDR_IMPLEMENTER_ARM = 0x41;
+	const static unsigned MIDR_PARTNUM_CORTEX_A53 = 0xD03;
+
+	static inline unsigned midr_read(void) {
+		return PMU_BACKEND_CALL(midr_read);
+	}
+
+	//Nonzero if the calling CPU is a Cortex-A53
+	static inline char midr_is_cortex_a53(void) {
+		unsigned midr = midr_read();
+		return midr >> MIDR_IMPLEMENTER_SHIFT == MIDR_IMPLEMENTER_ARM
+			&& (midr & MIDR_PARTNUM) >> MIDR_PARTNUM_SHIFT == MIDR_PARTNUM_CORTEX_A53;
 	}
 
 	//PMCEID0 and PMCEID1: Performance Monitors Common Event Identification Registers
@@ -1011,9 +738,7 @@ const static unsigned CLR = 0;
 	//https://developer.arm.com/documentation/ddi0500/j/Performance-Monitor-Unit/AArch32-PMU-register-descriptions/Performance-Monitors-Common-Event-Identification-Register-1?lang=en
 	
 	static inline unsigned pmceid0_read() {
-		unsigned x = 0;
-		asm volatile ("MCR p15, 0, %0, c9, c12, 6" : "=r" (x));
-		return x;
+		return PMU_BACKEND_CALL(pmceid_read, 0);
 	}
 
 	static inline char pmceid0_isset(unsigned x) {
@@ -1021,9 +746,7 @@ const static unsigned CLR = 0;
 	}
 
 	static inline unsigned pmceid1_read() {
-		unsigned x = 0;
-		asm volatile ("MCR p15, 0, %0, c9, c12, 7" : "=r" (x));
-		return x;
+		return PMU_BACKEND_CALL(pmceid_read, 1);
 	}
 
 	static inline char pmceid1_isset(unsigned x) {
@@ -1036,6 +759,8 @@ const static unsigned CLR = 0;
 	//Enumerate flags for event library
 	//Flags are not tied to the architecture, and are specific to our library
 	const static unsigned PMU_EVENTFLAG_64BIT = 1 << 0;
+	//64-bit range from a single counter, extended in software (see pmevcntr_read_ext)
+	const static unsigned PMU_EVENTFLAG_64BIT_SW = 1 << 1;
 
 	//Return values for event library
 	const static int PMU_RETURN_SUCCESS = 0;
@@ -1044,16 +769,403 @@ const static unsigned CLR = 0;
 	const static int PMU_RETURN_NO_OPEN_SLOT = -3;
 	const static int PMU_RETURN_EVENT_ALREADY = -4;
 	const static int PMU_RETURN_BAD_PTR = -5;
+	const static int PMU_RETURN_MUX_FULL = -6;
+	const static int PMU_RETURN_GROUP_TOO_LARGE = -7;
+	const static int PMU_RETURN_RING_EMPTY = -8;
+	const static int PMU_RETURN_NO_BACKEND = -9;
+	const static int PMU_RETURN_CONFIG_BUSY = -10;
+	const static int PMU_RETURN_NO_MEMORY = -11;
+	const static int PMU_RETURN_TIMER = -12;
+	const static int PMU_RETURN_TRACE_END = -13;
+	const static int PMU_RETURN_TRACE_CORRUPT = -14;
+	const static int PMU_RETURN_TRACE_IO = -15;
+	const static int PMU_RETURN_RING_FULL = -16;
+	const static int PMU_RETURN_SHM = -17;
+	const static int PMU_RETURN_SPEC_SYNTAX = -18;
+
+	//PMU_RETURN_NO_BACKEND if the runtime backend found no PMU to use here
+	static inline int pmu_backend_check(void) {
+#if defined(PMU_BACKEND_RUNTIME)
+		if (pmu_backend == &pmu_backend_none) return PMU_RETURN_NO_BACKEND;
+#endif
+		return PMU_RETURN_SUCCESS;
+	}
+
+	//Software-extended 64-bit counters
+	//A 32-bit counter plus a high word in memory, incremented on each PMOVSR overflow
+	//Frees the chain counter that PMU_EVENTFLAG_64BIT would use
+	//Overflows are folded into the high word either by pmu_overflow_handler
+	//(interrupt mode, see pmu_ext_interrupts) or by reads that see the overflow flag (polled mode)
+	//In polled mode the counter must be read at least once per 2^32 events
+	//The PMU is per-core: a counter must only be read and folded on its own CPU
+	struct pmu_ext_state {
+		unsigned seq; //Seqcount, odd while the high words are being updated
+		unsigned mask; //Event counters being extended
+		unsigned interrupt; //Nonzero if the overflow interrupt folds overflows
+		unsigned high[NEVENTS_ARCH_MAX]; //High words
+	};
+
+	//Per-CPU library state
+	//Each core has its own PMU, so everything tied to its registers is kept per CPU
+	//Each CPU's state is aligned and padded to whole cache lines so cores don't false-share
+	#ifndef PMU_MAX_CPUS
+	#ifdef __KERNEL__
+	#define PMU_MAX_CPUS NR_CPUS
+	#else
+	#define PMU_MAX_CPUS 64 //CPUs past this share state, raise it for bigger systems
+	#endif
+	#endif
+	#define PMU_CACHE_LINE 64 //Cortex-A53 L1 data cache line size
+
+	struct pmu_state {
+		//Registers saved by pmu_load and restored by pmu_unload
+		unsigned pmcr;
+		unsigned pmcnten;
+		unsigned pmevtype[NEVENTS_ARCH_MAX];
+		//PMUSERENR saved by perfmon_user_mod, which alone sets and restores it
+		unsigned pmuserenr;
+		//Event counters reserved by pmu_event_add, only updated with atomics (see pmu_slot_reserve)
+		unsigned slots;
+		//Event set generation, see pmu_config_write_begin
+		unsigned config_seq;
+		//Software-extended counters
+		struct pmu_ext_state ext;
+		//Bit per event in PMU_EVENT_SPACE this CPU implements, see pmu_event_available_init
+		unsigned available[PMU_EVENT_SPACE / 32];
+		unsigned available_init; //Nonzero once available is filled in
+	} __attribute__((aligned(PMU_CACHE_LINE)));
+	extern struct pmu_state pmu_state[PMU_MAX_CPUS];
+
+	//Index of the calling CPU into pmu_state
+	//Reads no system registers, so it is cheap enough for every counter read
+	//In userspace, the caller must be pinned to a CPU for this to stay meaningful
+	static inline unsigned pmu_cpu(void) {
+		return PMU_BACKEND_CALL_READ(cpu) % PMU_MAX_CPUS;
+	}
+
+	//State of the calling CPU
+	static inline struct pmu_state * pmu_state_this(void) {
+		return &pmu_state[pmu_cpu()];
+	}
+
+	//Event set seqlock
+	//Changes to PMEVTYPER/PMCNTEN through the library (add, remove, reset, ...) are bracketed by
+	//pmu_config_write_begin/end, and lookups of an event's counter retry if one overlapped them
+	//config_seq holds the writers in progress in its low bits and the generation above them:
+	//a writer can be interrupted by another (e.g. an interrupt adding an event), so writers
+	//don't exclude each other, they only keep readers retrying until all of them are done
+	#define PMU_CONFIG_WRITERS 0xffu
+	#define PMU_CONFIG_GENERATION ( PMU_CONFIG_WRITERS + 1 )
+
+	//Readers give up with PMU_RETURN_CONFIG_BUSY after this many attempts,
+	//as a reader interrupting a writer on its CPU would otherwise spin forever
+	#define PMU_CONFIG_RETRIES 64
+
+	static inline void pmu_config_write_begin(struct pmu_state * state) {
+		__atomic_add_fetch(&state->config_seq, 1, __ATOMIC_SEQ_CST);
+	}
+
+	//Return the new config_seq
+	static inline unsigned pmu_config_write_end(struct pmu_state * state) {
+		return __atomic_add_fetch(&state->config_seq, PMU_CONFIG_GENERATION - 1, __ATOMIC_SEQ_CST);
+	}
+
+	//Start reading the event set, returning the value to validate against
+	static inline unsigned pmu_config_read_begin(const struct pmu_state * state) {
+		return __atomic_load_n(&state->config_seq, __ATOMIC_ACQUIRE);
+	}
+
+	//Nonzero if a read started with pmu_config_read_begin must be retried
+	static inline int pmu_config_read_retry(const struct pmu_state * state, unsigned seq) {
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		return (seq & PMU_CONFIG_WRITERS) || __atomic_load_n(&state->config_seq, __ATOMIC_RELAXED) != seq;
+	}
+
+	//Fold overflow flags in mask into the high words, with the seqcount already held odd
+	static inline void pmu_ext_fold_locked(struct pmu_ext_state * ext, unsigned mask) {
+		unsigned ovs = pmovsr_read() & mask;
+		pmovsr_write(ovs);
+		while (ovs) {
+			ext->high[__builtin_ctz(ovs)]++;
+			ovs &= ovs - 1;
+		}
+	}
+
+	//Fold overflow flags in mask into the high words
+	//Only folds if the seqcount is still start_seq, so concurrent folders can't double count
+	static inline void pmu_ext_fold(struct pmu_ext_state * ext, unsigned start_seq, unsigned mask) {
+		if (!__atomic_compare_exchange_n(&ext->seq, &start_seq, start_seq + 1, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+		pmu_ext_fold_locked(ext, mask);
+		__atomic_store_n(&ext->seq, start_seq + 2, __ATOMIC_RELEASE);
+	}
+
+	/*
+		Read a software-extended 64-bit value from event counter n.
+		We get the 64-bit value by:
+			1. Reading the seqcount, retrying while a fold is in progress
+			2. Reading the high word
+			3. Reading the overflow flag, the counter, then the flag again
+			4. If the flag changed, the counter wrapped between reads: go to step 1
+			5. If the seqcount changed, a fold raced with us: go to step 1
+			6. If the flag is set, the counter has wrapped since the last fold,
+			   so the high word is one more than stored (and we fold it if polling)
+		Like pmevcntr_read_64, this never returns a torn value.
+	*/
+	static inline unsigned long long pmevcntr_read_ext_on(struct pmu_ext_state * ext, unsigned n) {
+		unsigned seq, high, low, ovf;
+		for (;;) {
+			seq = __atomic_load_n(&ext->seq, __ATOMIC_ACQUIRE);
+			if (seq & 1) continue;
+			high = ext->high[n];
+			ovf = pmovsr_read() & (1 << n);
+			low = pmevcntr_read(n);
+			if ((pmovsr_read() & (1 << n)) != ovf) continue;
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&ext->seq, __ATOMIC_RELAXED) != seq) continue;
+			break;
+		}
+		if (ovf) {
+			if (!ext->interrupt) pmu_ext_fold(ext, seq, 1 << n);
+			high++;
+		}
+		return ULL(low, high);
+	}
+
+	//pmevcntr_read_ext_on the calling CPU
+	static inline unsigned long long pmevcntr_read_ext(unsigned n) {
+		return pmevcntr_read_ext_on(&pmu_state_this()->ext, n);
+	}
+
+	//Event handle
+	//Returned by pmu_event_add_handle and pmu_event_handle_get
+	//Caches the counter register so reads skip the slot search
+	//Treat as opaque: fields may change between versions
+	struct pmu_event_handle {
+		unsigned slot; //Event counter register index
+		unsigned chained; //Nonzero if register slot+1 is chained for 64 bits
+		unsigned event; //Event being counted
+		unsigned extended; //Nonzero if extended to 64 bits in software
+		unsigned config; //Event set generation it was made in (config_seq)
+	};
+
+	//Nonzero if the event set changed since the handle was made, so it may name the wrong counter
+	//Reads through a handle don't check, to keep them to a register read
+	static inline int pmu_handle_stale_on(const struct pmu_state * state, const struct pmu_event_handle * handle) {
+		return pmu_config_read_begin(state) != handle->config;
+	}
+
+	//pmu_handle_stale_on the calling CPU
+	static inline int pmu_handle_stale(const struct pmu_event_handle * handle) {
+		return pmu_handle_stale_on(pmu_state_this(), handle);
+	}
+
+	//Get lower 32-bits of event count from a handle
+	//Costs a single event counter register read
+	static inline unsigned pmu_handle_read_32(const struct pmu_event_handle * handle) {
+		return pmevcntr_read(handle->slot);
+	}
+
+	//Get event count value from a handle
+	//Chained events read high/low/high, retrying on overflow
+	static inline unsigned long long pmu_handle_read_on(struct pmu_state * state, const struct pmu_event_handle * handle) {
+		if (handle->chained) return pmevcntr_read_64(handle->slot);
+		if (handle->extended) return pmevcntr_read_ext_on(&state->ext, handle->slot);
+		return (unsigned long long) pmevcntr_read(handle->slot);
+	}
+
+	//pmu_handle_read_on the calling CPU
+	//Only extended counters need the CPU's state, so plain and chained reads don't look it up
+	static inline unsigned long long pmu_handle_read(const struct pmu_event_handle * handle) {
+		if (handle->chained) return pmevcntr_read_64(handle->slot);
+		if (handle->extended) return pmevcntr_read_ext_on(&pmu_state_this()->ext, handle->slot);
+		return (unsigned long long) pmevcntr_read(handle->slot);
+	}
+
+	//One event of a batch, see pmu_event_add_batch
+	struct pmu_event_spec {
+		unsigned event;
+		unsigned flags; //PMU_EVENTFLAG_*
+		unsigned filter; //PMEVTYPER_P/U/NSK/NSU/NSH bits, 0 to count at EL0 and EL1
+	};
+
+	//Snapshot of every event counter and the cycle counter, taken together
+	//Filled by pmu_snapshot
+	struct pmu_snapshot {
+		unsigned enabled; //PMCNTENSET when the snapshot was taken
+		unsigned nevents; //Number of event counters read
+		unsigned count[NEVENTS_ARCH_MAX]; //Raw event counter values, meaningful where enabled
+		unsigned long long cycles; //Cycle counter value
+		unsigned skew; //Cycles elapsed between first and last counter read
+	};
+
+	//Snapshot flags
+	//Briefly clear PMCR.E around the reads so all counters are cut at the same instant
+	const static unsigned PMU_SNAPSHOT_CONSISTENT = 1 << 0;
+
+	//Get event count value for a handle from a snapshot
+	//Chained halves are only guaranteed to agree with PMU_SNAPSHOT_CONSISTENT
+	static inline unsigned long long pmu_snapshot_read(const struct pmu_snapshot * snap, const struct pmu_event_handle * handle) {
+		if (handle->chained) return ULL(snap->count[handle->slot], snap->count[handle->slot + 1]);
+		return (unsigned long long) snap->count[handle->slot];
+	}
+
+	//Region measurement
+	//pmu_region_begin/pmu_region_end give per-counter deltas for the code between them,
+	//less the cost of the begin/end sequence itself as measured by pmu_region_calibrate
+	//Nothing calibrates at init: run pmu_region_calibrate after programming events, and again
+	//whenever the enabled events change. Until then, or on another event set, deltas are exact
+	//but include the begin/end cost, see pmu_region_delta.corrected
+	struct pmu_region {
+		struct pmu_snapshot start;
+		unsigned chained; //Low registers of chained pairs at begin
+	};
+
+	//Deltas returned by pmu_region_end
+	//Chained events hold the full 64-bit delta in the low register's entry
+	struct pmu_region_delta {
+		unsigned enabled; //Event counters enabled for the whole region
+		unsigned corrected; //1 if the calibrated bias was subtracted
+		unsigned long long count[NEVENTS_ARCH_MAX];
+		unsigned long long cycles;
+	};
+
+	//Cost of an empty region, subtracted from every measurement
+	//Minimum over reps empty begin/end pairs
+	//Only valid for the event set programmed when it was measured
+	struct pmu_region_bias {
+		unsigned enabled; //Counters enabled when calibrated
+		unsigned chained; //Low registers of chained pairs
+		unsigned reps; //Number of empty regions measured
+		unsigned long long count[NEVENTS_ARCH_MAX];
+		unsigned long long cycles;
+	};
+	extern struct pmu_region_bias pmu_region_calibration;
+
+	//Default number of empty regions measured by pmu_region_calibrate
+	#define PMU_REGION_CALIBRATE_REPS 64
+
+	//Get event count delta for a handle from a region
+	static inline unsigned long long pmu_region_delta_read(const struct pmu_region_delta * delta, const struct pmu_event_handle * handle) {
+		return delta->count[handle->slot];
+	}
 
 	//Public Functions
+	void pmu_event_available_init(void);
 	char pmu_event_available(unsigned event);
 	int pmu_event_add(unsigned event, unsigned flags);
+	int pmu_event_add_handle(unsigned event, unsigned flags, struct pmu_event_handle * handle);
+	int pmu_event_add_batch(const struct pmu_event_spec * specs, unsigned n, struct pmu_event_handle * handles);
+	int pmu_event_handle_get(unsigned event, struct pmu_event_handle * handle);
 	int pmu_event_remove(unsigned event, unsigned flags);
 	int pmu_event_reset(unsigned event, unsigned flags);
 	int pmu_event_read_32(unsigned event, unsigned flags, unsigned * value);
-	int pmu_event_read(unsigned event, unsigned flags, unsigned long long * value);
+	int pmu_event_get(unsigned event, unsigned flags, unsigned long long * value);
+	int pmu_snapshot(struct pmu_snapshot * snap, unsigned flags);
+	int pmu_region_calibrate(unsigned reps);
+	int pmu_region_begin(struct pmu_region * region);
+	int pmu_region_end(struct pmu_region * region, struct pmu_region_delta * delta);
 	void pmu_disable_all(void);
 
+//Event-based sampling
+//Preloads a counter to -period so it overflows, and raises an interrupt, every period events
+//The interrupt handler calls pmu_overflow_handler, which records the interrupted PC
+//and a snapshot of all counters into a ring buffer, then preloads the counter again
+//It also folds overflows of software-extended counters when pmu_ext_interrupts is enabled
+//A software-extended counter can't also be sampled
+//pmu_overflow_handler only touches the PMU through the register functions above
+
+	#define PMU_SAMPLE_RING_SIZE 256 //Must be a power of two
+
+	//One overflow sample
+	struct pmu_sample {
+		unsigned long pc; //Interrupted program counter
+		unsigned slot; //Event counter that overflowed
+		unsigned event; //Event it was counting
+		unsigned long long cycles; //Cycle counter
+		unsigned count[NEVENTS_ARCH_MAX]; //Raw event counter values
+	};
+
+	//Single-producer single-consumer ring of samples
+	//The producer is the overflow interrupt on one CPU
+	struct pmu_sample_ring {
+		unsigned head; //Next record to write, only written by the producer
+		unsigned tail; //Next record to read, only written by the consumer
+		unsigned dropped; //Samples lost because the ring was full
+		struct pmu_sample records[PMU_SAMPLE_RING_SIZE];
+	};
+
+	int pmu_sample_period_set(const struct pmu_event_handle * handle, unsigned period);
+	int pmu_sample_period_clear(const struct pmu_event_handle * handle);
+	unsigned pmu_overflow_handler(struct pmu_sample_ring * ring, unsigned long pc);
+	int pmu_sample_ring_pop(struct pmu_sample_ring * ring, struct pmu_sample * sample);
+	void pmu_ext_interrupts(char enable);
+
+//Timer sampling
+//A periodic tick calls pmu_profile_tick with the interrupted PC and thread, which records them
+//with what every enabled counter counted since the previous tick into a ring buffer
+//Userspace ticks with a per-thread POSIX timer (see perfmon_profile.h),
+//the module with a per-CPU hrtimer (see perfmon_module.c)
+//The tick only reads counters, so it can run alongside pmu_event_add and overflow sampling
+
+	//One timer sample
+	struct pmu_profile_sample {
+		unsigned long pc; //Interrupted program counter
+		unsigned tid; //Interrupted thread
+		unsigned enabled; //PMCNTENSET bits enabled at both ends of the tick
+		unsigned long long cycles; //Cycles since the previous tick
+		unsigned delta[NEVENTS_ARCH_MAX]; //Events since the previous tick, meaningful where enabled
+		unsigned short event[NEVENTS_ARCH_MAX]; //Event each counter counted (pmevtyper_get), meaningful where enabled
+	};
+
+	//Single-producer single-consumer ring of timer samples
+	//The producer is the tick, on one CPU or thread
+	//Allocated by the caller, PMU_PROFILE_RING_BYTES(n) bytes for n records
+	struct pmu_profile_ring {
+		unsigned head; //Next record to write, only written by the producer
+		unsigned tail; //Next record to read, only written by the consumer
+		unsigned dropped; //Samples lost because the ring was full
+		unsigned mask; //Number of records - 1
+		struct pmu_snapshot last; //Counters at the previous tick
+		unsigned config; //Event set generation event was read in (config_seq)
+		unsigned short event[NEVENTS_ARCH_MAX]; //Event each counter counted at the previous tick
+		struct pmu_profile_sample records[];
+	};
+
+	#define PMU_PROFILE_RING_BYTES( N ) ( sizeof(struct pmu_profile_ring) + (N) * sizeof(struct pmu_profile_sample) )
+
+	void pmu_profile_ring_init(struct pmu_profile_ring * ring, unsigned n);
+	void pmu_profile_tick(struct pmu_profile_ring * ring, unsigned long pc, unsigned tid);
+	int pmu_profile_ring_pop(struct pmu_profile_ring * ring, struct pmu_profile_sample * sample);
+
+//Multiplexing
+//Rotates groups of events through the hardware counters when there are more events than counters
+//Call pmu_mux_rotate from a periodic tick (hrtimer, POSIX timer, ...)
+//Time is measured with the cycle counter, which pmu_mux_start enables
+//Counts are scaled by enabled/running time, as perf does
+//Events in a group are always scheduled together
+//The multiplexer owns the event counters while started: don't mix with pmu_event_add
+//It is single-CPU: its state is global, so start, rotate and read it on one CPU (pin the thread,
+//or run the tick on the CPU it counts). pmu_mux_read retries if a rotation lands during it
+
+	#define PMU_MUX_MAX_EVENTS 32
+	#define PMU_MUX_MAX_GROUPS 16
+
+	//Count for a multiplexed event
+	struct pmu_mux_count {
+		unsigned long long value; //Scaled estimate: raw * enabled / running
+		unsigned long long raw; //Events counted while scheduled
+		unsigned long long enabled; //Cycles since pmu_mux_start
+		unsigned long long running; //Cycles spent scheduled on a counter
+	};
+
+	void pmu_mux_init(void);
+	int pmu_mux_group_add(const unsigned * events, const unsigned * flags, unsigned n);
+	int pmu_mux_start(void);
+	int pmu_mux_rotate(void);
+	int pmu_mux_stop(void);
+	int pmu_mux_read(unsigned event, struct pmu_mux_count * count);
+
 	/* TODO
 
 	Should we provide pause/resume counting semantics?
@@ -1063,13 +1175,37 @@ const static unsigned CLR = 0;
 
 //Perfmon State
 //Allow loading and unloading (e.g. in a kernel module)
-	void pmu_load(void);
-	void pmu_load_reset(void);
+//Each call saves or restores the calling CPU's PMU into pmu_state
+//PMUSERENR is left alone: perfmon_user_mod owns userspace access, whatever else loads and unloads
+//To cover every core, run them on each CPU (see perfmon_module.c)
+	int pmu_load(void);
+	int pmu_load_reset(void);
 	void pmu_unload(void);
 	void pmu_unload_reset(void);
-	extern unsigned state_pmcr;
-	extern unsigned state_pmcnten;
-	extern unsigned state_pmuserenr;
-	extern unsigned state_pmevtype[NEVENTS_ARCH_MAX];
+
+//Per-thread counter context
+//Saved when a thread is switched out and restored when it is switched back in,
+//so each thread sees its own virtual counters (see perfmon_module.c)
+//Only the counters in enabled are touched, to keep a switch in the low hundreds of cycles
+//Both bracket their writes with pmu_config_write_begin/end, so handle lookups overlapping a switch retry
+	struct pmu_context {
+		unsigned enabled; //PMCNTEN bits owned by this context, including PMCNTEN_CYCLE_CTR
+		unsigned active; //Owned counters programmed on the current CPU by pmu_context_restore
+		unsigned ovs; //Overflow flags of owned counters
+		unsigned inten; //PMINTEN bits of owned counters
+		unsigned pmevtype[NEVENTS_ARCH_MAX];
+		unsigned pmevcntr[NEVENTS_ARCH_MAX];
+		unsigned long long pmccntr;
+		unsigned ext_mask; //Owned counters extended to 64 bits in software
+		unsigned ext_high[NEVENTS_ARCH_MAX];
+	};
+
+	void pmu_context_init(struct pmu_context * ctx);
+	void pmu_context_save(struct pmu_context * ctx);
+	void pmu_context_restore(struct pmu_context * ctx);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif //__ASMARM_ARCH_PERFMON_H
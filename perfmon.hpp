@@ -0,0 +1,430 @@
+#ifndef __ASMARM_ARCH_PERFMON_HPP
+#define __ASMARM_ARCH_PERFMON_HPP
+
+/******************************************************************************
+*
+* perfmon.hpp
+*
+* C++ layer over perfmon.h for counters whose register index
+* is known at compile time.
+*
+* The slot is a template parameter, so each access is a single
+* inline MRC/MCR (MRS/MSR in AARCH64) with a constant encoding, instead of going through
+* the runtime switch in pmevcntr_read and friends.
+*
+* Counters are bound to a backend at compile time (pmu::Cp15 or pmu::A64,
+* pmu::Perf, or pmu::Library for whatever the C library selected), defaulting to the
+* one the library is built for:
+*	typedef pmu::Counter<0, EVT_INST_RETIRED, false, pmu::Perf> PerfInst;
+*
+* Example:
+*	typedef pmu::Counter<0, EVT_INST_RETIRED> Inst;
+*	typedef pmu::Counter<2, EVT_L1D_CACHE_REFILL, true> Refill; //Chained into slot 3
+*	typedef pmu::Group<Inst, Refill> Hot;
+*
+*	Hot::program();
+*	unsigned long long v[Hot::size];
+*	Hot::read(v);
+*
+* Programming through this layer does not go through pmu_event_add,
+* so it is up to the caller not to mix both on the same slots.
+*
+******************************************************************************/
+
+#include "perfmon.h"
+
+namespace pmu {
+
+//Coprocessor encodings for event counter registers
+//See PMEVCNTR_CRM, PMEVTYPER_CRM and PMEV_OPC2 in perfmon.h
+
+	template <unsigned Slot>
+	struct Encoding {
+		static_assert(Slot < 31, "Event counter index out of range");
+		static const unsigned cntr_crm = PMEVCNTR_CRM(Slot);
+		static const unsigned typer_crm = PMEVTYPER_CRM(Slot);
+		static const unsigned opc2 = PMEV_OPC2(Slot);
+	};
+
+//Backends
+//Compile-time form of struct pmu_backend in perfmon.h
+//Each backend supplies the register operations as static members,
+//with the counter index as a template parameter for event counters
+//Backend<Derived> builds the operations counters need on top of them,
+//so everything bound to a backend here inlines into the caller
+
+	template <class Derived>
+	struct Backend {
+
+		//Number of event counters
+		static inline unsigned nevents() {
+			return (Derived::pmcr_read() & PMCR_NEVENTS) >> PMCR_NEVENTS_SHIFT;
+		}
+
+		//Enable and disable event counting
+		static inline void enable() {
+			Derived::pmcr_write(Derived::pmcr_read() | PMCR_ENABLE_COUNTERS);
+		}
+
+		static inline void disable() {
+			Derived::pmcr_write(Derived::pmcr_read() & ~PMCR_ENABLE_COUNTERS);
+		}
+
+		//Enable and disable the counters in a PMCNTEN mask
+		static inline void counters_enable(unsigned mask) {
+			Derived::pmcntenset_write(mask);
+		}
+
+		static inline void counters_disable(unsigned mask) {
+			Derived::pmcntenclr_write(mask);
+		}
+
+		//Overflow flags, and clearing them
+		static inline unsigned overflowed() {
+			return Derived::pmovsr_read();
+		}
+
+		static inline void overflow_clear(unsigned mask) {
+			Derived::pmovsr_write(mask);
+		}
+
+		//Set event type for register Slot, keeping filter bits as-is
+		//Same semantics as pmevtyper_set
+		template <unsigned Slot>
+		static inline void evtyper_set(unsigned event) {
+			unsigned mask = ( (~0u) << 10 ); //Keep all but bits 9:0
+			Derived::template evtyper_write<Slot>(event | (Derived::template evtyper_read<Slot>() & mask));
+		}
+	};
+
+#if !defined(__aarch64__)
+
+	//MRC/MCR with constant encodings, a single instruction per access
+	struct Cp15 : Backend<Cp15> {
+
+		static inline unsigned pmcr_read() { return cp15_pmcr_read(); }
+		static inline void pmcr_write(unsigned x) { cp15_pmcr_write(x); }
+		static inline void pmcntenset_write(unsigned x) { cp15_pmcntenset_write(x); }
+		static inline void pmcntenclr_write(unsigned x) { cp15_pmcntenclr_write(x); }
+		static inline unsigned pmovsr_read() { return cp15_pmovsr_read(); }
+		static inline void pmovsr_write(unsigned x) { cp15_pmovsr_write(x); }
+
+		//Read from event count register Slot
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) unsigned evcntr_read() {
+			unsigned x;
+			asm volatile ("MRC p15, 0, %0, c14, c%c1, %c2\t\n" : "=r" (x)
+				: "i" (Encoding<Slot>::cntr_crm), "i" (Encoding<Slot>::opc2));
+			return x;
+		}
+
+		//Write to event count register Slot
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) void evcntr_write(unsigned x) {
+			asm volatile ("MCR p15, 0, %0, c14, c%c1, %c2\t\n" :: "r" (x),
+				"i" (Encoding<Slot>::cntr_crm), "i" (Encoding<Slot>::opc2));
+		}
+
+		//Read from event type register Slot
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) unsigned evtyper_read() {
+			unsigned x;
+			asm volatile ("MRC p15, 0, %0, c14, c%c1, %c2\t\n" : "=r" (x)
+				: "i" (Encoding<Slot>::typer_crm), "i" (Encoding<Slot>::opc2));
+			return x;
+		}
+
+		//Write to event type register Slot
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) void evtyper_write(unsigned x) {
+			asm volatile ("MCR p15, 0, %0, c14, c%c1, %c2\t\n" :: "r" (x),
+				"i" (Encoding<Slot>::typer_crm), "i" (Encoding<Slot>::opc2));
+		}
+	};
+
+#else
+
+	//MRS/MSR with constant encodings, a single instruction per access
+	struct A64 : Backend<A64> {
+
+		static inline unsigned pmcr_read() { return a64_pmcr_read(); }
+		static inline void pmcr_write(unsigned x) { a64_pmcr_write(x); }
+		static inline void pmcntenset_write(unsigned x) { a64_pmcntenset_write(x); }
+		static inline void pmcntenclr_write(unsigned x) { a64_pmcntenclr_write(x); }
+		static inline unsigned pmovsr_read() { return a64_pmovsr_read(); }
+		static inline void pmovsr_write(unsigned x) { a64_pmovsr_write(x); }
+
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) unsigned evcntr_read() {
+			unsigned long long x;
+			A64_PMEVCNTR_READ( Slot, x );
+			return x;
+		}
+
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) void evcntr_write(unsigned x) {
+			A64_PMEVCNTR_WRITE( Slot, (unsigned long long) x );
+		}
+
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) unsigned evtyper_read() {
+			unsigned long long x;
+			A64_PMEVTYPER_READ( Slot, x );
+			return x;
+		}
+
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) void evtyper_write(unsigned x) {
+			A64_PMEVTYPER_WRITE( Slot, (unsigned long long) x );
+		}
+	};
+
+#endif
+
+#if defined(PMU_BACKEND_PERF) || defined(PMU_BACKEND_RUNTIME)
+
+	//perf events, see perfmon_perf.h
+	struct Perf : Backend<Perf> {
+
+		static inline unsigned pmcr_read() { return perf_pmcr_read(); }
+		static inline void pmcr_write(unsigned x) { perf_pmcr_write(x); }
+		static inline void pmcntenset_write(unsigned x) { perf_pmcntenset_write(x); }
+		static inline void pmcntenclr_write(unsigned x) { perf_pmcntenclr_write(x); }
+		static inline unsigned pmovsr_read() { return perf_pmovsr_read(); }
+		static inline void pmovsr_write(unsigned x) { perf_pmovsr_write(x); }
+
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) unsigned evcntr_read() { return perf_pmevcntr_read(Slot); }
+
+		template <unsigned Slot>
+		static inline void evcntr_write(unsigned x) { perf_pmevcntr_write(Slot, x); }
+
+		template <unsigned Slot>
+		static inline unsigned evtyper_read() { return perf_pmevtyper_read(Slot); }
+
+		template <unsigned Slot>
+		static inline void evtyper_write(unsigned x) { perf_pmevtyper_write(Slot, x); }
+	};
+
+#endif
+
+	//Whatever backend the C library uses, through the functions in perfmon.h
+	struct Library : Backend<Library> {
+
+		static inline unsigned pmcr_read() { return ::pmcr_read(); }
+		static inline void pmcr_write(unsigned x) { ::pmcr_write(x); }
+		static inline void pmcntenset_write(unsigned x) { ::pmcntenset_write(x); }
+		static inline void pmcntenclr_write(unsigned x) { ::pmcntenclr_write(x); }
+		static inline unsigned pmovsr_read() { return ::pmovsr_read(); }
+		static inline void pmovsr_write(unsigned x) { ::pmovsr_write(x); }
+
+		template <unsigned Slot>
+		static inline __attribute__((always_inline)) unsigned evcntr_read() { return ::pmevcntr_read(Slot); }
+
+		template <unsigned Slot>
+		static inline void evcntr_write(unsigned x) { ::pmevcntr_write(Slot, x); }
+
+		template <unsigned Slot>
+		static inline unsigned evtyper_read() { return ::pmevtyper_read(Slot); }
+
+		template <unsigned Slot>
+		static inline void evtyper_write(unsigned x) { ::pmevtyper_write(Slot, x); }
+	};
+
+	//Backend counters use unless told otherwise: the one the C library was built for
+	//A runtime-selected library goes through its dispatch, which still inlines cp15 reads
+#if defined(PMU_BACKEND_RUNTIME) || defined(PMU_BACKEND_EMU)
+	typedef Library DefaultBackend;
+#elif defined(PMU_BACKEND_PERF)
+	typedef Perf DefaultBackend;
+#elif defined(__aarch64__)
+	typedef A64 DefaultBackend;
+#else
+	typedef Cp15 DefaultBackend;
+#endif
+
+	//Register access on the default backend
+
+	template <unsigned Slot>
+	static inline __attribute__((always_inline)) unsigned evcntr_read() {
+		return DefaultBackend::evcntr_read<Slot>();
+	}
+
+	template <unsigned Slot>
+	static inline __attribute__((always_inline)) void evcntr_write(unsigned x) {
+		DefaultBackend::evcntr_write<Slot>(x);
+	}
+
+	template <unsigned Slot>
+	static inline __attribute__((always_inline)) unsigned evtyper_read() {
+		return DefaultBackend::evtyper_read<Slot>();
+	}
+
+	template <unsigned Slot>
+	static inline __attribute__((always_inline)) void evtyper_write(unsigned x) {
+		DefaultBackend::evtyper_write<Slot>(x);
+	}
+
+	template <unsigned Slot>
+	static inline void evtyper_set(unsigned event) {
+		DefaultBackend::evtyper_set<Slot>(event);
+	}
+
+	//Unchained and chained reads are specialized separately,
+	//so an unchained counter in slot 30 never names slot 31
+	template <unsigned Slot, bool Chained, class B>
+	struct Reader {
+		static inline __attribute__((always_inline)) unsigned long long read() {
+			return B::template evcntr_read<Slot>();
+		}
+	};
+
+	//Same high/low/high retry as pmevcntr_read_64
+	template <unsigned Slot, class B>
+	struct Reader<Slot, true, B> {
+		static inline __attribute__((always_inline)) unsigned long long read() {
+			unsigned low, high, old_high;
+			high = B::template evcntr_read<Slot + 1>();
+			do {
+				old_high = high;
+				low = B::template evcntr_read<Slot>();
+				high = B::template evcntr_read<Slot + 1>();
+			} while (high != old_high);
+			return ULL(low, high);
+		}
+	};
+
+	//Event counter bound to a fixed register at compile time
+	//Chained counters also occupy register Slot + 1 with EVT_CHAIN
+	//B is the backend the counter is accessed through
+	template <unsigned Slot, unsigned Event, bool Chained = false, class B = DefaultBackend>
+	struct Counter {
+		static_assert(!Chained || Slot % 2 == 0, "Chained counters must start on an even register");
+		static_assert(!Chained || Slot + 1 < 31, "Chained counter has no register to chain into");
+
+		static const unsigned slot = Slot;
+		static const unsigned event = Event;
+		static const bool chained = Chained;
+		typedef B backend;
+
+		//PMCNTEN bits used by this counter
+		static const unsigned mask = (Chained ? 0b11u : 0b1u) << Slot;
+
+		//Monitor Event in Slot, chain if requested, enable and reset
+		//Same sequence as pmu_event_set
+		static inline void program() {
+			B::counters_enable(mask);
+			B::template evtyper_set<Slot>(Event);
+			B::template evcntr_write<Slot>(0);
+			if (Chained) {
+				B::template evtyper_set<Slot + Chained>(EVT_CHAIN);
+				B::template evcntr_write<Slot + Chained>(0);
+			}
+		}
+
+		//Reset count
+		static inline void reset() {
+			if (Chained) B::template evcntr_write<Slot + Chained>(0);
+			B::template evcntr_write<Slot>(0);
+		}
+
+		//Stop counting
+		static inline void disable() {
+			B::counters_disable(mask);
+		}
+
+		//Get lower 32-bits of event count
+		static inline __attribute__((always_inline)) unsigned read_32() {
+			return B::template evcntr_read<Slot>();
+		}
+
+		//Get event count value
+		static inline __attribute__((always_inline)) unsigned long long read() {
+			return Reader<Slot, Chained, B>::read();
+		}
+	};
+
+	template <class T, class U>
+	struct SameType {
+		static const bool value = false;
+	};
+
+	template <class T>
+	struct SameType<T, T> {
+		static const bool value = true;
+	};
+
+	//OR together the PMCNTEN masks of a list of counters
+	template <class... Counters>
+	struct MaskOf;
+
+	template <>
+	struct MaskOf<> {
+		static const unsigned value = 0;
+	};
+
+	template <class First, class... Rest>
+	struct MaskOf<First, Rest...> {
+		static_assert((First::mask & MaskOf<Rest...>::value) == 0, "Counters in a group overlap");
+		static const unsigned value = First::mask | MaskOf<Rest...>::value;
+	};
+
+	//Backend shared by a list of counters
+	template <class... Counters>
+	struct BackendOf;
+
+	template <class Only>
+	struct BackendOf<Only> {
+		typedef typename Only::backend type;
+	};
+
+	template <class First, class Second, class... Rest>
+	struct BackendOf<First, Second, Rest...> {
+		typedef typename BackendOf<Second, Rest...>::type type;
+		static_assert(SameType<typename First::backend, type>::value, "Counters in a group use different backends");
+	};
+
+	//Several compile-time counters read back-to-back
+	//Reads are emitted in the order the counters are listed
+	template <class... Counters>
+	struct Group {
+		static_assert(sizeof...(Counters) > 0, "Group must contain at least one counter");
+
+		static const unsigned size = sizeof...(Counters);
+		static const unsigned mask = MaskOf<Counters...>::value;
+		typedef typename BackendOf<Counters...>::type backend;
+
+		//Program every counter in the group
+		static inline void program() {
+			int order[] = { (Counters::program(), 0)... };
+			(void) order;
+		}
+
+		//Reset every counter in the group
+		static inline void reset() {
+			int order[] = { (Counters::reset(), 0)... };
+			(void) order;
+		}
+
+		//Disable every counter in the group with a single PMCNTENCLR write
+		static inline void disable() {
+			backend::counters_disable(mask);
+		}
+
+		//Read every counter into values, in declaration order
+		//Braced initializers are evaluated left to right
+		static inline __attribute__((always_inline)) void read(unsigned long long (&values)[size]) {
+			unsigned long long v[size] = { Counters::read()... };
+			for (unsigned i = 0; i < size; i++) values[i] = v[i];
+		}
+
+		//Read the lower 32-bits of every counter into values
+		static inline __attribute__((always_inline)) void read_32(unsigned (&values)[size]) {
+			unsigned v[size] = { Counters::read_32()... };
+			for (unsigned i = 0; i < size; i++) values[i] = v[i];
+		}
+	};
+
+} //namespace pmu
+
+#endif //__ASMARM_ARCH_PERFMON_HPP
@@ -0,0 +1,906 @@
+#ifndef __PERFMON_A64_H
+#define __PERFMON_A64_H
+
+/******************************************************************************
+*
+* perfmon_a64.h
+*
+* AARCH64 backend for perfmon.h: PMU registers of the calling core,
+* accessed with MRS/MSR.
+*
+* This is the default backend when building for AARCH64. The registers
+* are the AARCH64 views of the ones perfmon_cp15.h accesses, with the
+* same bit layouts in their low 32 bits, so the library above works
+* unchanged. PMCCNTR_EL0 is read and written whole in one instruction.
+* From userspace it needs PMUSERENR_EL0.EN set on every core
+* (see perfmon_user.c).
+*
+* Registers are named by encoding (S3_3_C14_C<m>_<n>) so event counters
+* can be computed from n, and so older assemblers accept them.
+*
+* Included by perfmon.h, not meant to be included directly.
+*
+******************************************************************************/
+
+//PMEVCNTR<n>_EL0/PMEVTYPER<n>_EL0: Event counter and event type registers
+//https://developer.arm.com/docs/ddi0595/f/aarch64-system-registers/pmevcntrn_el0
+//PMEVTYPER<n>_EL0 is 64 bits wide, with bits 63:32 RES0 on ARMv8.0
+
+	#define A64_PMEVTYPER_READ( N, EVENT ) asm volatile ("MRS %0, S3_3_C14_C%c1_%c2\t\n" : "=r" (EVENT) : "i" (PMEVTYPER_CRM(N)), "i" (PMEV_OPC2(N)))
+	#define A64_PMEVTYPER_WRITE( N, EVENT ) asm volatile ("MSR S3_3_C14_C%c1_%c2, %0\t\n" :: "r" (EVENT), "i" (PMEVTYPER_CRM(N)), "i" (PMEV_OPC2(N)))
+	#define A64_PMEVCNTR_READ( N, COUNT ) asm volatile ("MRS %0, S3_3_C14_C%c1_%c2\t\n" : "=r" (COUNT) : "i" (PMEVCNTR_CRM(N)), "i" (PMEV_OPC2(N)))
+	#define A64_PMEVCNTR_WRITE( N, COUNT ) asm volatile ("MSR S3_3_C14_C%c1_%c2, %0\t\n" :: "r" (COUNT), "i" (PMEVCNTR_CRM(N)), "i" (PMEV_OPC2(N)))
+
+	//Read from event type register n, direct access
+	static inline unsigned a64_pmevtyper_read_direct(unsigned n) {
+		unsigned long long event = 0;
+		switch(n) {
+#if NEVENTS_ARCH_MAX > 0
+			case 0 :
+				A64_PMEVTYPER_READ( 0, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 1
+			case 1 :
+				A64_PMEVTYPER_READ( 1, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 2
+			case 2 :
+				A64_PMEVTYPER_READ( 2, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 3
+			case 3 :
+				A64_PMEVTYPER_READ( 3, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 4
+			case 4 :
+				A64_PMEVTYPER_READ( 4, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 5
+			case 5 :
+				A64_PMEVTYPER_READ( 5, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 6
+			case 6 :
+				A64_PMEVTYPER_READ( 6, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 7
+			case 7 :
+				A64_PMEVTYPER_READ( 7, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 8
+			case 8 :
+				A64_PMEVTYPER_READ( 8, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 9
+			case 9 :
+				A64_PMEVTYPER_READ( 9, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 10
+			case 10 :
+				A64_PMEVTYPER_READ( 10, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 11
+			case 11 :
+				A64_PMEVTYPER_READ( 11, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 12
+			case 12 :
+				A64_PMEVTYPER_READ( 12, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 13
+			case 13 :
+				A64_PMEVTYPER_READ( 13, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 14
+			case 14 :
+				A64_PMEVTYPER_READ( 14, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 15
+			case 15 :
+				A64_PMEVTYPER_READ( 15, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 16
+			case 16 :
+				A64_PMEVTYPER_READ( 16, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 17
+			case 17 :
+				A64_PMEVTYPER_READ( 17, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 18
+			case 18 :
+				A64_PMEVTYPER_READ( 18, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 19
+			case 19 :
+				A64_PMEVTYPER_READ( 19, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 20
+			case 20 :
+				A64_PMEVTYPER_READ( 20, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 21
+			case 21 :
+				A64_PMEVTYPER_READ( 21, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 22
+			case 22 :
+				A64_PMEVTYPER_READ( 22, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 23
+			case 23 :
+				A64_PMEVTYPER_READ( 23, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 24
+			case 24 :
+				A64_PMEVTYPER_READ( 24, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 25
+			case 25 :
+				A64_PMEVTYPER_READ( 25, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 26
+			case 26 :
+				A64_PMEVTYPER_READ( 26, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 27
+			case 27 :
+				A64_PMEVTYPER_READ( 27, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 28
+			case 28 :
+				A64_PMEVTYPER_READ( 28, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 29
+			case 29 :
+				A64_PMEVTYPER_READ( 29, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 30
+			case 30 :
+				A64_PMEVTYPER_READ( 30, event );
+				break;
+#endif
+		}
+
+		return event;
+	}
+
+	//Write to event type register n, direct access
+	static inline void a64_pmevtyper_write_direct(unsigned n, unsigned long long event) {
+		switch(n) {
+#if NEVENTS_ARCH_MAX > 0
+			case 0 :
+				A64_PMEVTYPER_WRITE( 0, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 1
+			case 1 :
+				A64_PMEVTYPER_WRITE( 1, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 2
+			case 2 :
+				A64_PMEVTYPER_WRITE( 2, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 3
+			case 3 :
+				A64_PMEVTYPER_WRITE( 3, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 4
+			case 4 :
+				A64_PMEVTYPER_WRITE( 4, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 5
+			case 5 :
+				A64_PMEVTYPER_WRITE( 5, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 6
+			case 6 :
+				A64_PMEVTYPER_WRITE( 6, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 7
+			case 7 :
+				A64_PMEVTYPER_WRITE( 7, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 8
+			case 8 :
+				A64_PMEVTYPER_WRITE( 8, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 9
+			case 9 :
+				A64_PMEVTYPER_WRITE( 9, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 10
+			case 10 :
+				A64_PMEVTYPER_WRITE( 10, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 11
+			case 11 :
+				A64_PMEVTYPER_WRITE( 11, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 12
+			case 12 :
+				A64_PMEVTYPER_WRITE( 12, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 13
+			case 13 :
+				A64_PMEVTYPER_WRITE( 13, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 14
+			case 14 :
+				A64_PMEVTYPER_WRITE( 14, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 15
+			case 15 :
+				A64_PMEVTYPER_WRITE( 15, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 16
+			case 16 :
+				A64_PMEVTYPER_WRITE( 16, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 17
+			case 17 :
+				A64_PMEVTYPER_WRITE( 17, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 18
+			case 18 :
+				A64_PMEVTYPER_WRITE( 18, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 19
+			case 19 :
+				A64_PMEVTYPER_WRITE( 19, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 20
+			case 20 :
+				A64_PMEVTYPER_WRITE( 20, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 21
+			case 21 :
+				A64_PMEVTYPER_WRITE( 21, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 22
+			case 22 :
+				A64_PMEVTYPER_WRITE( 22, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 23
+			case 23 :
+				A64_PMEVTYPER_WRITE( 23, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 24
+			case 24 :
+				A64_PMEVTYPER_WRITE( 24, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 25
+			case 25 :
+				A64_PMEVTYPER_WRITE( 25, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 26
+			case 26 :
+				A64_PMEVTYPER_WRITE( 26, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 27
+			case 27 :
+				A64_PMEVTYPER_WRITE( 27, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 28
+			case 28 :
+				A64_PMEVTYPER_WRITE( 28, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 29
+			case 29 :
+				A64_PMEVTYPER_WRITE( 29, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 30
+			case 30 :
+				A64_PMEVTYPER_WRITE( 30, event );
+				break;
+#endif
+		}
+	}
+
+	//Read from event count register n, direct access
+	static inline unsigned a64_pmevcntr_read_direct(unsigned n) {
+		unsigned long long count = 0;
+		switch(n) {
+#if NEVENTS_ARCH_MAX > 0
+			case 0 :
+				A64_PMEVCNTR_READ( 0, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 1
+			case 1 :
+				A64_PMEVCNTR_READ( 1, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 2
+			case 2 :
+				A64_PMEVCNTR_READ( 2, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 3
+			case 3 :
+				A64_PMEVCNTR_READ( 3, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 4
+			case 4 :
+				A64_PMEVCNTR_READ( 4, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 5
+			case 5 :
+				A64_PMEVCNTR_READ( 5, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 6
+			case 6 :
+				A64_PMEVCNTR_READ( 6, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 7
+			case 7 :
+				A64_PMEVCNTR_READ( 7, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 8
+			case 8 :
+				A64_PMEVCNTR_READ( 8, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 9
+			case 9 :
+				A64_PMEVCNTR_READ( 9, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 10
+			case 10 :
+				A64_PMEVCNTR_READ( 10, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 11
+			case 11 :
+				A64_PMEVCNTR_READ( 11, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 12
+			case 12 :
+				A64_PMEVCNTR_READ( 12, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 13
+			case 13 :
+				A64_PMEVCNTR_READ( 13, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 14
+			case 14 :
+				A64_PMEVCNTR_READ( 14, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 15
+			case 15 :
+				A64_PMEVCNTR_READ( 15, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 16
+			case 16 :
+				A64_PMEVCNTR_READ( 16, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 17
+			case 17 :
+				A64_PMEVCNTR_READ( 17, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 18
+			case 18 :
+				A64_PMEVCNTR_READ( 18, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 19
+			case 19 :
+				A64_PMEVCNTR_READ( 19, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 20
+			case 20 :
+				A64_PMEVCNTR_READ( 20, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 21
+			case 21 :
+				A64_PMEVCNTR_READ( 21, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 22
+			case 22 :
+				A64_PMEVCNTR_READ( 22, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 23
+			case 23 :
+				A64_PMEVCNTR_READ( 23, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 24
+			case 24 :
+				A64_PMEVCNTR_READ( 24, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 25
+			case 25 :
+				A64_PMEVCNTR_READ( 25, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 26
+			case 26 :
+				A64_PMEVCNTR_READ( 26, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 27
+			case 27 :
+				A64_PMEVCNTR_READ( 27, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 28
+			case 28 :
+				A64_PMEVCNTR_READ( 28, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 29
+			case 29 :
+				A64_PMEVCNTR_READ( 29, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 30
+			case 30 :
+				A64_PMEVCNTR_READ( 30, count );
+				break;
+#endif
+		}
+
+		return count;
+	}
+
+	//Write to event counter register n, direct access
+	static inline void a64_pmevcntr_write_direct(unsigned n, unsigned long long count) {
+		switch(n) {
+#if NEVENTS_ARCH_MAX > 0
+			case 0 :
+				A64_PMEVCNTR_WRITE( 0, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 1
+			case 1 :
+				A64_PMEVCNTR_WRITE( 1, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 2
+			case 2 :
+				A64_PMEVCNTR_WRITE( 2, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 3
+			case 3 :
+				A64_PMEVCNTR_WRITE( 3, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 4
+			case 4 :
+				A64_PMEVCNTR_WRITE( 4, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 5
+			case 5 :
+				A64_PMEVCNTR_WRITE( 5, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 6
+			case 6 :
+				A64_PMEVCNTR_WRITE( 6, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 7
+			case 7 :
+				A64_PMEVCNTR_WRITE( 7, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 8
+			case 8 :
+				A64_PMEVCNTR_WRITE( 8, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 9
+			case 9 :
+				A64_PMEVCNTR_WRITE( 9, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 10
+			case 10 :
+				A64_PMEVCNTR_WRITE( 10, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 11
+			case 11 :
+				A64_PMEVCNTR_WRITE( 11, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 12
+			case 12 :
+				A64_PMEVCNTR_WRITE( 12, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 13
+			case 13 :
+				A64_PMEVCNTR_WRITE( 13, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 14
+			case 14 :
+				A64_PMEVCNTR_WRITE( 14, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 15
+			case 15 :
+				A64_PMEVCNTR_WRITE( 15, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 16
+			case 16 :
+				A64_PMEVCNTR_WRITE( 16, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 17
+			case 17 :
+				A64_PMEVCNTR_WRITE( 17, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 18
+			case 18 :
+				A64_PMEVCNTR_WRITE( 18, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 19
+			case 19 :
+				A64_PMEVCNTR_WRITE( 19, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 20
+			case 20 :
+				A64_PMEVCNTR_WRITE( 20, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 21
+			case 21 :
+				A64_PMEVCNTR_WRITE( 21, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 22
+			case 22 :
+				A64_PMEVCNTR_WRITE( 22, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 23
+			case 23 :
+				A64_PMEVCNTR_WRITE( 23, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 24
+			case 24 :
+				A64_PMEVCNTR_WRITE( 24, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 25
+			case 25 :
+				A64_PMEVCNTR_WRITE( 25, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 26
+			case 26 :
+				A64_PMEVCNTR_WRITE( 26, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 27
+			case 27 :
+				A64_PMEVCNTR_WRITE( 27, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 28
+			case 28 :
+				A64_PMEVCNTR_WRITE( 28, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 29
+			case 29 :
+				A64_PMEVCNTR_WRITE( 29, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 30
+			case 30 :
+				A64_PMEVCNTR_WRITE( 30, count );
+				break;
+#endif
+		}
+	}
+
+	//PMSELR_EL0: Event counter selection, for PMXEVTYPER_EL0 and PMXEVCNTR_EL0
+	//https://developer.arm.com/docs/ddi0595/f/aarch64-system-registers/pmselr_el0
+
+	static inline unsigned a64_pmselr_read(void) {
+		unsigned long long x;
+		asm volatile ("MRS %0, PMSELR_EL0\t\n" : "=r" (x));
+		return x;
+	}
+
+	//Select event counter n, synchronizing so the next PMXEV* access sees it
+	//As with perfmon_cp15.h's pmselr_write, the *_indirect functions mask interrupts in the kernel
+	//between selection and access, and userspace signal handlers use pmu_select_save/restore
+	static inline void a64_pmselr_write(unsigned n) {
+		asm volatile ("MSR PMSELR_EL0, %0\t\n"
+					  "ISB\t\n" :: "r" ((unsigned long long) n) : "memory");
+	}
+
+	static inline unsigned a64_pmevtyper_read_indirect(unsigned n) {
+		unsigned long long x;
+		unsigned long flags;
+		PMU_SELECT_LOCK(flags);
+		a64_pmselr_write(n);
+		asm volatile ("MRS %0, PMXEVTYPER_EL0\t\n" : "=r" (x));
+		PMU_SELECT_UNLOCK(flags);
+		return x;
+	}
+
+	static inline void a64_pmevtyper_write_indirect(unsigned n, unsigned long long event) {
+		unsigned long flags;
+		PMU_SELECT_LOCK(flags);
+		a64_pmselr_write(n);
+		asm volatile ("MSR PMXEVTYPER_EL0, %0\t\n" :: "r" (event));
+		PMU_SELECT_UNLOCK(flags);
+	}
+
+	static inline unsigned a64_pmevcntr_read_indirect(unsigned n) {
+		unsigned long long x;
+		unsigned long flags;
+		PMU_SELECT_LOCK(flags);
+		a64_pmselr_write(n);
+		asm volatile ("MRS %0, PMXEVCNTR_EL0\t\n" : "=r" (x));
+		PMU_SELECT_UNLOCK(flags);
+		return x;
+	}
+
+	static inline void a64_pmevcntr_write_indirect(unsigned n, unsigned long long count) {
+		unsigned long flags;
+		PMU_SELECT_LOCK(flags);
+		a64_pmselr_write(n);
+		asm volatile ("MSR PMXEVCNTR_EL0, %0\t\n" :: "r" (count));
+		PMU_SELECT_UNLOCK(flags);
+	}
+
+	//PMSELR under perfmon_cp15.h's names, see pmu_select_save
+	static inline unsigned pmselr_read(void) {
+		return a64_pmselr_read();
+	}
+
+	static inline void pmselr_write(unsigned n) {
+		a64_pmselr_write(n);
+	}
+
+	//Reads by access path under perfmon_cp15.h's names, for code comparing them (see perfmon_bench.c)
+	static inline unsigned pmevtyper_read_direct(unsigned n) {
+		return a64_pmevtyper_read_direct(n);
+	}
+
+	static inline unsigned pmevtyper_read_indirect(unsigned n) {
+		return a64_pmevtyper_read_indirect(n);
+	}
+
+	static inline unsigned pmevcntr_read_direct(unsigned n) {
+		return a64_pmevcntr_read_direct(n);
+	}
+
+	static inline unsigned pmevcntr_read_indirect(unsigned n) {
+		return a64_pmevcntr_read_indirect(n);
+	}
+
+
+//Backend operations, see struct pmu_backend in perfmon.h
+//System registers move 64 bits; the 32-bit registers are zero-extended on write
+
+	#define A64_READ( REG, X ) do { unsigned long long v; asm volatile ("MRS %0, " REG "\t\n" : "=r" (v)); X = v; } while (0)
+	#define A64_WRITE( REG, X ) asm volatile ("MSR " REG ", %0\t\n" :: "r" ((unsigned long long) (X)))
+
+	static inline unsigned a64_pmcr_read(void) {
+		unsigned x;
+		A64_READ( "PMCR_EL0", x );
+		return x;
+	}
+
+	static inline void a64_pmcr_write(unsigned x) {
+		A64_WRITE( "PMCR_EL0", x );
+	}
+
+	static inline unsigned a64_pmcnten_read(void) {
+		unsigned x;
+		A64_READ( "PMCNTENSET_EL0", x );
+		return x;
+	}
+
+	static inline void a64_pmcntenset_write(unsigned x) {
+		A64_WRITE( "PMCNTENSET_EL0", x );
+	}
+
+	static inline void a64_pmcntenclr_write(unsigned x) {
+		A64_WRITE( "PMCNTENCLR_EL0", x );
+	}
+
+	static inline unsigned a64_pmevtyper_read(unsigned n) {
+#ifdef PMU_ACCESS_INDIRECT
+		return a64_pmevtyper_read_indirect(n);
+#else
+		return a64_pmevtyper_read_direct(n);
+#endif
+	}
+
+	static inline void a64_pmevtyper_write(unsigned n, unsigned type) {
+#ifdef PMU_ACCESS_INDIRECT
+		a64_pmevtyper_write_indirect(n, type);
+#else
+		a64_pmevtyper_write_direct(n, type);
+#endif
+	}
+
+	static inline unsigned a64_pmevcntr_read(unsigned n) {
+#ifdef PMU_ACCESS_INDIRECT
+		return a64_pmevcntr_read_indirect(n);
+#else
+		return a64_pmevcntr_read_direct(n);
+#endif
+	}
+
+	static inline void a64_pmevcntr_write(unsigned n, unsigned count) {
+#ifdef PMU_ACCESS_INDIRECT
+		a64_pmevcntr_write_indirect(n, count);
+#else
+		a64_pmevcntr_write_direct(n, count);
+#endif
+	}
+
+	//A single 64-bit read, no high/low pairing
+	static inline unsigned long long a64_pmccntr_read(void) {
+		unsigned long long x;
+		asm volatile ("MRS %0, PMCCNTR_EL0\t\n" : "=r" (x));
+		return x;
+	}
+
+	static inline void a64_pmccntr_write(unsigned long long count) {
+		asm volatile ("MSR PMCCNTR_EL0, %0\t\n" :: "r" (count));
+	}
+
+	static inline unsigned a64_pmovsr_read(void) {
+		unsigned x;
+		A64_READ( "PMOVSCLR_EL0", x );
+		return x;
+	}
+
+	static inline void a64_pmovsr_write(unsigned x) {
+		A64_WRITE( "PMOVSCLR_EL0", x );
+	}
+
+	static inline void a64_pmovsset_write(unsigned x) {
+		A64_WRITE( "PMOVSSET_EL0", x );
+	}
+
+	static inline unsigned a64_pminten_read(void) {
+		unsigned x;
+		A64_READ( "PMINTENSET_EL1", x );
+		return x;
+	}
+
+	static inline void a64_pmintenset_write(unsigned x) {
+		A64_WRITE( "PMINTENSET_EL1", x );
+	}
+
+	static inline void a64_pmintenclr_write(unsigned x) {
+		A64_WRITE( "PMINTENCLR_EL1", x );
+	}
+
+	static inline unsigned a64_pmuserenr_read(void) {
+		unsigned x;
+		A64_READ( "PMUSERENR_EL0", x );
+		return x;
+	}
+
+	static inline void a64_pmuserenr_write(unsigned x) {
+		A64_WRITE( "PMUSERENR_EL0", x );
+	}
+
+	static inline unsigned a64_mpidr_read(void) {
+		unsigned x;
+		A64_READ( "MPIDR_EL1", x );
+		return x;
+	}
+
+	//MPIDR_EL1 is the same on every core from userspace, see pmu_cpu_core
+	static inline unsigned a64_cpu(void) {
+		return pmu_cpu_core();
+	}
+
+	//Userspace reads of MIDR_EL1 trap, so it asks Linux like AARCH32, see pmu_midr_user
+	static inline unsigned a64_midr_read(void) {
+#ifdef __KERNEL__
+		unsigned x;
+		A64_READ( "MIDR_EL1", x );
+		return x;
+#else
+		return pmu_midr_user();
+#endif
+	}
+
+	//PMCEID0_EL0 for n = 0, PMCEID1_EL0 for n = 1
+	//Only the common events 0x00-0x3F, bits 31:0
+	static inline unsigned a64_pmceid_read(unsigned n) {
+		unsigned x;
+		if (n) A64_READ( "PMCEID1_EL0", x );
+		else A64_READ( "PMCEID0_EL0", x );
+		return x;
+	}
+
+#endif
@@ -0,0 +1,219 @@
+#include <string.h>
+#include "perfmon.h"
+
+//Runtime backend selection, built with PMU_BACKEND_RUNTIME
+//Backends are listed fastest first, pmu_backend_select takes the first usable one
+
+//Backends
+
+#if defined(__arm__) && !defined(__aarch64__)
+
+    //PMUSERENR can always be read from userspace, the rest of the PMU only once EN is set
+    static int cp15_probe(void) {
+        return cp15_pmuserenr_read() & PMUSERENR_ENABLE;
+    }
+
+    const struct pmu_backend pmu_backend_cp15 = {
+        .name = "cp15",
+        .probe = cp15_probe,
+        .pmcr_read = cp15_pmcr_read,
+        .pmcr_write = cp15_pmcr_write,
+        .pmcnten_read = cp15_pmcnten_read,
+        .pmcntenset_write = cp15_pmcntenset_write,
+        .pmcntenclr_write = cp15_pmcntenclr_write,
+        .pmevtyper_read = cp15_pmevtyper_read,
+        .pmevtyper_write = cp15_pmevtyper_write,
+        .pmevcntr_read = cp15_pmevcntr_read,
+        .pmevcntr_write = cp15_pmevcntr_write,
+        .pmccntr_read = cp15_pmccntr_read,
+        .pmccntr_write = cp15_pmccntr_write,
+        .pmovsr_read = cp15_pmovsr_read,
+        .pmovsr_write = cp15_pmovsr_write,
+        .pmovsset_write = cp15_pmovsset_write,
+        .pminten_read = cp15_pminten_read,
+        .pmintenset_write = cp15_pmintenset_write,
+        .pmintenclr_write = cp15_pmintenclr_write,
+        .pmuserenr_read = cp15_pmuserenr_read,
+        .pmuserenr_write = cp15_pmuserenr_write,
+        .mpidr_read = cp15_mpidr_read,
+        .cpu = cp15_cpu,
+        .midr_read = cp15_midr_read,
+        .pmceid_read = cp15_pmceid_read,
+    };
+
+#endif
+
+#if defined(__aarch64__)
+
+    //PMUSERENR_EL0 can always be read from userspace, the rest of the PMU only once EN is set
+    static int a64_probe(void) {
+        return a64_pmuserenr_read() & PMUSERENR_ENABLE;
+    }
+
+    const struct pmu_backend pmu_backend_a64 = {
+        .name = "a64",
+        .probe = a64_probe,
+        .pmcr_read = a64_pmcr_read,
+        .pmcr_write = a64_pmcr_write,
+        .pmcnten_read = a64_pmcnten_read,
+        .pmcntenset_write = a64_pmcntenset_write,
+        .pmcntenclr_write = a64_pmcntenclr_write,
+        .pmevtyper_read = a64_pmevtyper_read,
+        .pmevtyper_write = a64_pmevtyper_write,
+        .pmevcntr_read = a64_pmevcntr_read,
+        .pmevcntr_write = a64_pmevcntr_write,
+        .pmccntr_read = a64_pmccntr_read,
+        .pmccntr_write = a64_pmccntr_write,
+        .pmovsr_read = a64_pmovsr_read,
+        .pmovsr_write = a64_pmovsr_write,
+        .pmovsset_write = a64_pmovsset_write,
+        .pminten_read = a64_pminten_read,
+        .pmintenset_write = a64_pmintenset_write,
+        .pmintenclr_write = a64_pmintenclr_write,
+        .pmuserenr_read = a64_pmuserenr_read,
+        .pmuserenr_write = a64_pmuserenr_write,
+        .mpidr_read = a64_mpidr_read,
+        .cpu = a64_cpu,
+        .midr_read = a64_midr_read,
+        .pmceid_read = a64_pmceid_read,
+    };
+
+#endif
+
+    const struct pmu_backend pmu_backend_perf = {
+        .name = "perf",
+        .probe = perf_probe,
+        .pmcr_read = perf_pmcr_read,
+        .pmcr_write = perf_pmcr_write,
+        .pmcnten_read = perf_pmcnten_read,
+        .pmcntenset_write = perf_pmcntenset_write,
+        .pmcntenclr_write = perf_pmcntenclr_write,
+        .pmevtyper_read = perf_pmevtyper_read,
+        .pmevtyper_write = perf_pmevtyper_write,
+        .pmevcntr_read = perf_pmevcntr_read,
+        .pmevcntr_write = perf_pmevcntr_write,
+        .pmccntr_read = perf_pmccntr_read,
+        .pmccntr_write = perf_pmccntr_write,
+        .pmovsr_read = perf_pmovsr_read,
+        .pmovsr_write = perf_pmovsr_write,
+        .pmovsset_write = perf_pmovsset_write,
+        .pminten_read = perf_pminten_read,
+        .pmintenset_write = perf_pmintenset_write,
+        .pmintenclr_write = perf_pmintenclr_write,
+        .pmuserenr_read = perf_pmuserenr_read,
+        .pmuserenr_write = perf_pmuserenr_write,
+        .mpidr_read = perf_mpidr_read,
+        .cpu = perf_cpu,
+        .midr_read = perf_midr_read,
+        .pmceid_read = perf_pmceid_read,
+    };
+
+    static int emu_probe(void) {
+        return 1;
+    }
+
+    const struct pmu_backend pmu_backend_emu = {
+        .name = "emu",
+        .probe = emu_probe,
+        .pmcr_read = emu_pmcr_read,
+        .pmcr_write = emu_pmcr_write,
+        .pmcnten_read = emu_pmcnten_read,
+        .pmcntenset_write = emu_pmcntenset_write,
+        .pmcntenclr_write = emu_pmcntenclr_write,
+        .pmevtyper_read = emu_pmevtyper_read,
+        .pmevtyper_write = emu_pmevtyper_write,
+        .pmevcntr_read = emu_pmevcntr_read,
+        .pmevcntr_write = emu_pmevcntr_write,
+        .pmccntr_read = emu_pmccntr_read,
+        .pmccntr_write = emu_pmccntr_write,
+        .pmovsr_read = emu_pmovsr_read,
+        .pmovsr_write = emu_pmovsr_write,
+        .pmovsset_write = emu_pmovsset_write,
+        .pminten_read = emu_pminten_read,
+        .pmintenset_write = emu_pmintenset_write,
+        .pmintenclr_write = emu_pmintenclr_write,
+        .pmuserenr_read = emu_pmuserenr_read,
+        .pmuserenr_write = emu_pmuserenr_write,
+        .mpidr_read = emu_mpidr_read,
+        .cpu = emu_cpu,
+        .midr_read = emu_midr_read,
+        .pmceid_read = emu_pmceid_read,
+    };
+
+    //Until a backend is selected: no counters, reads of 0, writes ignored
+    //pmu_event_add and pmu_load return PMU_RETURN_NO_BACKEND on it, see pmu_backend_check
+    static int none_probe(void) { return 0; }
+    static unsigned none_read(void) { return 0; }
+    static unsigned none_read_n(unsigned n) { return 0; }
+    static unsigned long long none_read_64(void) { return 0; }
+    static void none_write(unsigned x) { }
+    static void none_write_n(unsigned n, unsigned x) { }
+    static void none_write_64(unsigned long long x) { }
+
+    const struct pmu_backend pmu_backend_none = {
+        .name = "none",
+        .probe = none_probe,
+        .pmcr_read = none_read,
+        .pmcr_write = none_write,
+        .pmcnten_read = none_read,
+        .pmcntenset_write = none_write,
+        .pmcntenclr_write = none_write,
+        .pmevtyper_read = none_read_n,
+        .pmevtyper_write = none_write_n,
+        .pmevcntr_read = none_read_n,
+        .pmevcntr_write = none_write_n,
+        .pmccntr_read = none_read_64,
+        .pmccntr_write = none_write_64,
+        .pmovsr_read = none_read,
+        .pmovsr_write = none_write,
+        .pmovsset_write = none_write,
+        .pminten_read = none_read,
+        .pmintenset_write = none_write,
+        .pmintenclr_write = none_write,
+        .pmuserenr_read = none_read,
+        .pmuserenr_write = none_write,
+        .mpidr_read = none_read,
+        .cpu = none_read,
+        .midr_read = none_read,
+        .pmceid_read = none_read_n,
+    };
+
+    //The emulated PMU always probes, so it comes last and is only used by name
+    static const struct pmu_backend * const backends[] = {
+#if defined(__aarch64__)
+        &pmu_backend_a64,
+#elif defined(__arm__)
+        &pmu_backend_cp15,
+#endif
+        &pmu_backend_perf,
+        &pmu_backend_emu,
+    };
+
+    //Nothing touches a PMU before pmu_backend_init has probed for one
+    const struct pmu_backend * pmu_backend = &pmu_backend_none;
+
+
+//Public Functions
+
+    int pmu_backend_select(const char * name) {
+
+        for (unsigned i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+
+            const struct pmu_backend * backend = backends[i];
+            if (!name && backend == &pmu_backend_emu) break;
+            if (name && strcmp(name, backend->name)) continue;
+            if (!backend->probe()) continue;
+
+            pmu_backend = backend;
+            return PMU_RETURN_SUCCESS;
+        }
+
+        return PMU_RETURN_NO_BACKEND;
+
+    }
+
+    //Pick the backend before main, so a program doesn't have to
+    //If none works here, pmu_backend stays pmu_backend_none and the library reports PMU_RETURN_NO_BACKEND
+    __attribute__((constructor)) static void pmu_backend_init(void) {
+        pmu_backend_select(0);
+    }
@@ -0,0 +1,96 @@
+/******************************************************************************
+*
+* perfmon_bench.c
+*
+* Measures the cost of the direct (PMEVCNTR<n>/PMEVTYPER<n>) and
+* indirect (PMSELR + PMXEVCNTR/PMXEVTYPER) event counter access paths
+* on the target, so the library can be built with the cheaper one.
+*
+* Userspace access must be enabled (PMUSERENR.EN) before running,
+* e.g. by loading perfmon_user_mod.ko.
+*
+* The report goes to stderr; stdout gets a single Makefile line:
+*	./perfmon_bench > perfmon_access.mk
+* after which `make` builds with the selected access path.
+*
+******************************************************************************/
+
+#include <stdio.h>
+#include "perfmon.h"
+
+#define BENCH_REPS 1024
+#define BENCH_TRIALS 32
+
+//Runtime index, so the compiler can't fold the direct path's switch
+static volatile unsigned bench_slot;
+
+//Cycles taken by BENCH_REPS iterations of an access path
+//Minimum over BENCH_TRIALS, to filter out interrupts and cache misses
+#define BENCH_MIN_CYCLES( RESULT, BODY ) \
+	do { \
+		unsigned best = ~0u; \
+		for (unsigned t = 0; t < BENCH_TRIALS; t++) { \
+			unsigned start = pmccntr_read_32(); \
+			for (unsigned r = 0; r < BENCH_REPS; r++) { BODY; } \
+			unsigned cycles = pmccntr_read_32() - start; \
+			if (cycles < best) best = cycles; \
+		} \
+		RESULT = best; \
+	} while (0)
+
+int main(void) {
+
+	unsigned pmcr = pmcr_read();
+	unsigned nevents = pmu_nevents();
+	if (nevents > NEVENTS_ARCH_MAX) nevents = NEVENTS_ARCH_MAX;
+
+	//Count every cycle so results are in cycles
+	pmu_enable();
+	pmccntr_enable();
+	pmcr_unset(PMCR_CYCLE_COUNT_EVERY_64);
+
+	volatile unsigned sink;
+	unsigned empty, direct_cntr, indirect_cntr, direct_typer, indirect_typer;
+	unsigned direct_total = 0, indirect_total = 0;
+
+	BENCH_MIN_CYCLES( empty, sink = bench_slot );
+
+	fprintf(stderr, "%-6s %12s %12s %12s %12s\n", "slot",
+		"cntr_direct", "cntr_indir", "typer_direct", "typer_indir");
+
+	for (unsigned n = 0; n < nevents; n++) {
+
+		bench_slot = n;
+
+		BENCH_MIN_CYCLES( direct_cntr, sink = pmevcntr_read_direct(bench_slot) );
+		BENCH_MIN_CYCLES( indirect_cntr, sink = pmevcntr_read_indirect(bench_slot) );
+		BENCH_MIN_CYCLES( direct_typer, sink = pmevtyper_read_direct(bench_slot) );
+		BENCH_MIN_CYCLES( indirect_typer, sink = pmevtyper_read_indirect(bench_slot) );
+
+		direct_cntr -= empty;
+		indirect_cntr -= empty;
+		direct_typer -= empty;
+		indirect_typer -= empty;
+
+		fprintf(stderr, "%-6u %12.2f %12.2f %12.2f %12.2f\n", n,
+			(double) direct_cntr / BENCH_REPS, (double) indirect_cntr / BENCH_REPS,
+			(double) direct_typer / BENCH_REPS, (double) indirect_typer / BENCH_REPS);
+
+		//Counter reads are the hot path, so they decide
+		direct_total += direct_cntr;
+		indirect_total += indirect_cntr;
+	}
+	(void) sink;
+
+	pmcr_write(pmcr);
+
+	const char * choice = indirect_total < direct_total ? "indirect" : "direct";
+	fprintf(stderr, "cycles per counter read: direct %.2f, indirect %.2f -> %s\n",
+		nevents ? (double) direct_total / (BENCH_REPS * nevents) : 0.0,
+		nevents ? (double) indirect_total / (BENCH_REPS * nevents) : 0.0,
+		choice);
+
+	printf("ACCESS = %s\n", choice);
+
+	return 0;
+}
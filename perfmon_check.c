@@ -0,0 +1,425 @@
+/******************************************************************************
+*
+* perfmon_check.c
+*
+* Checks the library's logic on the emulated PMU (perfmon_emu.h), with
+* deterministic counts, on any host: make host, or make check BACKEND=emu.
+*
+* Covers:
+*	chained and software-extended reads, with overflows scripted between
+*	the register reads of a single read
+*	region deltas, with and without a calibrated bias
+*	multiplexer rotation and scaling
+*	overflow sampling and interrupt folding of extended counters
+*	trace write/read round trips across blocks and event set changes
+*	duplicate adds and the slots pmu_unload hands back
+*
+* Prints each failed check and exits nonzero if any failed.
+*
+******************************************************************************/
+
+#include <stdio.h>
+#include "perfmon.h"
+#include "perfmon_trace.h"
+
+#if !defined(PMU_BACKEND_EMU) && !defined(PMU_BACKEND_RUNTIME)
+#error "perfmon_check needs the emulated backend: BACKEND=emu or BACKEND=runtime"
+#endif
+
+static unsigned check_run, check_failed;
+
+#define CHECK( COND ) \
+	do { \
+		check_run++; \
+		if (!(COND)) { \
+			check_failed++; \
+			fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #COND); \
+		} \
+	} while (0)
+
+#define CHECK_EQ( A, B ) \
+	do { \
+		unsigned long long a_ = (A), b_ = (B); \
+		check_run++; \
+		if (a_ != b_) { \
+			check_failed++; \
+			fprintf(stderr, "%s:%d: %s: check failed: %s == %s (0x%llx != 0x%llx)\n", \
+				__FILE__, __LINE__, __func__, #A, #B, a_, b_); \
+		} \
+	} while (0)
+
+//Fresh emulated PMU with nevents counters, enabled, counting every cycle
+static void check_setup(unsigned nevents) {
+	pmu_emu_reset(nevents);
+	pmu_enable();
+	pmccntr_enable();
+}
+
+//Leave the PMU and the library's slots idle for the next check
+static void check_teardown(void) {
+	pmu_emu_script(0, 0);
+	pmu_disable_all();
+	CHECK_EQ(pmu_state_this()->slots, 0);
+	CHECK_EQ(pmu_state_this()->ext.mask, 0);
+}
+
+//Chained reads retry when the low word wraps between the high reads
+static void check_chained(void) {
+
+	check_setup(4);
+
+	struct pmu_event_handle h;
+	CHECK_EQ(pmu_event_add_handle(EVT_BR_PRED, PMU_EVENTFLAG_64BIT, &h), PMU_RETURN_SUCCESS);
+	CHECK(h.chained);
+
+	pmu_emu_inject(EVT_BR_PRED, 0x1234);
+	CHECK_EQ(pmu_handle_read(&h), 0x1234);
+
+	//Reads are high, low, high: wrap before the second high read
+	pmevcntr_write(h.slot, 0xfffffff0);
+	pmevcntr_write(h.slot + 1, 0);
+	struct pmu_emu_step late[] = { { 3, EVT_BR_PRED, 0x20 } };
+	pmu_emu_script(late, 1);
+	CHECK_EQ(pmu_handle_read(&h), 0x100000010ULL);
+	CHECK_EQ(pmu_emu_script_pending, 0);
+
+	//Wrap before the low read
+	pmevcntr_write(h.slot, 0xfffffff0);
+	struct pmu_emu_step early[] = { { 2, EVT_BR_PRED, 0x20 } };
+	pmu_emu_script(early, 1);
+	CHECK_EQ(pmu_handle_read(&h), 0x200000010ULL);
+
+	//By event code, and through a snapshot taken with the counters stopped
+	unsigned long long value;
+	CHECK(pmu_event_get(EVT_BR_PRED, PMU_EVENTFLAG_64BIT, &value) >= 0);
+	CHECK_EQ(value, 0x200000010ULL);
+	struct pmu_snapshot snap;
+	CHECK_EQ(pmu_snapshot(&snap, PMU_SNAPSHOT_CONSISTENT), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_snapshot_read(&snap, &h), 0x200000010ULL);
+
+	CHECK_EQ(pmu_event_remove(EVT_BR_PRED, PMU_EVENTFLAG_64BIT), PMU_RETURN_SUCCESS);
+	check_teardown();
+
+}
+
+//Software-extended reads see a wrap between the overflow flag and counter reads, and fold it once
+static void check_extended(void) {
+
+	check_setup(4);
+
+	struct pmu_event_handle h;
+	CHECK_EQ(pmu_event_add_handle(EVT_L1D_CACHE, PMU_EVENTFLAG_64BIT_SW, &h), PMU_RETURN_SUCCESS);
+	CHECK(h.extended);
+	CHECK(!h.chained);
+
+	//The only counter read comes between the two flag reads
+	pmevcntr_write(h.slot, 0xfffffff0);
+	struct pmu_emu_step wrap[] = { { 1, EVT_L1D_CACHE, 0x20 } };
+	pmu_emu_script(wrap, 1);
+	CHECK_EQ(pmu_handle_read(&h), 0x100000010ULL);
+	CHECK_EQ(pmu_emu_script_pending, 0);
+
+	//The polled read folded the overflow into the high word
+	CHECK_EQ(pmovsr_read() & (1 << h.slot), 0);
+	CHECK_EQ(pmu_handle_read(&h), 0x100000010ULL);
+
+	//An overflow nobody has read yet is counted, and folded, once
+	pmu_emu_inject(EVT_L1D_CACHE, 0xfffffff0);
+	CHECK_EQ(pmu_handle_read(&h), 0x200000000ULL);
+	CHECK_EQ(pmu_handle_read(&h), 0x200000000ULL);
+
+	CHECK_EQ(pmu_event_remove(EVT_L1D_CACHE, PMU_EVENTFLAG_64BIT_SW), PMU_RETURN_SUCCESS);
+	check_teardown();
+
+}
+
+//Counter reads in one snapshot, counted with a script of empty steps
+static unsigned check_snapshot_reads(void) {
+	static struct pmu_emu_step count[64];
+	struct pmu_snapshot snap;
+	for (unsigned i = 0; i < 64; i++) count[i] = (struct pmu_emu_step) { 1, EVT_SW_INCR, 0 };
+	pmu_emu_script(count, 64);
+	pmu_snapshot(&snap, 0);
+	unsigned reads = 64 - pmu_emu_script_pending;
+	pmu_emu_script(0, 0);
+	return reads;
+}
+
+static void check_region(void) {
+
+	check_setup(4);
+
+	struct pmu_event_handle chain, inst;
+	CHECK_EQ(pmu_event_add_handle(EVT_BR_PRED, PMU_EVENTFLAG_64BIT, &chain), PMU_RETURN_SUCCESS);
+
+	//Uncalibrated: the full 64-bit delta, uncorrected
+	struct pmu_region region;
+	struct pmu_region_delta delta;
+	pmevcntr_write(chain.slot, 0xffffff00);
+	CHECK_EQ(pmu_region_begin(&region), PMU_RETURN_SUCCESS);
+	pmu_emu_inject(EVT_BR_PRED, 0x300000200ULL);
+	pmu_emu_inject(EVT_CPU_CYCLES, 1000);
+	CHECK_EQ(pmu_region_end(&region, &delta), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_region_delta_read(&delta, &chain), 0x300000200ULL);
+	CHECK_EQ(delta.cycles, 1000);
+	CHECK_EQ(delta.corrected, 0);
+	CHECK_EQ(delta.enabled & (0b11 << chain.slot), 0b11 << chain.slot);
+
+	//Every snapshot sees 5 more instructions than the one before: that is the bias
+	CHECK_EQ(pmu_event_add_handle(EVT_INST_RETIRED, 0, &inst), PMU_RETURN_SUCCESS);
+	unsigned reads = check_snapshot_reads();
+	CHECK(reads > 0);
+	static struct pmu_emu_step cost[64];
+	for (unsigned i = 0; i < 64; i++) cost[i] = (struct pmu_emu_step) { reads, EVT_INST_RETIRED, 5 };
+	pmu_emu_script(cost, 64);
+	CHECK_EQ(pmu_region_calibrate(16), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_region_calibration.count[inst.slot], 5);
+
+	CHECK_EQ(pmu_region_begin(&region), PMU_RETURN_SUCCESS);
+	pmu_emu_inject(EVT_INST_RETIRED, 100);
+	pmu_emu_inject(EVT_BR_PRED, 7);
+	CHECK_EQ(pmu_region_end(&region, &delta), PMU_RETURN_SUCCESS);
+	CHECK_EQ(delta.corrected, 1);
+	CHECK_EQ(pmu_region_delta_read(&delta, &inst), 100);
+	CHECK_EQ(pmu_region_delta_read(&delta, &chain), 7);
+	pmu_emu_script(0, 0);
+
+	//Another event set: exact, with the bias left out
+	CHECK_EQ(pmu_event_add(EVT_L1D_CACHE, 0), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_region_begin(&region), PMU_RETURN_SUCCESS);
+	pmu_emu_inject(EVT_INST_RETIRED, 100);
+	CHECK_EQ(pmu_region_end(&region, &delta), PMU_RETURN_SUCCESS);
+	CHECK_EQ(delta.corrected, 0);
+	CHECK_EQ(pmu_region_delta_read(&delta, &inst), 100);
+
+	CHECK_EQ(pmu_event_remove(EVT_L1D_CACHE, 0), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_remove(EVT_INST_RETIRED, 0), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_remove(EVT_BR_PRED, PMU_EVENTFLAG_64BIT), PMU_RETURN_SUCCESS);
+	check_teardown();
+
+}
+
+static void check_mux(void) {
+
+	check_setup(2);
+
+	//Two groups on two counters: each runs half the time
+	unsigned first[] = { EVT_L1D_CACHE, EVT_INST_RETIRED };
+	unsigned second[] = { EVT_BR_PRED, EVT_BR_MIS_PRED };
+	pmu_mux_init();
+	CHECK_EQ(pmu_mux_group_add(first, 0, 2), 0);
+	CHECK_EQ(pmu_mux_group_add(second, 0, 2), 1);
+	CHECK_EQ(pmu_mux_start(), PMU_RETURN_SUCCESS);
+
+	pmu_emu_inject(EVT_CPU_CYCLES, 100);
+	pmu_emu_inject(EVT_L1D_CACHE, 10);
+	pmu_emu_inject(EVT_INST_RETIRED, 20);
+	pmu_emu_inject(EVT_BR_PRED, 999);
+	CHECK_EQ(pmu_mux_rotate(), PMU_RETURN_SUCCESS);
+
+	pmu_emu_inject(EVT_CPU_CYCLES, 100);
+	pmu_emu_inject(EVT_BR_PRED, 30);
+	pmu_emu_inject(EVT_L1D_CACHE, 999);
+
+	//Read while scheduled, then stopped
+	struct pmu_mux_count count;
+	CHECK_EQ(pmu_mux_read(EVT_BR_PRED, &count), PMU_RETURN_SUCCESS);
+	CHECK_EQ(count.raw, 30);
+	CHECK_EQ(pmu_mux_stop(), PMU_RETURN_SUCCESS);
+
+	CHECK_EQ(pmu_mux_read(EVT_L1D_CACHE, &count), PMU_RETURN_SUCCESS);
+	CHECK_EQ(count.raw, 10);
+	CHECK_EQ(count.enabled, 200);
+	CHECK_EQ(count.running, 100);
+	CHECK_EQ(count.value, 20);
+	CHECK_EQ(pmu_mux_read(EVT_BR_PRED, &count), PMU_RETURN_SUCCESS);
+	CHECK_EQ(count.raw, 30);
+	CHECK_EQ(count.value, 60);
+	CHECK_EQ(pmu_mux_read(EVT_CHAIN, &count), PMU_RETURN_EVENT_NO_WATCH);
+	CHECK_EQ(pmu_state_this()->slots, 0);
+
+	//An event someone else monitors stops its group, and stays monitored
+	CHECK_EQ(pmu_event_add(EVT_BR_PRED, 0), PMU_RETURN_SUCCESS);
+	pmu_mux_init();
+	CHECK_EQ(pmu_mux_group_add(second, 0, 2), 0);
+	CHECK_EQ(pmu_mux_start(), PMU_RETURN_EVENT_ALREADY);
+	struct pmu_event_handle h;
+	CHECK(pmu_event_handle_get(EVT_BR_PRED, &h) >= 0);
+	CHECK(pmu_event_handle_get(EVT_BR_MIS_PRED, &h) < 0);
+	pmu_mux_init();
+
+	CHECK_EQ(pmu_event_remove(EVT_BR_PRED, 0), PMU_RETURN_SUCCESS);
+	check_teardown();
+
+}
+
+static void check_overflow(void) {
+
+	static struct pmu_sample_ring ring;
+	struct pmu_sample sample;
+
+	check_setup(4);
+
+	struct pmu_event_handle h, ext;
+	CHECK_EQ(pmu_event_add_handle(EVT_BR_PRED, 0, &h), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_sample_period_set(&h, 100), PMU_RETURN_SUCCESS);
+	CHECK(pmintenset_read() & (1 << h.slot));
+
+	//Not ours until the counter overflows
+	pmu_emu_inject(EVT_BR_PRED, 99);
+	CHECK_EQ(pmu_overflow_handler(&ring, 0x1000), 0);
+
+	//The events past the overflow are carried into the next period
+	pmu_emu_inject(EVT_BR_PRED, 11);
+	CHECK_EQ(pmu_overflow_handler(&ring, 0x1000), 1 << h.slot);
+	CHECK_EQ(pmovsr_read() & (1 << h.slot), 0);
+	CHECK_EQ(pmevcntr_read(h.slot), (unsigned) (10 - 100));
+
+	CHECK_EQ(pmu_sample_ring_pop(&ring, &sample), PMU_RETURN_SUCCESS);
+	CHECK_EQ(sample.pc, 0x1000);
+	CHECK_EQ(sample.slot, h.slot);
+	CHECK_EQ(sample.event, EVT_BR_PRED);
+	CHECK_EQ(sample.count[h.slot], 10);
+	CHECK_EQ(pmu_sample_ring_pop(&ring, &sample), PMU_RETURN_RING_EMPTY);
+
+	//Overflows of extended counters are folded by the handler, and raise no sample
+	CHECK_EQ(pmu_event_add_handle(EVT_L1D_CACHE, PMU_EVENTFLAG_64BIT_SW, &ext), PMU_RETURN_SUCCESS);
+	pmu_ext_interrupts(1);
+	CHECK(pmintenset_read() & (1 << ext.slot));
+	pmu_emu_inject(EVT_L1D_CACHE, 0x100000010ULL);
+	CHECK_EQ(pmu_overflow_handler(&ring, 0x2000), 1 << ext.slot);
+	CHECK_EQ(pmu_state_this()->ext.high[ext.slot], 1);
+	CHECK_EQ(pmu_handle_read(&ext), 0x100000010ULL);
+	CHECK_EQ(pmu_sample_ring_pop(&ring, &sample), PMU_RETURN_RING_EMPTY);
+	pmu_ext_interrupts(0);
+
+	CHECK_EQ(pmu_sample_period_clear(&h), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmintenset_read() & (1 << h.slot), 0);
+	pmu_emu_inject(EVT_BR_PRED, 1000);
+	CHECK_EQ(pmu_overflow_handler(&ring, 0x3000), 0);
+
+	CHECK_EQ(pmu_event_remove(EVT_L1D_CACHE, PMU_EVENTFLAG_64BIT_SW), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_remove(EVT_BR_PRED, 0), PMU_RETURN_SUCCESS);
+	check_teardown();
+
+}
+
+#define CHECK_TRACE_RECORDS 2000
+
+static void check_trace(void) {
+
+	static struct pmu_snapshot snaps[CHECK_TRACE_RECORDS];
+	static struct pmu_trace_writer w;
+	struct pmu_trace_reader r;
+	struct pmu_trace_record record;
+
+	check_setup(4);
+
+	FILE * f = tmpfile();
+	CHECK(f != 0);
+	if (!f) return;
+
+	CHECK_EQ(pmu_event_add(EVT_INST_RETIRED, 0), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_add(EVT_BR_PRED, 0), PMU_RETURN_SUCCESS);
+
+	//Enough varied records to fill several blocks, with the event set changing halfway
+	pmu_trace_writer_init(&w, f);
+	unsigned seed = 1;
+	for (unsigned k = 0; k < CHECK_TRACE_RECORDS; k++) {
+		if (k == CHECK_TRACE_RECORDS / 2) CHECK_EQ(pmu_event_add(EVT_L1D_CACHE, 0), PMU_RETURN_SUCCESS);
+		seed = seed * 1103515245 + 12345;
+		pmu_emu_inject(EVT_CPU_CYCLES, 10000 + (seed >> 20));
+		pmu_emu_inject(EVT_INST_RETIRED, 5000 + (seed >> 16 & 0xfff));
+		pmu_emu_inject(EVT_BR_PRED, seed >> 24);
+		pmu_emu_inject(EVT_L1D_CACHE, k % 3 ? 0x7fffffff : 1);
+		pmu_snapshot(&snaps[k], 0);
+		CHECK_EQ(pmu_trace_write(&w, &snaps[k]), PMU_RETURN_SUCCESS);
+	}
+	CHECK_EQ(pmu_trace_flush(&w), PMU_RETURN_SUCCESS);
+	CHECK(ftell(f) > PMU_TRACE_BLOCK_BYTES);
+
+	rewind(f);
+	pmu_trace_reader_init(&r, f);
+	unsigned mismatched = 0;
+	for (unsigned k = 0; k < CHECK_TRACE_RECORDS; k++) {
+		if (pmu_trace_read(&r, &record) < 0) {
+			mismatched++;
+			break;
+		}
+		const struct pmu_snapshot * snap = &snaps[k];
+		if (record.enabled != snap->enabled || record.nevents != snap->nevents) mismatched++;
+		else if (record.cycles != snap->cycles) mismatched++;
+		else {
+			for (unsigned i = 0; i < snap->nevents; i++) {
+				if (!((snap->enabled >> i) & 1)) continue;
+				if (record.count[i] != snap->count[i] || record.types[i] != pmevtyper_get(i)) mismatched++;
+			}
+		}
+	}
+	CHECK_EQ(mismatched, 0);
+	CHECK_EQ(pmu_trace_read(&r, &record), PMU_RETURN_TRACE_END);
+	fclose(f);
+
+	CHECK_EQ(pmu_event_remove(EVT_L1D_CACHE, 0), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_remove(EVT_BR_PRED, 0), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_remove(EVT_INST_RETIRED, 0), PMU_RETURN_SUCCESS);
+	check_teardown();
+
+}
+
+static void check_slots(void) {
+
+	check_setup(4);
+
+	//A duplicate add backs off without keeping a counter
+	CHECK_EQ(pmu_event_add(EVT_BR_PRED, 0), PMU_RETURN_SUCCESS);
+	unsigned slots = pmu_state_this()->slots;
+	CHECK_EQ(pmu_event_add(EVT_BR_PRED, 0), PMU_RETURN_EVENT_ALREADY);
+	CHECK_EQ(pmu_event_add(EVT_BR_PRED, PMU_EVENTFLAG_64BIT), PMU_RETURN_EVENT_ALREADY);
+	CHECK_EQ(pmu_state_this()->slots, slots);
+
+	//pmu_unload hands back the counters added since pmu_load, and keeps the others
+	CHECK_EQ(pmu_load(), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_add(EVT_INST_RETIRED, PMU_EVENTFLAG_64BIT), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_add(EVT_L1D_CACHE, PMU_EVENTFLAG_64BIT_SW), PMU_RETURN_SUCCESS);
+	CHECK(pmu_event_add(EVT_BR_MIS_PRED, 0) < 0);
+	pmu_unload();
+	CHECK_EQ(pmu_state_this()->slots, slots);
+	CHECK_EQ(pmu_state_this()->ext.mask, 0);
+	CHECK_EQ(pmcntenset_read() & ((1 << pmu_nevents()) - 1), slots);
+	struct pmu_event_handle h;
+	CHECK(pmu_event_handle_get(EVT_BR_PRED, &h) >= 0);
+	CHECK(pmu_event_handle_get(EVT_INST_RETIRED, &h) < 0);
+
+	//Three counters are free again
+	CHECK_EQ(pmu_event_add(EVT_INST_RETIRED, PMU_EVENTFLAG_64BIT), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_add(EVT_L1D_CACHE, 0), PMU_RETURN_SUCCESS);
+
+	CHECK_EQ(pmu_event_remove(EVT_L1D_CACHE, 0), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_remove(EVT_INST_RETIRED, PMU_EVENTFLAG_64BIT), PMU_RETURN_SUCCESS);
+	CHECK_EQ(pmu_event_remove(EVT_BR_PRED, 0), PMU_RETURN_SUCCESS);
+	check_teardown();
+
+}
+
+int main(void) {
+
+#if defined(PMU_BACKEND_RUNTIME)
+	if (pmu_backend_select("emu") < 0) {
+		fprintf(stderr, "perfmon_check: the emulated backend is not available\n");
+		return 1;
+	}
+#endif
+
+	check_chained();
+	check_extended();
+	check_region();
+	check_mux();
+	check_overflow();
+	check_trace();
+	check_slots();
+
+	printf("perfmon_check: %u of %u checks passed\n", check_run - check_failed, check_run);
+	return check_failed ? 1 : 0;
+
+}
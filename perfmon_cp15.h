@@ -0,0 +1,896 @@
+#ifndef __PERFMON_CP15_H
+#define __PERFMON_CP15_H
+
+/******************************************************************************
+*
+* perfmon_cp15.h
+*
+* CP15 backend for perfmon.h: PMU registers of the calling core,
+* accessed with MRC/MCR in AARCH32 mode.
+*
+* This is the default backend. From userspace it needs PMUSERENR.EN
+* set on every core (see perfmon_user.c).
+*
+* Included by perfmon.h, not meant to be included directly.
+*
+******************************************************************************/
+
+//PMEVCNTR/PMEVTYPER: Event counter and event type registers
+
+	//Coprocessor encodings for event counter n: c14, with PMEVCNTR_CRM/PMEVTYPER_CRM and PMEV_OPC2
+	//https://developer.arm.com/docs/ddi0595/f/aarch32-system-registers/pmevcntrn
+	#define PMEVTYPER_READ( N, EVENT ) asm volatile ("MRC p15, 0, %0, c14, c%c1, %c2\t\n" : "=r" (EVENT) : "i" (PMEVTYPER_CRM(N)), "i" (PMEV_OPC2(N)))
+	#define PMEVTYPER_WRITE( N, EVENT ) asm volatile ("MCR p15, 0, %0, c14, c%c1, %c2\t\n" :: "r" (EVENT), "i" (PMEVTYPER_CRM(N)), "i" (PMEV_OPC2(N)))
+	#define PMEVCNTR_READ( N, COUNT ) asm volatile ("MRC p15, 0, %0, c14, c%c1, %c2\t\n" : "=r" (COUNT) : "i" (PMEVCNTR_CRM(N)), "i" (PMEV_OPC2(N)))
+	#define PMEVCNTR_WRITE( N, COUNT ) asm volatile ("MCR p15, 0, %0, c14, c%c1, %c2\t\n" :: "r" (COUNT), "i" (PMEVCNTR_CRM(N)), "i" (PMEV_OPC2(N)))
+
+	//Read from event type register n, direct access
+	static inline unsigned pmevtyper_read_direct(unsigned n) {
+		unsigned event = 0;
+		switch(n) {
+#if NEVENTS_ARCH_MAX > 0
+			case 0 :
+				PMEVTYPER_READ( 0, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 1
+			case 1 :
+				PMEVTYPER_READ( 1, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 2
+			case 2 :
+				PMEVTYPER_READ( 2, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 3
+			case 3 :
+				PMEVTYPER_READ( 3, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 4
+			case 4 :
+				PMEVTYPER_READ( 4, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 5
+			case 5 :
+				PMEVTYPER_READ( 5, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 6
+			case 6 :
+				PMEVTYPER_READ( 6, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 7
+			case 7 :
+				PMEVTYPER_READ( 7, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 8
+			case 8 :
+				PMEVTYPER_READ( 8, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 9
+			case 9 :
+				PMEVTYPER_READ( 9, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 10
+			case 10 :
+				PMEVTYPER_READ( 10, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 11
+			case 11 :
+				PMEVTYPER_READ( 11, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 12
+			case 12 :
+				PMEVTYPER_READ( 12, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 13
+			case 13 :
+				PMEVTYPER_READ( 13, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 14
+			case 14 :
+				PMEVTYPER_READ( 14, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 15
+			case 15 :
+				PMEVTYPER_READ( 15, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 16
+			case 16 :
+				PMEVTYPER_READ( 16, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 17
+			case 17 :
+				PMEVTYPER_READ( 17, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 18
+			case 18 :
+				PMEVTYPER_READ( 18, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 19
+			case 19 :
+				PMEVTYPER_READ( 19, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 20
+			case 20 :
+				PMEVTYPER_READ( 20, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 21
+			case 21 :
+				PMEVTYPER_READ( 21, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 22
+			case 22 :
+				PMEVTYPER_READ( 22, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 23
+			case 23 :
+				PMEVTYPER_READ( 23, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 24
+			case 24 :
+				PMEVTYPER_READ( 24, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 25
+			case 25 :
+				PMEVTYPER_READ( 25, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 26
+			case 26 :
+				PMEVTYPER_READ( 26, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 27
+			case 27 :
+				PMEVTYPER_READ( 27, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 28
+			case 28 :
+				PMEVTYPER_READ( 28, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 29
+			case 29 :
+				PMEVTYPER_READ( 29, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 30
+			case 30 :
+				PMEVTYPER_READ( 30, event );
+				break;
+#endif
+		}
+
+		return event;
+	}
+
+	//Write to event type register n, direct access
+	static inline void pmevtyper_write_direct(unsigned n, unsigned event) {
+		switch(n) {
+#if NEVENTS_ARCH_MAX > 0
+			case 0 :
+				PMEVTYPER_WRITE( 0, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 1
+			case 1 :
+				PMEVTYPER_WRITE( 1, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 2
+			case 2 :
+				PMEVTYPER_WRITE( 2, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 3
+			case 3 :
+				PMEVTYPER_WRITE( 3, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 4
+			case 4 :
+				PMEVTYPER_WRITE( 4, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 5
+			case 5 :
+				PMEVTYPER_WRITE( 5, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 6
+			case 6 :
+				PMEVTYPER_WRITE( 6, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 7
+			case 7 :
+				PMEVTYPER_WRITE( 7, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 8
+			case 8 :
+				PMEVTYPER_WRITE( 8, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 9
+			case 9 :
+				PMEVTYPER_WRITE( 9, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 10
+			case 10 :
+				PMEVTYPER_WRITE( 10, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 11
+			case 11 :
+				PMEVTYPER_WRITE( 11, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 12
+			case 12 :
+				PMEVTYPER_WRITE( 12, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 13
+			case 13 :
+				PMEVTYPER_WRITE( 13, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 14
+			case 14 :
+				PMEVTYPER_WRITE( 14, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 15
+			case 15 :
+				PMEVTYPER_WRITE( 15, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 16
+			case 16 :
+				PMEVTYPER_WRITE( 16, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 17
+			case 17 :
+				PMEVTYPER_WRITE( 17, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 18
+			case 18 :
+				PMEVTYPER_WRITE( 18, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 19
+			case 19 :
+				PMEVTYPER_WRITE( 19, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 20
+			case 20 :
+				PMEVTYPER_WRITE( 20, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 21
+			case 21 :
+				PMEVTYPER_WRITE( 21, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 22
+			case 22 :
+				PMEVTYPER_WRITE( 22, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 23
+			case 23 :
+				PMEVTYPER_WRITE( 23, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 24
+			case 24 :
+				PMEVTYPER_WRITE( 24, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 25
+			case 25 :
+				PMEVTYPER_WRITE( 25, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 26
+			case 26 :
+				PMEVTYPER_WRITE( 26, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 27
+			case 27 :
+				PMEVTYPER_WRITE( 27, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 28
+			case 28 :
+				PMEVTYPER_WRITE( 28, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 29
+			case 29 :
+				PMEVTYPER_WRITE( 29, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 30
+			case 30 :
+				PMEVTYPER_WRITE( 30, event );
+				break;
+#endif
+		}
+	}
+
+	//Read from event count register n, direct access
+	static inline unsigned pmevcntr_read_direct(unsigned n) {
+		unsigned event = 0;
+		switch(n) {
+#if NEVENTS_ARCH_MAX > 0
+			case 0 :
+				PMEVCNTR_READ( 0, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 1
+			case 1 :
+				PMEVCNTR_READ( 1, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 2
+			case 2 :
+				PMEVCNTR_READ( 2, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 3
+			case 3 :
+				PMEVCNTR_READ( 3, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 4
+			case 4 :
+				PMEVCNTR_READ( 4, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 5
+			case 5 :
+				PMEVCNTR_READ( 5, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 6
+			case 6 :
+				PMEVCNTR_READ( 6, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 7
+			case 7 :
+				PMEVCNTR_READ( 7, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 8
+			case 8 :
+				PMEVCNTR_READ( 8, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 9
+			case 9 :
+				PMEVCNTR_READ( 9, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 10
+			case 10 :
+				PMEVCNTR_READ( 10, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 11
+			case 11 :
+				PMEVCNTR_READ( 11, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 12
+			case 12 :
+				PMEVCNTR_READ( 12, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 13
+			case 13 :
+				PMEVCNTR_READ( 13, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 14
+			case 14 :
+				PMEVCNTR_READ( 14, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 15
+			case 15 :
+				PMEVCNTR_READ( 15, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 16
+			case 16 :
+				PMEVCNTR_READ( 16, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 17
+			case 17 :
+				PMEVCNTR_READ( 17, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 18
+			case 18 :
+				PMEVCNTR_READ( 18, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 19
+			case 19 :
+				PMEVCNTR_READ( 19, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 20
+			case 20 :
+				PMEVCNTR_READ( 20, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 21
+			case 21 :
+				PMEVCNTR_READ( 21, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 22
+			case 22 :
+				PMEVCNTR_READ( 22, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 23
+			case 23 :
+				PMEVCNTR_READ( 23, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 24
+			case 24 :
+				PMEVCNTR_READ( 24, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 25
+			case 25 :
+				PMEVCNTR_READ( 25, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 26
+			case 26 :
+				PMEVCNTR_READ( 26, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 27
+			case 27 :
+				PMEVCNTR_READ( 27, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 28
+			case 28 :
+				PMEVCNTR_READ( 28, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 29
+			case 29 :
+				PMEVCNTR_READ( 29, event );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 30
+			case 30 :
+				PMEVCNTR_READ( 30, event );
+				break;
+#endif
+		}
+
+		return event;
+	}
+
+	//Write to event counter register n, direct access
+	static inline void pmevcntr_write_direct(unsigned n, unsigned count) {
+		switch(n) {
+#if NEVENTS_ARCH_MAX > 0
+			case 0 :
+				PMEVCNTR_WRITE( 0, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 1
+			case 1 :
+				PMEVCNTR_WRITE( 1, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 2
+			case 2 :
+				PMEVCNTR_WRITE( 2, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 3
+			case 3 :
+				PMEVCNTR_WRITE( 3, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 4
+			case 4 :
+				PMEVCNTR_WRITE( 4, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 5
+			case 5 :
+				PMEVCNTR_WRITE( 5, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 6
+			case 6 :
+				PMEVCNTR_WRITE( 6, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 7
+			case 7 :
+				PMEVCNTR_WRITE( 7, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 8
+			case 8 :
+				PMEVCNTR_WRITE( 8, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 9
+			case 9 :
+				PMEVCNTR_WRITE( 9, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 10
+			case 10 :
+				PMEVCNTR_WRITE( 10, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 11
+			case 11 :
+				PMEVCNTR_WRITE( 11, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 12
+			case 12 :
+				PMEVCNTR_WRITE( 12, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 13
+			case 13 :
+				PMEVCNTR_WRITE( 13, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 14
+			case 14 :
+				PMEVCNTR_WRITE( 14, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 15
+			case 15 :
+				PMEVCNTR_WRITE( 15, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 16
+			case 16 :
+				PMEVCNTR_WRITE( 16, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 17
+			case 17 :
+				PMEVCNTR_WRITE( 17, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 18
+			case 18 :
+				PMEVCNTR_WRITE( 18, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 19
+			case 19 :
+				PMEVCNTR_WRITE( 19, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 20
+			case 20 :
+				PMEVCNTR_WRITE( 20, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 21
+			case 21 :
+				PMEVCNTR_WRITE( 21, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 22
+			case 22 :
+				PMEVCNTR_WRITE( 22, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 23
+			case 23 :
+				PMEVCNTR_WRITE( 23, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 24
+			case 24 :
+				PMEVCNTR_WRITE( 24, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 25
+			case 25 :
+				PMEVCNTR_WRITE( 25, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 26
+			case 26 :
+				PMEVCNTR_WRITE( 26, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 27
+			case 27 :
+				PMEVCNTR_WRITE( 27, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 28
+			case 28 :
+				PMEVCNTR_WRITE( 28, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 29
+			case 29 :
+				PMEVCNTR_WRITE( 29, count );
+				break;
+#endif
+#if NEVENTS_ARCH_MAX > 30
+			case 30 :
+				PMEVCNTR_WRITE( 30, count );
+				break;
+#endif
+		}
+	}
+
+	//PMSELR: Performance Monitors Event Counter Selection Register
+	//PMXEVTYPER, PMXEVCNTR: event type and count registers of the counter selected by PMSELR
+	//https://developer.arm.com/docs/ddi0595/f/aarch32-system-registers/pmselr
+	//Indirect access costs a PMSELR write and an ISB per access, but no dispatch on n
+
+	static inline unsigned pmselr_read(void) {
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c9, c12, 5\t\n" : "=r" (x));
+		return x;
+	}
+
+	//Select event counter n, synchronizing so the next PMXEV* access sees it
+	//The selection and the access are separate instructions, so an interrupt between them that
+	//selects another counter redirects the access: the *_indirect functions mask interrupts in
+	//the kernel, and userspace signal handlers bracket counter access with pmu_select_save/restore
+	static inline void pmselr_write(unsigned n) {
+		asm volatile ("MCR p15, 0, %0, c9, c12, 5\t\n"
+					  "ISB\t\n" :: "r" (n) : "memory");
+	}
+
+	static inline unsigned pmxevtyper_read(void) {
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c9, c13, 1\t\n" : "=r" (x));
+		return x;
+	}
+
+	static inline void pmxevtyper_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c13, 1\t\n" :: "r" (x));
+	}
+
+	static inline unsigned pmxevcntr_read(void) {
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c9, c13, 2\t\n" : "=r" (x));
+		return x;
+	}
+
+	static inline void pmxevcntr_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c13, 2\t\n" :: "r" (x));
+	}
+
+	//Read from event type register n, indirect access
+	static inline unsigned pmevtyper_read_indirect(unsigned n) {
+		unsigned long flags;
+		PMU_SELECT_LOCK(flags);
+		pmselr_write(n);
+		unsigned x = pmxevtyper_read();
+		PMU_SELECT_UNLOCK(flags);
+		return x;
+	}
+
+	//Write to event type register n, indirect access
+	static inline void pmevtyper_write_indirect(unsigned n, unsigned event) {
+		unsigned long flags;
+		PMU_SELECT_LOCK(flags);
+		pmselr_write(n);
+		pmxevtyper_write(event);
+		PMU_SELECT_UNLOCK(flags);
+	}
+
+	//Read from event count register n, indirect access
+	static inline unsigned pmevcntr_read_indirect(unsigned n) {
+		unsigned long flags;
+		PMU_SELECT_LOCK(flags);
+		pmselr_write(n);
+		unsigned x = pmxevcntr_read();
+		PMU_SELECT_UNLOCK(flags);
+		return x;
+	}
+
+	//Write to event counter register n, indirect access
+	static inline void pmevcntr_write_indirect(unsigned n, unsigned count) {
+		unsigned long flags;
+		PMU_SELECT_LOCK(flags);
+		pmselr_write(n);
+		pmxevcntr_write(count);
+		PMU_SELECT_UNLOCK(flags);
+	}
+
+//Backend operations, see struct pmu_backend in perfmon.h
+
+	static inline unsigned cp15_pmcr_read(void) {
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c9, c12, 0\t\n" : "=r" (x));
+		return x;
+	}
+
+	static inline void cp15_pmcr_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c12, 0\t\n" :: "r" (x));
+	}
+
+	static inline unsigned cp15_pmcnten_read(void) {
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c9, c12, 1\t\n" : "=r" (x));
+		return x;
+	}
+
+	static inline void cp15_pmcntenset_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c12, 1\t\n" :: "r" (x));
+	}
+
+	static inline void cp15_pmcntenclr_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c12, 2\t\n" :: "r" (x));
+	}
+
+	//Event counters go through the access path chosen with PMU_ACCESS_INDIRECT
+	//perfmon_bench measures both on the target and reports which is cheaper
+
+	static inline unsigned cp15_pmevtyper_read(unsigned n) {
+#ifdef PMU_ACCESS_INDIRECT
+		return pmevtyper_read_indirect(n);
+#else
+		return pmevtyper_read_direct(n);
+#endif
+	}
+
+	static inline void cp15_pmevtyper_write(unsigned n, unsigned type) {
+#ifdef PMU_ACCESS_INDIRECT
+		pmevtyper_write_indirect(n, type);
+#else
+		pmevtyper_write_direct(n, type);
+#endif
+	}
+
+	static inline unsigned cp15_pmevcntr_read(unsigned n) {
+#ifdef PMU_ACCESS_INDIRECT
+		return pmevcntr_read_indirect(n);
+#else
+		return pmevcntr_read_direct(n);
+#endif
+	}
+
+	static inline void cp15_pmevcntr_write(unsigned n, unsigned count) {
+#ifdef PMU_ACCESS_INDIRECT
+		pmevcntr_write_indirect(n, count);
+#else
+		pmevcntr_write_direct(n, count);
+#endif
+	}
+
+	//PMCCNTR is read and written whole with MRRC/MCRR
+	static inline unsigned long long cp15_pmccntr_read(void) {
+		unsigned low, high;
+		asm volatile ("MRRC p15, 0, %0, %1, c9" : "=r" (low), "=r" (high));
+		return ULL(low, high);
+	}
+
+	static inline void cp15_pmccntr_write(unsigned long long count) {
+		unsigned low = count, high = count >> 32;
+		asm volatile ("MCRR p15, 0, %0, %1, c9" :: "r" (low), "r" (high));
+	}
+
+	static inline unsigned cp15_pmovsr_read(void) {
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c9, c12, 3\t\n" : "=r" (x));
+		return x;
+	}
+
+	static inline void cp15_pmovsr_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c12, 3\t\n" :: "r" (x));
+	}
+
+	static inline void cp15_pmovsset_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c14, 3\t\n" :: "r" (x));
+	}
+
+	static inline unsigned cp15_pminten_read(void) {
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c9, c14, 1\t\n" : "=r" (x));
+		return x;
+	}
+
+	static inline void cp15_pmintenset_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c14, 1\t\n" :: "r" (x));
+	}
+
+	static inline void cp15_pmintenclr_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c14, 2\t\n" :: "r" (x));
+	}
+
+	static inline unsigned cp15_pmuserenr_read(void) {
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c9, c14, 0\t\n" : "=r" (x));
+		return x;
+	}
+
+	static inline void cp15_pmuserenr_write(unsigned x) {
+		asm volatile ("MCR p15, 0, %0, c9, c14, 0\t\n" :: "r" (x));
+	}
+
+	static inline unsigned cp15_mpidr_read(void) {
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c0, c0, 5\t\n" : "=r" (x));
+		return x;
+	}
+
+	//MPIDR can't be read from userspace, see pmu_cpu_core
+	static inline unsigned cp15_cpu(void) {
+		return pmu_cpu_core();
+	}
+
+	//MIDR is PL1-only, so userspace asks Linux, see pmu_midr_user
+	static inline unsigned cp15_midr_read(void) {
+#ifdef __KERNEL__
+		unsigned x = 0;
+		asm volatile ("MRC p15, 0, %0, c0, c0, 0\t\n" : "=r" (x));
+		return x;
+#else
+		return pmu_midr_user();
+#endif
+	}
+
+	//PMCEID0 for n = 0, PMCEID1 for n = 1
+	static inline unsigned cp15_pmceid_read(unsigned n) {
+		unsigned x = 0;
+		if (n) asm volatile ("MRC p15, 0, %0, c9, c12, 7\t\n" : "=r" (x));
+		else asm volatile ("MRC p15, 0, %0, c9, c12, 6\t\n" : "=r" (x));
+		return x;
+	}
+
+#endif
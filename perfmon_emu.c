@@ -0,0 +1,132 @@
+#include "perfmon.h"
+
+//Emulated PMU backend, see perfmon_emu.h
+
+//Internal state
+
+    struct pmu_emu_regs pmu_emu = {
+        .nevents = NEVENTS_ARCH_MAX,
+        .pmceid = { ~0u, ~0u },
+        .midr = PMU_EMU_MIDR,
+    };
+
+    unsigned pmu_emu_script_pending;
+
+    static const struct pmu_emu_step * script_steps;
+    static unsigned script_reads; //Counter reads since the last step fired
+
+
+//Helper Functions
+
+    //Nonzero if counter n counts, cycle counter included
+    static int emu_counting(unsigned n) {
+        if (!(pmu_emu.pmcr & PMCR_ENABLE_COUNTERS)) return 0;
+        if (!((pmu_emu.pmcnten >> n) & 1)) return 0;
+        if (n == 31) return 1;
+        return !(pmu_emu.pmevtyper[n] & PMEVTYPER_U);
+    }
+
+    //Add count to event counter n, carrying overflows into a chained counter above
+    static void emu_counter_add(unsigned n, unsigned long long count) {
+
+        unsigned long long sum = pmu_emu.pmevcntr[n] + count;
+        unsigned long long overflows = sum >> 32;
+        pmu_emu.pmevcntr[n] = sum;
+        if (!overflows) return;
+
+        pmu_emu.pmovsr |= 1 << n;
+
+        //The chain counter only counts when it is enabled itself
+        unsigned high = n + 1;
+        if (n % 2 == 0 && high < pmu_emu.nevents
+            && (pmu_emu.pmevtyper[high] & PMEVTYPER_EVENT) == EVT_CHAIN && emu_counting(high)) {
+            emu_counter_add(high, overflows);
+        }
+
+    }
+
+    static void emu_cycles_add(unsigned long long count) {
+
+        if (pmu_emu.pmcr & PMCR_CYCLE_COUNT_EVERY_64) {
+            count += pmu_emu.prescale;
+            pmu_emu.prescale = count % 64;
+            count /= 64;
+        }
+
+        unsigned long long old = pmu_emu.pmccntr;
+        pmu_emu.pmccntr += count;
+
+        if (pmu_emu.pmcr & PMCR_CYCLE_COUNTER_64_BITS) {
+            if (pmu_emu.pmccntr < old) pmu_emu.pmovsr |= PMCNTEN_CYCLE_CTR;
+        }
+        else if ((pmu_emu.pmccntr >> 32) != (old >> 32)) pmu_emu.pmovsr |= PMCNTEN_CYCLE_CTR;
+
+    }
+
+
+//Public Functions
+
+    void pmu_emu_reset(unsigned nevents) {
+        if (nevents > NEVENTS_ARCH_MAX) nevents = NEVENTS_ARCH_MAX;
+        pmu_emu = (struct pmu_emu_regs) {
+            .nevents = nevents,
+            .pmceid = { ~0u, ~0u },
+            .midr = PMU_EMU_MIDR,
+        };
+        //Availability is cached per CPU, so work it out again for the new PMU
+        for (unsigned i = 0; i < PMU_MAX_CPUS; i++) pmu_state[i].available_init = 0;
+        pmu_emu_script(0, 0);
+    }
+
+    void pmu_emu_inject(unsigned event, unsigned long long count) {
+
+        event &= PMEVTYPER_EVENT;
+
+        //Chain counters are advanced by the counter below them
+        if (event != EVT_CHAIN) {
+            for (unsigned n = 0; n < pmu_emu.nevents; n++) {
+                if ((pmu_emu.pmevtyper[n] & PMEVTYPER_EVENT) == event && emu_counting(n)) {
+                    emu_counter_add(n, count);
+                }
+            }
+        }
+
+        if (event == EVT_CPU_CYCLES && emu_counting(31)) emu_cycles_add(count);
+
+    }
+
+    void pmu_emu_script(const struct pmu_emu_step * steps, unsigned n) {
+        script_steps = steps;
+        script_reads = 0;
+        pmu_emu_script_pending = n;
+    }
+
+    //Fire every step due at this read, steps with 0 reads fire together
+    void pmu_emu_script_read(void) {
+        script_reads++;
+        while (pmu_emu_script_pending && script_reads >= script_steps->reads) {
+            const struct pmu_emu_step * step = script_steps++;
+            pmu_emu_script_pending--;
+            script_reads = 0;
+            pmu_emu_inject(step->event, step->count);
+        }
+    }
+
+    unsigned emu_pmcr_read(void) {
+        return pmu_emu.pmcr | (pmu_emu.nevents << PMCR_NEVENTS_SHIFT);
+    }
+
+    void emu_pmcr_write(unsigned x) {
+
+        //Reset bits act on write and read as zero
+        if (x & PMCR_EVENT_COUNTER_RESET) {
+            for (unsigned n = 0; n < pmu_emu.nevents; n++) pmu_emu.pmevcntr[n] = 0;
+        }
+        if (x & PMCR_CYCLE_COUNTER_RESET) {
+            pmu_emu.pmccntr = 0;
+            pmu_emu.prescale = 0;
+        }
+
+        pmu_emu.pmcr = x & PMCR_WRITABLE & ~(PMCR_EVENT_COUNTER_RESET | PMCR_CYCLE_COUNTER_RESET);
+
+    }
@@ -0,0 +1,183 @@
+#ifndef __PERFMON_EMU_H
+#define __PERFMON_EMU_H
+
+/******************************************************************************
+*
+* perfmon_emu.h
+*
+* Emulated PMU backend for perfmon.h.
+*
+* Selected with -DPMU_BACKEND_EMU, or by name with pmu_backend_select("emu")
+* in PMU_BACKEND_RUNTIME builds, the PMU registers live in memory (pmu_emu)
+* and count nothing on their own. Events are injected by the caller, so the
+* library's allocation, chaining, state and read-retry logic can be run and
+* timed on any host, with deterministic counts.
+*
+* Emulation:
+*	Counters only count when PMCR.E and their PMCNTEN bit are set, and not
+*	when PMEVTYPER.U excludes user mode (injected events are user mode).
+*	Event counters wrap at 32 bits, setting their PMOVSR bit. An odd counter
+*	of type EVT_CHAIN counts the overflows of the counter below it.
+*	PMCCNTR counts EVT_CPU_CYCLES, divided by 64 with PMCR.D, and overflows
+*	at 32 or 64 bits according to PMCR.LC.
+*	PMINTEN is a plain register: no overflow interrupts are raised, call
+*	pmu_overflow_handler to emulate one.
+*
+* Event injector:
+*	pmu_emu_inject advances every counter counting an event.
+*	pmu_emu_script queues injections that fire from inside counter reads,
+*	e.g. between the high and low reads of a chained counter, to force an
+*	overflow in the middle of a read.
+*	perfmon_check.c drives the library with both (make host).
+*
+* There is a single emulated PMU, shared by all threads, and not thread safe.
+* pmu_cpu() follows pmu_emu.mpidr. pmu_emu_reset makes the PMU a Cortex-A53
+* (pmu_emu.midr) implementing every event; call pmu_event_available_init
+* after changing pmu_emu.pmceid or pmu_emu.midr.
+*
+******************************************************************************/
+
+	//Emulated register file
+	struct pmu_emu_regs {
+		unsigned pmcr; //Writable PMCR bits
+		unsigned nevents; //PMCR.N, at most NEVENTS_ARCH_MAX
+		unsigned pmcnten;
+		unsigned pmevtyper[NEVENTS_ARCH_MAX];
+		unsigned pmevcntr[NEVENTS_ARCH_MAX];
+		unsigned long long pmccntr;
+		unsigned prescale; //Cycles towards the next PMCCNTR increment with PMCR.D
+		unsigned pmovsr;
+		unsigned pminten;
+		unsigned pmuserenr;
+		unsigned pmceid[2];
+		unsigned mpidr;
+		unsigned midr;
+	};
+
+	extern struct pmu_emu_regs pmu_emu;
+
+	#define PMU_EMU_MIDR 0x410FD034 //Cortex-A53 r0p4
+
+	//Scripted injection, see pmu_emu_script
+	struct pmu_emu_step {
+		unsigned reads; //Counter reads to let through since the previous step
+		unsigned event; //Event to inject
+		unsigned long long count; //Occurrences of the event
+	};
+
+	//Reset the register file to an idle PMU with nevents counters
+	//Every common event is reported in PMCEID, and the script is cleared
+	void pmu_emu_reset(unsigned nevents);
+
+	//Advance every enabled counter counting event by count occurrences
+	//EVT_CPU_CYCLES also advances PMCCNTR
+	void pmu_emu_inject(unsigned event, unsigned long long count);
+
+	//Queue injections to fire from inside counter reads (PMEVCNTR and PMCCNTR)
+	//Step i fires just before the read steps[i].reads reads after step i - 1 fired
+	//steps must stay valid until the script has run, n = 0 cancels it
+	void pmu_emu_script(const struct pmu_emu_step * steps, unsigned n);
+
+	//Nonzero while scripted steps remain
+	extern unsigned pmu_emu_script_pending;
+
+	//Count a counter read against the script
+	void pmu_emu_script_read(void);
+
+	//Backend operations, see struct pmu_backend in perfmon.h
+
+	unsigned emu_pmcr_read(void);
+	void emu_pmcr_write(unsigned x);
+
+	static inline unsigned emu_pmcnten_read(void) {
+		return pmu_emu.pmcnten;
+	}
+
+	static inline void emu_pmcntenset_write(unsigned x) {
+		pmu_emu.pmcnten |= x;
+	}
+
+	static inline void emu_pmcntenclr_write(unsigned x) {
+		pmu_emu.pmcnten &= ~x;
+	}
+
+	static inline unsigned emu_pmevtyper_read(unsigned n) {
+		if (n >= pmu_emu.nevents) return 0;
+		return pmu_emu.pmevtyper[n];
+	}
+
+	static inline void emu_pmevtyper_write(unsigned n, unsigned type) {
+		if (n >= pmu_emu.nevents) return;
+		pmu_emu.pmevtyper[n] = type;
+	}
+
+	static inline unsigned emu_pmevcntr_read(unsigned n) {
+		if (pmu_emu_script_pending) pmu_emu_script_read();
+		if (n >= pmu_emu.nevents) return 0;
+		return pmu_emu.pmevcntr[n];
+	}
+
+	static inline void emu_pmevcntr_write(unsigned n, unsigned count) {
+		if (n >= pmu_emu.nevents) return;
+		pmu_emu.pmevcntr[n] = count;
+	}
+
+	static inline unsigned long long emu_pmccntr_read(void) {
+		if (pmu_emu_script_pending) pmu_emu_script_read();
+		return pmu_emu.pmccntr;
+	}
+
+	static inline void emu_pmccntr_write(unsigned long long count) {
+		pmu_emu.pmccntr = count;
+	}
+
+	static inline unsigned emu_pmovsr_read(void) {
+		return pmu_emu.pmovsr;
+	}
+
+	static inline void emu_pmovsr_write(unsigned x) {
+		pmu_emu.pmovsr &= ~x;
+	}
+
+	static inline void emu_pmovsset_write(unsigned x) {
+		pmu_emu.pmovsr |= x;
+	}
+
+	static inline unsigned emu_pminten_read(void) {
+		return pmu_emu.pminten;
+	}
+
+	static inline void emu_pmintenset_write(unsigned x) {
+		pmu_emu.pminten |= x;
+	}
+
+	static inline void emu_pmintenclr_write(unsigned x) {
+		pmu_emu.pminten &= ~x;
+	}
+
+	static inline unsigned emu_pmuserenr_read(void) {
+		return pmu_emu.pmuserenr;
+	}
+
+	static inline void emu_pmuserenr_write(unsigned x) {
+		pmu_emu.pmuserenr = x;
+	}
+
+	static inline unsigned emu_mpidr_read(void) {
+		return pmu_emu.mpidr;
+	}
+
+	//Aff0 of the emulated MPIDR
+	static inline unsigned emu_cpu(void) {
+		return pmu_emu.mpidr & 0xff;
+	}
+
+	static inline unsigned emu_midr_read(void) {
+		return pmu_emu.midr;
+	}
+
+	static inline unsigned emu_pmceid_read(unsigned n) {
+		return pmu_emu.pmceid[n & 1];
+	}
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef __PERFMON_EVENT_NAMES_H
+#define __PERFMON_EVENT_NAMES_H
+
+//Generated by perfmon_event_names.py from the EVT_* constants in perfmon.h, do not edit
+//Perfect hash of event names: FNV-1a of the upper-cased name from PMU_EVENT_NAMES_SEED,
+//top PMU_EVENT_NAMES_BITS bits index pmu_event_names, empty entries have a null name
+
+#define PMU_EVENT_NAMES_BITS 8
+#define PMU_EVENT_NAMES_SEED 0x0000151fu
+#define PMU_EVENT_NAMES_PRIME 0x01000193u
+
+static const struct {
+	const char * name;
+	unsigned event;
+} pmu_event_names[1 << PMU_EVENT_NAMES_BITS] = {
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_PRE_DECODE_ERR", 0xC6 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "INST_RETIRED", 0x08 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "SW_INCR", 0x00 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "L1D_CACHE_REFILL", 0x03 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_READ_ALLOC_ENTER", 0xC4 },
+	{ "L1D_CACHE_WB", 0x15 },
+	{ "A53_TLB_ERR", 0xD2 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "BR_IMMED_RETIRED", 0x0D },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_BR_INDIRECT_ADDR_MISPRED", 0xCB },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "EXC_RETURN", 0x0A },
+	{ 0, 0 },
+	{ "A53_L1D_CACHE_ERR", 0xD1 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "ST_RETIRED", 0x07 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "L2D_CACHE_ALLOCATE", 0x20 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_SIMD_DEP_STALL", 0xE6 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_BR_COND_MISPRED", 0xCC },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "UNALIGNED_LDST_RETIRED", 0x0F },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_IUTLB_DEP_STALL", 0xE2 },
+	{ "A53_IC_DEP_STALL", 0xE1 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "LD_RETIRED", 0x06 },
+	{ 0, 0 },
+	{ "MEM_ACCESS", 0x13 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "L2D_CACHE", 0x16 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "L1I_CACHE", 0x14 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "CID_WRITE_RETIRED", 0x0B },
+	{ "A53_EXC_FIQ", 0x87 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "BR_MIS_PRED", 0x10 },
+	{ "A53_OTHER_IQ_DEP_STALL", 0xE0 },
+	{ 0, 0 },
+	{ "EXC_TAKEN", 0x09 },
+	{ 0, 0 },
+	{ "PC_WRITE_RETIRED", 0x0C },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_PREFETCH_LINEFILL", 0xC2 },
+	{ "A53_OTHER_INTERLOCK_STALL", 0xE4 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "BR_RETURN_RETIRED", 0x0E },
+	{ "A53_AGU_DEP_STALL", 0xE5 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_BR_COND", 0xC9 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_BUS_ACCESS_WR", 0x61 },
+	{ 0, 0 },
+	{ "A53_EXT_MEM_REQ", 0xC0 },
+	{ 0, 0 },
+	{ "L1D_TLB_REFILL", 0x05 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_L1I_CACHE_ERR", 0xD0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "INST_SPEC", 0x1B },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_STALL_SB_FULL", 0xC7 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "CPU_CYCLES", 0x11 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "L1I_TLB_REFILL", 0x02 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_ICACHE_THROTTLE", 0xC3 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_BR_INDIRECT_SPEC", 0x7A },
+	{ 0, 0 },
+	{ "L1D_CACHE", 0x04 },
+	{ "A53_BR_INDIRECT_MISPRED", 0xCA },
+	{ 0, 0 },
+	{ "A53_DECODE_DEP_STALL", 0xE3 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "L2D_CACHE_REFILL", 0x17 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "L1I_CACHE_REFILL", 0x01 },
+	{ "A53_LD_DEP_STALL", 0xE7 },
+	{ 0, 0 },
+	{ "A53_ST_DEP_STALL", 0xE8 },
+	{ "BUS_CYCLES", 0x1D },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "BR_PRED", 0x12 },
+	{ "MEMORY_ERROR", 0x1A },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "L1D_CACHE_ALLOCATE", 0x1F },
+	{ "TTBR_WRITE_RETIRED", 0x1C },
+	{ 0, 0 },
+	{ "A53_BUS_ACCESS_RD", 0x60 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "A53_EXT_SNOOP", 0xC8 },
+	{ "A53_EXT_MEM_REQ_NC", 0xC1 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ 0, 0 },
+	{ "L2D_CACHE_WB", 0x18 },
+	{ 0, 0 },
+	{ "A53_READ_ALLOC", 0xC5 },
+	{ 0, 0 },
+	{ "A53_EXC_IRQ", 0x86 },
+	{ "BUS_ACCESS", 0x19 },
+};
+
+#endif
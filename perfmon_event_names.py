@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+#
+# Generate perfmon_event_names.h, a perfect hash table of event names
+# to event numbers, from the EVT_* constants in perfmon.h
+#
+# Run `make names` after adding events to perfmon.h
+#
+# The hash is FNV-1a over the upper-cased name, starting from a seed, and
+# indexes the table with its top bits. The table is the smallest power of
+# two at least twice the number of names for which some seed sends every
+# name to its own entry, so a lookup is one hash and one name compare.
+
+import re
+import sys
+
+FNV_PRIME = 0x01000193
+MASK = 0xffffffff
+
+#Events that make no sense to ask for by name
+SKIP = { 'CHAIN' }
+
+
+def fnv(name, seed):
+    h = seed
+    for c in name.upper().encode():
+        h = ((h ^ c) * FNV_PRIME) & MASK
+    return h
+
+
+def events(header):
+    found = []
+    for m in re.finditer(r'const static unsigned EVT_(\w+) = (0x[0-9A-Fa-f]+|\d+);', header):
+        name, code = m.group(1), int(m.group(2), 0)
+        if name not in SKIP:
+            found.append((name, code))
+    return found
+
+
+def perfect(names):
+    bits = 1
+    while (1 << bits) < 2 * len(names):
+        bits += 1
+    while True:
+        for seed in range(1, 1 << 20):
+            slots = { fnv(name, seed) >> (32 - bits) for name in names }
+            if len(slots) == len(names):
+                return bits, seed
+        bits += 1
+
+
+def main():
+    source = sys.argv[1] if len(sys.argv) > 1 else 'perfmon.h'
+    output = sys.argv[2] if len(sys.argv) > 2 else 'perfmon_event_names.h'
+
+    with open(source) as f:
+        found = events(f.read())
+    bits, seed = perfect([name for name, _ in found])
+
+    table = [None] * (1 << bits)
+    for name, code in found:
+        table[fnv(name, seed) >> (32 - bits)] = (name, code)
+
+    lines = [
+        '#ifndef __PERFMON_EVENT_NAMES_H',
+        '#define __PERFMON_EVENT_NAMES_H',
+        '',
+        '//Generated by perfmon_event_names.py from the EVT_* constants in perfmon.h, do not edit',
+        '//Perfect hash of event names: FNV-1a of the upper-cased name from PMU_EVENT_NAMES_SEED,',
+        '//top PMU_EVENT_NAMES_BITS bits index pmu_event_names, empty entries have a null name',
+        '',
+        '#define PMU_EVENT_NAMES_BITS %d' % bits,
+        '#define PMU_EVENT_NAMES_SEED 0x%08xu' % seed,
+        '#define PMU_EVENT_NAMES_PRIME 0x%08xu' % FNV_PRIME,
+        '',
+        'static const struct {',
+        '\tconst char * name;',
+        '\tunsigned event;',
+        '} pmu_event_names[1 << PMU_EVENT_NAMES_BITS] = {',
+    ]
+    for entry in table:
+        if entry:
+            lines.append('\t{ "%s", 0x%02X },' % entry)
+        else:
+            lines.append('\t{ 0, 0 },')
+    lines += [ '};', '', '#endif', '' ]
+
+    with open(output, 'w') as f:
+        f.write('\n'.join(lines))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,237 @@
+#include "perfmon_metrics.h"
+
+//Derived metrics, see perfmon_metrics.h
+
+//Internal state
+
+    //Indexed by PMU_METRIC_*
+    static const struct pmu_metric_def metric_defs[PMU_METRIC_COUNT] = {
+        { "ipc", EVT_INST_RETIRED, EVT_CPU_CYCLES, 1 },
+        { "cpi", EVT_CPU_CYCLES, EVT_INST_RETIRED, 1 },
+        { "l1i_mpki", EVT_L1I_CACHE_REFILL, EVT_INST_RETIRED, 1000 },
+        { "l1d_mpki", EVT_L1D_CACHE_REFILL, EVT_INST_RETIRED, 1000 },
+        { "l2d_mpki", EVT_L2D_CACHE_REFILL, EVT_INST_RETIRED, 1000 },
+        { "l1d_miss_ratio", EVT_L1D_CACHE_REFILL, EVT_L1D_CACHE, 1 },
+        { "l2d_miss_ratio", EVT_L2D_CACHE_REFILL, EVT_L2D_CACHE, 1 },
+        { "l1i_tlb_mpki", EVT_L1I_TLB_REFILL, EVT_INST_RETIRED, 1000 },
+        { "l1d_tlb_mpki", EVT_L1D_TLB_REFILL, EVT_INST_RETIRED, 1000 },
+        { "br_mpki", EVT_BR_MIS_PRED, EVT_INST_RETIRED, 1000 },
+        { "br_mispred_ratio", EVT_BR_MIS_PRED, EVT_BR_PRED, 1 },
+        { "mem_per_inst", EVT_MEM_ACCESS, EVT_INST_RETIRED, 1 },
+    };
+
+
+//Helper Functions
+
+    //Add an event to a set unless it's already there
+    static int metric_set_need(struct pmu_metric_set * set, unsigned event) {
+
+        //The cycle counter counts cycles
+        if (event == EVT_CPU_CYCLES) return PMU_RETURN_SUCCESS;
+
+        for (unsigned i = 0; i < set->nevents; i++) {
+            if (set->events[i] == event) return PMU_RETURN_SUCCESS;
+        }
+
+        if (!pmu_event_available(event)) return PMU_RETURN_EVENT_NO_AVAIL;
+        if (set->nevents >= NEVENTS_ARCH_MAX) return PMU_RETURN_GROUP_TOO_LARGE;
+        set->events[set->nevents++] = event;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    //What an event counted between two snapshots
+    static int metric_count(const struct pmu_metric_set * set, unsigned event,
+        const struct pmu_snapshot * start, const struct pmu_snapshot * end, unsigned long long * count) {
+
+        unsigned enabled = start->enabled & end->enabled;
+
+        //The 32-bit cycle counter wraps, so take the difference modulo 2^32
+        if (event == EVT_CPU_CYCLES) {
+            if (!(enabled & PMCNTEN_CYCLE_CTR)) return PMU_RETURN_EVENT_NO_WATCH;
+            if ((end->cycles | start->cycles) >> 32) *count = end->cycles - start->cycles;
+            else *count = (unsigned) (end->cycles - start->cycles);
+            return PMU_RETURN_SUCCESS;
+        }
+
+        for (unsigned i = 0; i < set->nevents; i++) {
+
+            if (set->events[i] != event) continue;
+
+            const struct pmu_event_handle * handle = &set->handles[i];
+            if (!((enabled >> handle->slot) & 1)) return PMU_RETURN_EVENT_NO_WATCH;
+
+            //So do 32-bit event counters
+            if (handle->chained) *count = pmu_snapshot_read(end, handle) - pmu_snapshot_read(start, handle);
+            else *count = (unsigned) (end->count[handle->slot] - start->count[handle->slot]);
+
+            return PMU_RETURN_SUCCESS;
+        }
+
+        return PMU_RETURN_EVENT_NO_WATCH;
+
+    }
+
+    //Numerator and denominator of a metric between two snapshots
+    static int metric_operands(const struct pmu_metric_set * set, unsigned metric,
+        const struct pmu_snapshot * start, const struct pmu_snapshot * end,
+        unsigned long long * numerator, unsigned long long * denominator) {
+
+        if (!set || !start || !end) return PMU_RETURN_BAD_PTR;
+        if (metric >= PMU_METRIC_COUNT || !((set->metrics >> metric) & 1)) return PMU_RETURN_EVENT_NO_WATCH;
+
+        const struct pmu_metric_def * def = &metric_defs[metric];
+        int ret = metric_count(set, def->numerator, start, end, numerator);
+        if (ret < 0) return ret;
+        return metric_count(set, def->denominator, start, end, denominator);
+
+    }
+
+    //Top 32 bits of nonzero v, so that v ~= result * 2^exp
+    static inline unsigned metric_norm(unsigned long long v, int * exp) {
+        int s = __builtin_clzll(v);
+        *exp = 32 - s;
+        return (v << s) >> 32;
+    }
+
+    //2^63 / d for d in [2^31, 2^32), capped at 2^32 - 1, without dividing
+    //Works on x = 2^31 / D for D = d / 2^32 in [0.5, 1)
+    static inline unsigned metric_reciprocal(unsigned d) {
+
+        //Linear estimate 48/17 - 32/17 D, within 1/17 of 1/D
+        unsigned long long x = 6063268397ull - ((4042178931ull * d) >> 32);
+
+        //Newton-Raphson, x = x (2 - D x), squares the error each step: 2^-8, 2^-16, 2^-32
+        for (int i = 0; i < 3; i++) {
+            unsigned long long e = -(d * x);
+            x = (x * (e >> 32)) >> 31;
+        }
+
+        return x > 0xffffffffull ? 0xffffffff : (unsigned) x;
+
+    }
+
+    //scale * n / d with PMU_METRIC_FRAC_BITS fractional bits
+    static unsigned long long metric_ratio(unsigned long long n, unsigned long long d, unsigned scale) {
+
+        if (!n || !d || !scale) return 0;
+
+        int en, es, ed;
+        unsigned mn = metric_norm(n, &en);
+        unsigned ms = metric_norm((unsigned long long) mn * scale, &es);
+        unsigned md = metric_norm(d, &ed);
+
+        //scale * n / d ~= ms * 2^(en + es) * reciprocal(md) * 2^-63 * 2^-ed
+        unsigned long long p = (unsigned long long) ms * metric_reciprocal(md);
+        int shift = 63 - PMU_METRIC_FRAC_BITS - en - es + ed;
+
+        //Round to nearest, so exact ratios aren't truncated one unit short by the reciprocal
+        if (shift >= 64) return 0;
+        if (shift > 0) return (p >> shift) + ((p >> (shift - 1)) & 1);
+        if (!shift) return p;
+        if (shift <= -64 || p >> (64 + shift)) return ~0ull;
+        return p << -shift;
+
+    }
+
+
+//Public Functions
+
+    const struct pmu_metric_def * pmu_metric_def(unsigned metric) {
+        return metric < PMU_METRIC_COUNT ? &metric_defs[metric] : 0;
+    }
+
+    int pmu_metric_set_init(struct pmu_metric_set * set, const unsigned * metrics, unsigned n) {
+
+        if (!set || !metrics) return PMU_RETURN_BAD_PTR;
+
+        set->metrics = 0;
+        set->nevents = 0;
+        set->added = 0;
+
+        for (unsigned i = 0; i < n; i++) {
+
+            if (metrics[i] >= PMU_METRIC_COUNT) return PMU_RETURN_EVENT_NO_AVAIL;
+            const struct pmu_metric_def * def = &metric_defs[metrics[i]];
+
+            int ret = metric_set_need(set, def->numerator);
+            if (ret < 0) return ret;
+            ret = metric_set_need(set, def->denominator);
+            if (ret < 0) return ret;
+
+            set->metrics |= 1 << metrics[i];
+        }
+
+        //A set that can never be counted at once is an error now, not a failed schedule later
+        if (set->nevents > pmu_nevents()) return PMU_RETURN_GROUP_TOO_LARGE;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    int pmu_metric_set_schedule(struct pmu_metric_set * set) {
+
+        if (!set) return PMU_RETURN_BAD_PTR;
+
+        pmu_metric_set_unschedule(set);
+
+        for (unsigned i = 0; i < set->nevents; i++) {
+
+            //Share events that are already being counted
+            int ret = pmu_event_handle_get(set->events[i], &set->handles[i]);
+            if (ret == PMU_RETURN_EVENT_NO_WATCH) {
+                ret = pmu_event_add_handle(set->events[i], 0, &set->handles[i]);
+                if (ret == PMU_RETURN_SUCCESS) set->added |= 1 << i;
+            }
+
+            if (ret < 0) {
+                pmu_metric_set_unschedule(set);
+                return ret;
+            }
+        }
+
+        pmccntr_enable();
+        pmu_enable();
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    void pmu_metric_set_unschedule(struct pmu_metric_set * set) {
+        if (!set) return;
+        for (unsigned pending = set->added; pending; pending &= pending - 1) {
+            pmu_event_remove(set->events[__builtin_ctz(pending)], 0);
+        }
+        set->added = 0;
+    }
+
+    int pmu_metric_fixed(const struct pmu_metric_set * set, unsigned metric,
+        const struct pmu_snapshot * start, const struct pmu_snapshot * end, unsigned long long * value) {
+
+        unsigned long long n, d;
+        if (!value) return PMU_RETURN_BAD_PTR;
+        int ret = metric_operands(set, metric, start, end, &n, &d);
+        if (ret < 0) return ret;
+
+        *value = metric_ratio(n, d, metric_defs[metric].scale);
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+#ifndef __KERNEL__
+    int pmu_metric_value(const struct pmu_metric_set * set, unsigned metric,
+        const struct pmu_snapshot * start, const struct pmu_snapshot * end, double * value) {
+
+        unsigned long long n, d;
+        if (!value) return PMU_RETURN_BAD_PTR;
+        int ret = metric_operands(set, metric, start, end, &n, &d);
+        if (ret < 0) return ret;
+
+        *value = d ? (double) metric_defs[metric].scale * n / d : 0;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+#endif
@@ -0,0 +1,107 @@
+#ifndef __PERFMON_METRICS_H
+#define __PERFMON_METRICS_H
+
+/******************************************************************************
+*
+* perfmon_metrics.h
+*
+* Derived metrics (IPC, MPKI, miss ratios, ...) over counter snapshots.
+*
+* Each metric is a ratio of two events, times a scale:
+*	value = scale * numerator / denominator
+* e.g. L1D MPKI is 1000 * EVT_L1D_CACHE_REFILL / EVT_INST_RETIRED.
+* EVT_CPU_CYCLES is taken from the cycle counter, so it needs no event counter.
+*
+* Use:
+*	pmu_metric_set_init works out the raw events a list of metrics needs,
+*	each once however many metrics share it, and pmu_metric_set_schedule
+*	puts them on event counters, reusing events already being counted.
+*	Take snapshots (pmu_snapshot) around the code being measured; metrics
+*	are only computed from them when asked for with pmu_metric_fixed
+*	or pmu_metric_value.
+*
+* Fixed point:
+*	pmu_metric_fixed returns values with PMU_METRIC_FRAC_BITS fractional
+*	bits. It divides by multiplying with a reciprocal refined by
+*	Newton-Raphson, so it needs no 64-bit division and runs in the kernel
+*	module as well. Values are accurate to about 29 significant bits.
+*	pmu_metric_value returns a double, and is userspace only.
+*
+* A metric set describes counters on the calling CPU: schedule it, and take
+* its snapshots, on the CPU the metrics are for. Reschedule after the event
+* set changes (see pmu_handle_stale).
+*
+******************************************************************************/
+
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	//Metrics
+	const static unsigned PMU_METRIC_IPC = 0; //Instructions per cycle
+	const static unsigned PMU_METRIC_CPI = 1; //Cycles per instruction
+	const static unsigned PMU_METRIC_L1I_MPKI = 2; //L1 instruction cache refills per 1000 instructions
+	const static unsigned PMU_METRIC_L1D_MPKI = 3; //L1 data cache refills per 1000 instructions
+	const static unsigned PMU_METRIC_L2D_MPKI = 4; //L2 cache refills per 1000 instructions
+	const static unsigned PMU_METRIC_L1D_MISS_RATIO = 5; //L1 data cache refills per access
+	const static unsigned PMU_METRIC_L2D_MISS_RATIO = 6; //L2 cache refills per access
+	const static unsigned PMU_METRIC_L1I_TLB_MPKI = 7; //L1 instruction TLB refills per 1000 instructions
+	const static unsigned PMU_METRIC_L1D_TLB_MPKI = 8; //L1 data TLB refills per 1000 instructions
+	const static unsigned PMU_METRIC_BR_MPKI = 9; //Branch mispredictions per 1000 instructions
+	const static unsigned PMU_METRIC_BR_MISPRED_RATIO = 10; //Mispredicted branches per predictable branch
+	const static unsigned PMU_METRIC_MEM_PER_INST = 11; //Data memory accesses per instruction
+	#define PMU_METRIC_COUNT 12
+
+	//Fractional bits of pmu_metric_fixed values
+	#define PMU_METRIC_FRAC_BITS 16
+	#define PMU_METRIC_ONE ( 1ull << PMU_METRIC_FRAC_BITS )
+
+	//Definition of a metric
+	struct pmu_metric_def {
+		const char * name;
+		unsigned numerator; //Event counted
+		unsigned denominator; //Event it is relative to
+		unsigned scale; //Multiplier, e.g. 1000 for per-kilo-instruction metrics
+	};
+
+	//Metrics and the events scheduled for them
+	struct pmu_metric_set {
+		unsigned metrics; //Bit per metric in the set
+		unsigned nevents; //Event counters needed
+		unsigned events[NEVENTS_ARCH_MAX]; //Events needed, EVT_CPU_CYCLES excluded
+		unsigned added; //Bit per event added by pmu_metric_set_schedule, rather than already counted
+		struct pmu_event_handle handles[NEVENTS_ARCH_MAX]; //Valid once scheduled
+	};
+
+	//Get the definition of a metric, or null
+	const struct pmu_metric_def * pmu_metric_def(unsigned metric);
+
+	//Work out the events needed by n metrics
+	//Returns PMU_RETURN_GROUP_TOO_LARGE if they need more event counters than there are
+	int pmu_metric_set_init(struct pmu_metric_set * set, const unsigned * metrics, unsigned n);
+
+	//Count the set's events on the calling CPU, and enable the cycle counter
+	//All events are counted or none
+	int pmu_metric_set_schedule(struct pmu_metric_set * set);
+
+	//Stop counting the events pmu_metric_set_schedule added
+	void pmu_metric_set_unschedule(struct pmu_metric_set * set);
+
+	//Value of a metric between two snapshots, with PMU_METRIC_FRAC_BITS fractional bits
+	//0 if the denominator didn't count, saturates at ~0ull
+	int pmu_metric_fixed(const struct pmu_metric_set * set, unsigned metric,
+		const struct pmu_snapshot * start, const struct pmu_snapshot * end, unsigned long long * value);
+
+#ifndef __KERNEL__
+	//Value of a metric between two snapshots
+	int pmu_metric_value(const struct pmu_metric_set * set, unsigned metric,
+		const struct pmu_snapshot * start, const struct pmu_snapshot * end, double * value);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
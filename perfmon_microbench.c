@@ -0,0 +1,302 @@
+/******************************************************************************
+*
+* perfmon_microbench.c
+*
+* Measures the cost of the library's public calls, in cycles and
+* instructions, one call at a time over BENCH_REPS repetitions.
+*
+* Each call is bracketed by a cycle counter read and an INST_RETIRED
+* read, and the cost of an empty bracket (the minimum over BENCH_REPS)
+* is subtracted. The report gives min, median, p99 and max cycles and
+* the median instruction count. Calls that read counters are measured
+* on 32-bit, chained 64-bit and software-extended 64-bit events.
+*
+* In builds with the perf backend (BACKEND=perf or runtime), reading a
+* perf event with read(2) and through its mmap page are measured too,
+* for comparison with the library's access path.
+*
+* Run with -H for a log2 histogram of each call's cycles.
+*
+* Userspace access must be enabled as for perfmon_bench.
+* The emulated backend (BACKEND=emu) has no cycles or instructions to
+* count, so there calls are timed with the host's clock instead: TSC
+* ticks on x86, nanoseconds elsewhere. This measures the library's own
+* software overhead on any Linux host.
+*
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "perfmon.h"
+
+#define BENCH_REPS 4096
+#define BENCH_BUCKETS 32
+
+//Samples of the call being measured
+static unsigned bench_cycles[BENCH_REPS];
+static unsigned bench_insts[BENCH_REPS];
+
+//Cost of an empty bracket, subtracted from every sample
+static unsigned bench_cycles_bias, bench_insts_bias;
+
+//Instruction counter, if it could be added
+static struct pmu_event_handle bench_inst;
+static int bench_inst_ok;
+
+static int bench_histogram;
+
+//Nonzero to time with the host's clock, where the cycle counter doesn't count
+#if defined(PMU_BACKEND_EMU)
+#define bench_host_clock 1
+#elif defined(PMU_BACKEND_RUNTIME)
+static int bench_host_clock;
+#else
+#define bench_host_clock 0
+#endif
+
+static inline unsigned bench_host_read(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return (unsigned) __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned) ts.tv_sec * 1000000000u + (unsigned) ts.tv_nsec;
+#endif
+}
+
+static inline unsigned bench_clock(void) {
+	return bench_host_clock ? bench_host_read() : pmccntr_read_32();
+}
+
+static inline unsigned bench_inst_read(void) {
+	return bench_inst_ok ? pmu_handle_read_32(&bench_inst) : 0;
+}
+
+//Time BODY BENCH_REPS times, running BEFORE and AFTER outside the bracket
+#define BENCH_SAMPLE( BEFORE, BODY, AFTER ) \
+	do { \
+		for (unsigned r = 0; r < BENCH_REPS; r++) { \
+			BEFORE; \
+			unsigned c0 = bench_clock(); \
+			unsigned i0 = bench_inst_read(); \
+			BODY; \
+			unsigned i1 = bench_inst_read(); \
+			unsigned c1 = bench_clock(); \
+			AFTER; \
+			bench_cycles[r] = c1 - c0; \
+			bench_insts[r] = i1 - i0; \
+		} \
+	} while (0)
+
+#define BENCH( NAME, BEFORE, BODY, AFTER ) \
+	do { \
+		BENCH_SAMPLE( BEFORE, BODY, AFTER ); \
+		bench_report(NAME); \
+	} while (0)
+
+static int bench_cmp(const void * a, const void * b) {
+	unsigned x = *(const unsigned *) a, y = *(const unsigned *) b;
+	return x < y ? -1 : x > y;
+}
+
+static unsigned bench_unbias(unsigned x, unsigned bias) {
+	return x > bias ? x - bias : 0;
+}
+
+static void bench_report(const char * name) {
+
+	for (unsigned r = 0; r < BENCH_REPS; r++) {
+		bench_cycles[r] = bench_unbias(bench_cycles[r], bench_cycles_bias);
+		bench_insts[r] = bench_unbias(bench_insts[r], bench_insts_bias);
+	}
+
+	qsort(bench_cycles, BENCH_REPS, sizeof(bench_cycles[0]), bench_cmp);
+	qsort(bench_insts, BENCH_REPS, sizeof(bench_insts[0]), bench_cmp);
+
+	printf("%-28s %8u %8u %8u %8u", name, bench_cycles[0], bench_cycles[BENCH_REPS / 2],
+		bench_cycles[BENCH_REPS * 99 / 100], bench_cycles[BENCH_REPS - 1]);
+	if (bench_inst_ok) printf(" %8u\n", bench_insts[BENCH_REPS / 2]);
+	else printf(" %8s\n", "-");
+
+	if (!bench_histogram) return;
+
+	//Bucket b holds samples in [2^(b-1), 2^b), bucket 0 holds zeros
+	unsigned buckets[BENCH_BUCKETS] = { 0 };
+	for (unsigned r = 0; r < BENCH_REPS; r++) {
+		unsigned x = bench_cycles[r];
+		buckets[x ? 32 - __builtin_clz(x) : 0]++;
+	}
+	for (unsigned b = 0; b < BENCH_BUCKETS; b++) {
+		if (!buckets[b]) continue;
+		unsigned width = (buckets[b] * 50 + BENCH_REPS - 1) / BENCH_REPS;
+		printf("    < %-10u %6u ", b ? 1u << b : 1u, buckets[b]);
+		for (unsigned w = 0; w < width; w++) putchar('#');
+		putchar('\n');
+	}
+
+}
+
+//Add an event for the benchmark, reporting failures
+static int bench_event_add(const char * what, unsigned event, unsigned flags, struct pmu_event_handle * handle) {
+	int ret = pmu_event_add_handle(event, flags, handle);
+	if (ret != PMU_RETURN_SUCCESS) fprintf(stderr, "can't add %s event: %d\n", what, ret);
+	return ret == PMU_RETURN_SUCCESS;
+}
+
+#if defined(PMU_BACKEND_PERF) || defined(PMU_BACKEND_RUNTIME)
+
+//The perf event behind the instruction counter, opened on the perf backend if the library uses another
+static const struct pmu_perf_counter * bench_perf_counter(void) {
+
+#if defined(PMU_BACKEND_RUNTIME)
+	if (pmu_backend != &pmu_backend_perf) {
+		perf_pmevtyper_write(0, EVT_INST_RETIRED);
+		perf_pmcntenset_write(1);
+		perf_pmcr_write(PMCR_ENABLE_COUNTERS);
+		return &pmu_perf_counters[0];
+	}
+#endif
+
+	if (!bench_inst_ok) return 0;
+	return &pmu_perf_counters[bench_inst.slot];
+
+}
+
+static void bench_perf(void) {
+
+	const struct pmu_perf_counter * c = bench_perf_counter();
+	if (!c || c->fd < 0) {
+		fprintf(stderr, "no perf event to compare with\n");
+		return;
+	}
+
+	volatile unsigned long long sink;
+	BENCH( "perf read(2)", , sink = perf_count_syscall(c), );
+	if (c->page && c->page->cap_user_rdpmc) BENCH( "perf mmap", , sink = perf_count(c), );
+	else fprintf(stderr, "perf mmap reads not allowed here\n");
+	(void) sink;
+
+}
+
+#endif
+
+int main(int argc, char ** argv) {
+
+	bench_histogram = argc > 1 && !strcmp(argv[1], "-H");
+
+#if defined(PMU_BACKEND_RUNTIME)
+	bench_host_clock = pmu_backend == &pmu_backend_emu;
+#endif
+
+	unsigned pmcr = pmcr_read();
+
+	//Count every cycle so results are in cycles
+	pmu_enable();
+	pmccntr_enable();
+	pmcr_unset(PMCR_CYCLE_COUNT_EVERY_64);
+
+	//Emulated instructions are only counted when injected
+	bench_inst_ok = !bench_host_clock && bench_event_add("instruction", EVT_INST_RETIRED, 0, &bench_inst);
+
+	struct pmu_event_handle ev32, ev64, evsw;
+	int ok32 = bench_event_add("32-bit", EVT_L1D_CACHE, 0, &ev32);
+	int ok64 = bench_event_add("chained", EVT_BR_PRED, PMU_EVENTFLAG_64BIT, &ev64);
+	int oksw = bench_event_add("software-extended", EVT_L1D_CACHE_REFILL, PMU_EVENTFLAG_64BIT_SW, &evsw);
+
+	volatile unsigned sink32;
+	volatile unsigned long long sink64;
+	unsigned v32;
+	unsigned long long v64;
+
+	//Empty bracket
+	BENCH_SAMPLE( , , );
+	qsort(bench_cycles, BENCH_REPS, sizeof(bench_cycles[0]), bench_cmp);
+	qsort(bench_insts, BENCH_REPS, sizeof(bench_insts[0]), bench_cmp);
+	bench_cycles_bias = bench_cycles[0];
+	bench_insts_bias = bench_insts[0];
+	const char * unit = "cycles";
+	if (bench_host_clock) {
+#if defined(__x86_64__) || defined(__i386__)
+		unit = "host TSC ticks";
+#else
+		unit = "host ns";
+#endif
+	}
+	fprintf(stderr, "empty bracket: %u %s, %u instructions\n", bench_cycles_bias, unit, bench_insts_bias);
+
+	printf("%-28s %8s %8s %8s %8s %8s\n", "call", "min", "median", "p99", "max", "insts");
+
+	BENCH( "pmccntr_read_32", , sink32 = pmccntr_read_32(), );
+	BENCH( "pmccntr_read_64", , sink64 = pmccntr_read_64(), );
+	BENCH( "pmccntr_get", , sink64 = pmccntr_get(), );
+
+	if (ok32) {
+		BENCH( "pmevcntr_read", , sink32 = pmevcntr_read(ev32.slot), );
+		BENCH( "pmu_handle_read_32", , sink32 = pmu_handle_read_32(&ev32), );
+		BENCH( "pmu_event_read_32", , pmu_event_read_32(EVT_L1D_CACHE, 0, &v32), );
+		BENCH( "pmu_event_get", , pmu_event_get(EVT_L1D_CACHE, 0, &v64), );
+	}
+
+	if (ok64) {
+		BENCH( "pmevcntr_read_64 chained", , sink64 = pmevcntr_read_64(ev64.slot), );
+		BENCH( "pmu_handle_read chained", , sink64 = pmu_handle_read(&ev64), );
+		BENCH( "pmu_event_get chained", , pmu_event_get(EVT_BR_PRED, PMU_EVENTFLAG_64BIT, &v64), );
+	}
+
+	if (oksw) {
+		BENCH( "pmu_handle_read sw", , sink64 = pmu_handle_read(&evsw), );
+		BENCH( "pmu_event_get sw", , pmu_event_get(EVT_L1D_CACHE_REFILL, PMU_EVENTFLAG_64BIT_SW, &v64), );
+	}
+
+	BENCH( "pmu_event_add",
+		, pmu_event_add(EVT_BR_MIS_PRED, 0), pmu_event_remove(EVT_BR_MIS_PRED, 0) );
+	BENCH( "pmu_event_add chained",
+		, pmu_event_add(EVT_BR_MIS_PRED, PMU_EVENTFLAG_64BIT), pmu_event_remove(EVT_BR_MIS_PRED, PMU_EVENTFLAG_64BIT) );
+	BENCH( "pmu_event_remove",
+		pmu_event_add(EVT_BR_MIS_PRED, 0), pmu_event_remove(EVT_BR_MIS_PRED, 0), );
+
+	struct pmu_snapshot snap;
+	BENCH( "pmu_snapshot", , pmu_snapshot(&snap, 0), );
+	BENCH( "pmu_snapshot consistent", , pmu_snapshot(&snap, PMU_SNAPSHOT_CONSISTENT), );
+
+	struct pmu_region region;
+	struct pmu_region_delta delta;
+	BENCH( "pmu_region_begin", , pmu_region_begin(&region), );
+	BENCH( "pmu_region_end", pmu_region_begin(&region), pmu_region_end(&region, &delta), );
+
+	//pmu_unload restores what pmu_load saved, so the pair leaves the PMU as it was
+	BENCH( "pmu_load", , pmu_load(), pmu_unload() );
+	BENCH( "pmu_unload", pmu_load(), pmu_unload(), );
+
+	//A context only takes counters the library hasn't reserved, so hand it the benchmark's events
+	unsigned handed = 0;
+	if (ok32 && pmu_event_remove(EVT_L1D_CACHE, 0) >= 0) handed |= 1u << ev32.slot;
+	if (ok64 && pmu_event_remove(EVT_BR_PRED, PMU_EVENTFLAG_64BIT) >= 0) handed |= 0b11u << ev64.slot;
+	if (oksw && pmu_event_remove(EVT_L1D_CACHE_REFILL, PMU_EVENTFLAG_64BIT_SW) >= 0) handed |= 1u << evsw.slot;
+	pmcntenset_write(handed);
+
+	//Leave the bracket's counters running
+	struct pmu_context ctx;
+	pmu_context_init(&ctx);
+	ctx.enabled &= ~PMCNTEN_CYCLE_CTR;
+	if (bench_inst_ok) ctx.enabled &= ~(1u << bench_inst.slot);
+	BENCH( "pmu_context_save", , pmu_context_save(&ctx), pmu_context_restore(&ctx) );
+	BENCH( "pmu_context_restore", pmu_context_save(&ctx), pmu_context_restore(&ctx), );
+
+#if defined(PMU_BACKEND_PERF) || defined(PMU_BACKEND_RUNTIME)
+	bench_perf();
+#endif
+
+	(void) sink32;
+	(void) sink64;
+
+	pmu_disable_all();
+	pmcr_write(pmcr);
+
+	return 0;
+}
@@ -0,0 +1,698 @@
+/******************************************************************************
+*
+* perfmon_module.c
+*
+* Kernel module built on the perfmon library.
+*
+* Each core has its own PMU, so everything that touches the registers
+* runs on every online CPU through cross-calls: pmu_load/pmu_unload at
+* module load and unload, and event programming through the
+* perfmon_event_*_all functions exported to other kernel code.
+*
+* System-wide counting:
+*	Events given in the events parameter are counted on every core.
+*	Reading /dev/perfmon_counts gives one "cpu event count" line per
+*	core and event, e.g.
+*		insmod perfmon_mod.ko events=0x08,0x11
+*
+* Per-thread counters:
+*	A thread that opens /dev/perfmon_thread takes over the counters
+*	enabled at that moment, except those the library reserved for the
+*	events parameter, sampling or perfmon_event_*_all, which stay
+*	system-wide. They are saved and stopped whenever it is switched out
+*	and restored when it is switched back in, on whichever core it
+*	lands, so it only counts its own events. On a core where one of its
+*	registers is reserved, that counter pauses until the thread moves on.
+*	Reading the file gives the thread's current struct pmu_context,
+*	and only the thread that opened it may read it. If another task
+*	closes it last, the context is unlinked at the owner's next switch.
+*	Needs CONFIG_PREEMPT_NOTIFIERS.
+*
+* Overflow sampling:
+*	Counts sample_event and raises the PMU overflow interrupt every
+*	sample_period occurrences on every core. The handler records the
+*	interrupted PC and a snapshot of all counters into a per-CPU ring
+*	buffer, which is drained as struct pmu_sample records by reading
+*	/dev/perfmon_samples.
+*	Sampling is enabled by giving the PMU interrupt number, e.g.
+*		insmod perfmon_mod.ko irq=<n> sample_event=0x17 sample_period=10000
+*
+* Timer sampling:
+*	A pinned hrtimer on every core ticks profile_hz times a second and
+*	records the interrupted PC, thread id and what every enabled counter
+*	counted since the previous tick (pmu_profile_tick) into a per-CPU
+*	ring, drained as struct pmu_profile_sample records by reading
+*	/dev/perfmon_profile. Needs no PMU interrupt, e.g.
+*		insmod perfmon_mod.ko events=0x11,0x03 profile_hz=1000
+*
+******************************************************************************/
+
+#include <linux/module.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/irq_regs.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/smp.h>
+#include <linux/atomic.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/ptrace.h>
+#include <linux/preempt.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/sched/task.h>
+#include <linux/llist.h>
+#include <linux/irq_work.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+
+#include "perfmon.h"
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("ARM Cortex-A53 performance monitor access");
+
+#define PERFMON_MAX_EVENTS NEVENTS_ARCH_MAX
+
+static unsigned events[PERFMON_MAX_EVENTS];
+static int nevents;
+module_param_array(events, uint, &nevents, 0444);
+MODULE_PARM_DESC(events, "Events to count on every core");
+
+static int irq = -1;
+module_param(irq, int, 0444);
+MODULE_PARM_DESC(irq, "PMU overflow interrupt, sampling is disabled if negative");
+
+static unsigned sample_event = EVT_L2D_CACHE_REFILL;
+module_param(sample_event, uint, 0444);
+MODULE_PARM_DESC(sample_event, "Event to sample on");
+
+static unsigned sample_period = 10000;
+module_param(sample_period, uint, 0444);
+MODULE_PARM_DESC(sample_period, "Events between samples");
+
+static unsigned profile_hz;
+module_param(profile_hz, uint, 0444);
+MODULE_PARM_DESC(profile_hz, "Timer samples per second on every core, timer sampling is disabled if 0");
+
+//Cross-calls
+//Run a library call on every online CPU, collecting the first error
+
+struct perfmon_call {
+    unsigned event;
+    unsigned flags;
+    atomic_t ret; //First error, PMU_RETURN_SUCCESS if none
+    unsigned long long value; //Result of single-CPU reads
+};
+
+static void perfmon_call_error(struct perfmon_call * call, int ret) {
+    if (ret < 0) atomic_cmpxchg(&call->ret, PMU_RETURN_SUCCESS, ret);
+}
+
+static void perfmon_load_ipi(void * info) {
+    pmu_load();
+    pmu_event_available_init();
+}
+
+static void perfmon_unload_ipi(void * info) {
+    pmu_unload();
+}
+
+static void perfmon_event_add_ipi(void * info) {
+    struct perfmon_call * call = info;
+    perfmon_call_error(call, pmu_event_add(call->event, call->flags));
+}
+
+static void perfmon_event_remove_ipi(void * info) {
+    struct perfmon_call * call = info;
+    perfmon_call_error(call, pmu_event_remove(call->event, call->flags));
+}
+
+static void perfmon_event_reset_ipi(void * info) {
+    struct perfmon_call * call = info;
+    perfmon_call_error(call, pmu_event_reset(call->event, call->flags));
+}
+
+static void perfmon_event_get_ipi(void * info) {
+    struct perfmon_call * call = info;
+    perfmon_call_error(call, pmu_event_get(call->event, call->flags, &call->value));
+}
+
+//Count event on every core
+//If any core can't, the event is removed again from all of them
+int perfmon_event_add_all(unsigned event, unsigned flags) {
+    struct perfmon_call call = { .event = event, .flags = flags, .ret = ATOMIC_INIT(PMU_RETURN_SUCCESS) };
+    struct perfmon_call undo = { .event = event, .flags = flags, .ret = ATOMIC_INIT(PMU_RETURN_SUCCESS) };
+
+    on_each_cpu(perfmon_event_add_ipi, &call, 1);
+    if (atomic_read(&call.ret) < 0) {
+        on_each_cpu(perfmon_event_remove_ipi, &undo, 1);
+    }
+    return atomic_read(&call.ret);
+}
+EXPORT_SYMBOL_GPL(perfmon_event_add_all);
+
+//Stop counting event on every core
+int perfmon_event_remove_all(unsigned event, unsigned flags) {
+    struct perfmon_call call = { .event = event, .flags = flags, .ret = ATOMIC_INIT(PMU_RETURN_SUCCESS) };
+    on_each_cpu(perfmon_event_remove_ipi, &call, 1);
+    return atomic_read(&call.ret);
+}
+EXPORT_SYMBOL_GPL(perfmon_event_remove_all);
+
+//Reset event count on every core
+int perfmon_event_reset_all(unsigned event, unsigned flags) {
+    struct perfmon_call call = { .event = event, .flags = flags, .ret = ATOMIC_INIT(PMU_RETURN_SUCCESS) };
+    on_each_cpu(perfmon_event_reset_ipi, &call, 1);
+    return atomic_read(&call.ret);
+}
+EXPORT_SYMBOL_GPL(perfmon_event_reset_all);
+
+//Get event count from one core
+int perfmon_event_get_cpu(int cpu, unsigned event, unsigned flags, unsigned long long * value) {
+    struct perfmon_call call = { .event = event, .flags = flags, .ret = ATOMIC_INIT(PMU_RETURN_SUCCESS) };
+    int ret = smp_call_function_single(cpu, perfmon_event_get_ipi, &call, 1);
+    if (ret) return ret;
+    if (atomic_read(&call.ret) < 0) return atomic_read(&call.ret);
+    *value = call.value;
+    return PMU_RETURN_SUCCESS;
+}
+EXPORT_SYMBOL_GPL(perfmon_event_get_cpu);
+
+//System-wide counts
+
+static DEFINE_MUTEX(perfmon_counts_lock);
+
+//One "cpu event count" line per online core and counted event
+static ssize_t perfmon_counts_read(struct file * file, char __user * buf, size_t len, loff_t * off) {
+    char line[64];
+    ssize_t copied = 0;
+    unsigned long long value;
+    int cpu, i, n;
+
+    //Counts are read once, at the start of the file
+    if (*off) return 0;
+
+    mutex_lock(&perfmon_counts_lock);
+    for_each_online_cpu(cpu) {
+        for (i = 0; i < nevents; i++) {
+            if (perfmon_event_get_cpu(cpu, events[i], 0, &value) != PMU_RETURN_SUCCESS) continue;
+            n = scnprintf(line, sizeof(line), "%d 0x%02x %llu\n", cpu, events[i], value);
+            if (copied + n > len) goto out;
+            if (copy_to_user(buf + copied, line, n)) {
+                copied = -EFAULT;
+                goto out;
+            }
+            copied += n;
+        }
+    }
+out:
+    mutex_unlock(&perfmon_counts_lock);
+    if (copied > 0) *off += copied;
+    return copied;
+}
+
+static const struct file_operations perfmon_counts_fops = {
+    .owner = THIS_MODULE,
+    .read = perfmon_counts_read,
+};
+
+static struct miscdevice perfmon_counts_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "perfmon_counts",
+    .fops = &perfmon_counts_fops,
+};
+
+static void perfmon_counts_stop(int n) {
+    while (n--) perfmon_event_remove_all(events[n], 0);
+}
+
+static int perfmon_counts_start(void) {
+    int i, ret;
+
+    for (i = 0; i < nevents; i++) {
+        if (perfmon_event_add_all(events[i], 0) < 0) {
+            perfmon_counts_stop(i);
+            return -EINVAL;
+        }
+    }
+
+    ret = misc_register(&perfmon_counts_dev);
+    if (ret) perfmon_counts_stop(nevents);
+    return ret;
+}
+
+//Overflow sampling
+
+static DEFINE_PER_CPU(struct pmu_sample_ring, perfmon_ring);
+static DEFINE_PER_CPU(struct pmu_event_handle, perfmon_sample_handle);
+static DEFINE_MUTEX(perfmon_samples_lock);
+static bool perfmon_irq_percpu;
+
+//The PMU interrupt is taken on the CPU whose counter overflowed
+static irqreturn_t perfmon_irq(int irq, void * dev) {
+    struct pt_regs * regs = get_irq_regs();
+    unsigned long pc = regs ? instruction_pointer(regs) : 0;
+
+    if (!pmu_overflow_handler(this_cpu_ptr(&perfmon_ring), pc)) return IRQ_NONE;
+    return IRQ_HANDLED;
+}
+
+//Drain samples from every CPU's ring into the reader's buffer
+//Each ring has a single consumer, so readers are serialized
+static ssize_t perfmon_samples_read(struct file * file, char __user * buf, size_t len, loff_t * off) {
+    struct pmu_sample sample;
+    ssize_t copied = 0;
+    int cpu;
+
+    mutex_lock(&perfmon_samples_lock);
+    for_each_online_cpu(cpu) {
+        struct pmu_sample_ring * ring = per_cpu_ptr(&perfmon_ring, cpu);
+        while (len - copied >= sizeof(sample)) {
+            if (pmu_sample_ring_pop(ring, &sample) != PMU_RETURN_SUCCESS) break;
+            if (copy_to_user(buf + copied, &sample, sizeof(sample))) {
+                copied = copied ? copied : -EFAULT;
+                goto out;
+            }
+            copied += sizeof(sample);
+        }
+    }
+out:
+    mutex_unlock(&perfmon_samples_lock);
+    return copied;
+}
+
+static const struct file_operations perfmon_samples_fops = {
+    .owner = THIS_MODULE,
+    .read = perfmon_samples_read,
+};
+
+static struct miscdevice perfmon_samples_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "perfmon_samples",
+    .fops = &perfmon_samples_fops,
+};
+
+static void perfmon_sample_start_ipi(void * info) {
+    struct perfmon_call * call = info;
+    struct pmu_event_handle * handle = this_cpu_ptr(&perfmon_sample_handle);
+    int ret = pmu_event_add_handle(sample_event, 0, handle);
+
+    if (ret < 0) {
+        perfmon_call_error(call, ret);
+        return;
+    }
+    pmu_sample_period_set(handle, sample_period);
+    if (perfmon_irq_percpu) enable_percpu_irq(irq, IRQ_TYPE_NONE);
+}
+
+static void perfmon_sample_stop_ipi(void * info) {
+    if (perfmon_irq_percpu) disable_percpu_irq(irq);
+    pmu_sample_period_clear(this_cpu_ptr(&perfmon_sample_handle));
+    pmu_event_remove(sample_event, 0);
+}
+
+static int perfmon_sample_start(void) {
+    struct perfmon_call call = { .event = sample_event, .ret = ATOMIC_INIT(PMU_RETURN_SUCCESS) };
+    int ret;
+
+    //The Cortex-A53 PMU interrupt is usually a per-CPU interrupt
+    perfmon_irq_percpu = irq_is_percpu_devid(irq);
+    if (perfmon_irq_percpu) ret = request_percpu_irq(irq, perfmon_irq, "perfmon", &perfmon_ring);
+    else ret = request_irq(irq, perfmon_irq, IRQF_NOBALANCING | IRQF_NO_THREAD | IRQF_SHARED, "perfmon", &perfmon_samples_dev);
+    if (ret) return ret;
+
+    ret = misc_register(&perfmon_samples_dev);
+    if (ret) goto err_irq;
+
+    on_each_cpu(perfmon_sample_start_ipi, &call, 1);
+    if (atomic_read(&call.ret) < 0) {
+        ret = -EINVAL;
+        goto err_cpu;
+    }
+
+    return 0;
+
+err_cpu:
+    on_each_cpu(perfmon_sample_stop_ipi, NULL, 1);
+    misc_deregister(&perfmon_samples_dev);
+err_irq:
+    if (perfmon_irq_percpu) free_percpu_irq(irq, &perfmon_ring);
+    else free_irq(irq, &perfmon_samples_dev);
+    return ret;
+}
+
+static void perfmon_sample_stop(void) {
+    on_each_cpu(perfmon_sample_stop_ipi, NULL, 1);
+    misc_deregister(&perfmon_samples_dev);
+    if (perfmon_irq_percpu) free_percpu_irq(irq, &perfmon_ring);
+    else free_irq(irq, &perfmon_samples_dev);
+}
+
+//Timer sampling
+
+#define PERFMON_PROFILE_SAMPLES 1024 //Records per CPU ring, a power of two
+
+static DEFINE_PER_CPU(struct pmu_profile_ring *, perfmon_profile_ring);
+static DEFINE_PER_CPU(struct hrtimer, perfmon_profile_timer);
+static DEFINE_MUTEX(perfmon_profile_lock);
+static ktime_t perfmon_profile_period;
+
+//Runs in hard interrupt context, on the CPU the timer was started on
+static enum hrtimer_restart perfmon_profile_tick(struct hrtimer * timer) {
+    struct pt_regs * regs = get_irq_regs();
+    unsigned long pc = regs ? instruction_pointer(regs) : 0;
+
+    pmu_profile_tick(this_cpu_read(perfmon_profile_ring), pc, task_pid_nr(current));
+    hrtimer_forward_now(timer, perfmon_profile_period);
+    return HRTIMER_RESTART;
+}
+
+//Drain samples from every CPU's ring into the reader's buffer
+//Each ring has a single consumer, so readers are serialized
+static ssize_t perfmon_profile_read(struct file * file, char __user * buf, size_t len, loff_t * off) {
+    struct pmu_profile_sample sample;
+    ssize_t copied = 0;
+    int cpu;
+
+    mutex_lock(&perfmon_profile_lock);
+    for_each_online_cpu(cpu) {
+        struct pmu_profile_ring * ring = per_cpu(perfmon_profile_ring, cpu);
+        while (len - copied >= sizeof(sample)) {
+            if (pmu_profile_ring_pop(ring, &sample) != PMU_RETURN_SUCCESS) break;
+            if (copy_to_user(buf + copied, &sample, sizeof(sample))) {
+                copied = copied ? copied : -EFAULT;
+                goto out;
+            }
+            copied += sizeof(sample);
+        }
+    }
+out:
+    mutex_unlock(&perfmon_profile_lock);
+    return copied;
+}
+
+static const struct file_operations perfmon_profile_fops = {
+    .owner = THIS_MODULE,
+    .read = perfmon_profile_read,
+};
+
+static struct miscdevice perfmon_profile_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "perfmon_profile",
+    .fops = &perfmon_profile_fops,
+};
+
+static void perfmon_profile_start_ipi(void * info) {
+    struct hrtimer * timer = this_cpu_ptr(&perfmon_profile_timer);
+
+    pmu_profile_ring_init(this_cpu_read(perfmon_profile_ring), PERFMON_PROFILE_SAMPLES);
+    hrtimer_init(timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+    timer->function = perfmon_profile_tick;
+    hrtimer_start(timer, perfmon_profile_period, HRTIMER_MODE_REL_PINNED);
+}
+
+static void perfmon_profile_free(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        kfree(per_cpu(perfmon_profile_ring, cpu));
+        per_cpu(perfmon_profile_ring, cpu) = NULL;
+    }
+}
+
+static int perfmon_profile_start(void) {
+    int cpu, ret;
+
+    perfmon_profile_period = ns_to_ktime(NSEC_PER_SEC / profile_hz);
+
+    //Rings are allocated up front, the tick only writes to them
+    for_each_possible_cpu(cpu) {
+        struct pmu_profile_ring * ring = kzalloc_node(PMU_PROFILE_RING_BYTES(PERFMON_PROFILE_SAMPLES),
+            GFP_KERNEL, cpu_to_node(cpu));
+        if (!ring) {
+            perfmon_profile_free();
+            return -ENOMEM;
+        }
+        per_cpu(perfmon_profile_ring, cpu) = ring;
+    }
+
+    ret = misc_register(&perfmon_profile_dev);
+    if (ret) {
+        perfmon_profile_free();
+        return ret;
+    }
+
+    on_each_cpu(perfmon_profile_start_ipi, NULL, 1);
+    return 0;
+}
+
+static void perfmon_profile_stop(void) {
+    int cpu;
+
+    for_each_online_cpu(cpu) hrtimer_cancel(per_cpu_ptr(&perfmon_profile_timer, cpu));
+    misc_deregister(&perfmon_profile_dev);
+    perfmon_profile_free();
+}
+
+//Per-thread counters
+
+#ifdef CONFIG_PREEMPT_NOTIFIERS
+
+//Lifetime of a context once its file is closed by a task other than the owner
+#define PERFMON_THREAD_LIVE 0
+#define PERFMON_THREAD_RELEASED 1 //Owner unlinks it at its next switch out
+#define PERFMON_THREAD_UNLINKED 2 //Off the owner's notifier list, waiting to be freed
+
+struct perfmon_thread {
+    struct preempt_notifier notifier;
+    struct task_struct * task; //Owner, referenced until the context is freed
+    struct pmu_context ctx;
+    atomic_t state;
+    struct llist_node reap;
+};
+
+//Contexts unlinked by the scheduler are freed from a work item:
+//sched_out can't wake a worker directly, so an irq_work queues it
+static LLIST_HEAD(perfmon_thread_reaped);
+
+static void perfmon_thread_free(struct perfmon_thread * thread) {
+    preempt_notifier_dec();
+    put_task_struct(thread->task);
+    kfree(thread);
+}
+
+static void perfmon_thread_reap(struct work_struct * work) {
+    struct perfmon_thread * thread, * next;
+
+    llist_for_each_entry_safe(thread, next, llist_del_all(&perfmon_thread_reaped), reap) {
+        perfmon_thread_free(thread);
+        module_put(THIS_MODULE);
+    }
+}
+
+static DECLARE_WORK(perfmon_thread_reap_work, perfmon_thread_reap);
+
+static void perfmon_thread_reap_queue(struct irq_work * work) {
+    schedule_work(&perfmon_thread_reap_work);
+}
+
+static struct irq_work perfmon_thread_reap_irq = IRQ_WORK_INIT(perfmon_thread_reap_queue);
+
+//Whether the owner has switched out for the last time, so its notifiers never run again
+static bool perfmon_thread_owner_dead(struct task_struct * task) {
+    if (READ_ONCE(task->__state) != TASK_DEAD) return false;
+#ifdef CONFIG_SMP
+    smp_cond_load_acquire(&task->on_cpu, !VAL);
+#endif
+    return true;
+}
+
+static void perfmon_thread_sched_in(struct preempt_notifier * notifier, int cpu) {
+    struct perfmon_thread * thread = container_of(notifier, struct perfmon_thread, notifier);
+    pmu_context_restore(&thread->ctx);
+}
+
+static void perfmon_thread_sched_out(struct preempt_notifier * notifier, struct task_struct * next) {
+    struct perfmon_thread * thread = container_of(notifier, struct perfmon_thread, notifier);
+    pmu_context_save(&thread->ctx);
+
+    //Released by another task: only the owner's switches walk its list, so unlink here.
+    //The walk goes on to this node's next, so it keeps it and is freed after the switch
+    if (atomic_read(&thread->state) == PERFMON_THREAD_RELEASED &&
+        atomic_cmpxchg(&thread->state, PERFMON_THREAD_RELEASED, PERFMON_THREAD_UNLINKED) == PERFMON_THREAD_RELEASED) {
+        __hlist_del(&notifier->link);
+        llist_add(&thread->reap, &perfmon_thread_reaped);
+        irq_work_queue(&perfmon_thread_reap_irq);
+    }
+}
+
+static struct preempt_ops perfmon_thread_ops = {
+    .sched_in = perfmon_thread_sched_in,
+    .sched_out = perfmon_thread_sched_out,
+};
+
+//Virtualize the counters enabled on this CPU for the calling thread
+static int perfmon_thread_open(struct inode * inode, struct file * file) {
+    struct perfmon_thread * thread;
+
+    //The notifiers run on the owner's switches, so it must be a user thread that will switch again
+    if (current->flags & (PF_KTHREAD | PF_EXITING)) return -EPERM;
+
+    thread = kzalloc(sizeof(*thread), GFP_KERNEL);
+    if (!thread) return -ENOMEM;
+
+    get_task_struct(current);
+    thread->task = current;
+    atomic_set(&thread->state, PERFMON_THREAD_LIVE);
+    preempt_notifier_init(&thread->notifier, &perfmon_thread_ops);
+    preempt_notifier_inc();
+
+    //No switch may land between taking the counters and registering
+    preempt_disable();
+    pmu_context_init(&thread->ctx);
+    pmu_context_restore(&thread->ctx);
+    preempt_notifier_register(&thread->notifier);
+    preempt_enable();
+
+    file->private_data = thread;
+    return 0;
+}
+
+static int perfmon_thread_release(struct inode * inode, struct file * file) {
+    struct perfmon_thread * thread = file->private_data;
+
+    if (thread->task == current) {
+        preempt_disable();
+        preempt_notifier_unregister(&thread->notifier);
+        pmu_context_save(&thread->ctx);
+        preempt_enable();
+
+        perfmon_thread_free(thread);
+        return 0;
+    }
+
+    //The last reference went with another task (a fork, a shared file table, or the owner exited).
+    //The owner's list may only change under the owner, so hand the context to its next switch out,
+    //keeping the module until then
+    __module_get(THIS_MODULE);
+    atomic_set(&thread->state, PERFMON_THREAD_RELEASED);
+    smp_mb();
+
+    //An owner past its last switch won't unlink it, and nothing walks its list any more
+    if (perfmon_thread_owner_dead(thread->task) &&
+        atomic_cmpxchg(&thread->state, PERFMON_THREAD_RELEASED, PERFMON_THREAD_UNLINKED) == PERFMON_THREAD_RELEASED) {
+        preempt_notifier_unregister(&thread->notifier);
+        perfmon_thread_free(thread);
+        module_put(THIS_MODULE);
+    }
+
+    return 0;
+}
+
+//Current virtual counters of the calling thread
+static ssize_t perfmon_thread_read(struct file * file, char __user * buf, size_t len, loff_t * off) {
+    struct perfmon_thread * thread = file->private_data;
+    struct pmu_context ctx;
+
+    if (thread->task != current) return -EPERM;
+    if (len < sizeof(ctx)) return -EINVAL;
+
+    //Saving stops the counters, so restore straight away
+    preempt_disable();
+    pmu_context_save(&thread->ctx);
+    ctx = thread->ctx;
+    pmu_context_restore(&thread->ctx);
+    preempt_enable();
+
+    if (copy_to_user(buf, &ctx, sizeof(ctx))) return -EFAULT;
+    return sizeof(ctx);
+}
+
+static const struct file_operations perfmon_thread_fops = {
+    .owner = THIS_MODULE,
+    .open = perfmon_thread_open,
+    .release = perfmon_thread_release,
+    .read = perfmon_thread_read,
+};
+
+static struct miscdevice perfmon_thread_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "perfmon_thread",
+    .fops = &perfmon_thread_fops,
+};
+
+static int perfmon_thread_start(void) {
+    return misc_register(&perfmon_thread_dev);
+}
+
+static void perfmon_thread_stop(void) {
+    misc_deregister(&perfmon_thread_dev);
+
+    //Reaping drops the module reference last, so wait for it to return
+    irq_work_sync(&perfmon_thread_reap_irq);
+    flush_work(&perfmon_thread_reap_work);
+}
+
+#else
+
+static int perfmon_thread_start(void) {
+    return 0;
+}
+
+static void perfmon_thread_stop(void) {
+}
+
+#endif //CONFIG_PREEMPT_NOTIFIERS
+
+//Module
+
+static int __init perfmon_init(void) {
+    int ret;
+
+    on_each_cpu(perfmon_load_ipi, NULL, 1);
+
+    ret = perfmon_counts_start();
+    if (ret) goto err_load;
+
+    ret = perfmon_thread_start();
+    if (ret) goto err_counts;
+
+    if (irq >= 0) {
+        ret = perfmon_sample_start();
+        if (ret) goto err_thread;
+    }
+
+    if (profile_hz) {
+        ret = perfmon_profile_start();
+        if (ret) goto err_sample;
+    }
+
+    return 0;
+
+err_sample:
+    if (irq >= 0) perfmon_sample_stop();
+err_thread:
+    perfmon_thread_stop();
+err_counts:
+    misc_deregister(&perfmon_counts_dev);
+    perfmon_counts_stop(nevents);
+err_load:
+    on_each_cpu(perfmon_unload_ipi, NULL, 1);
+    return ret;
+}
+
+static void __exit perfmon_exit(void) {
+    if (profile_hz) perfmon_profile_stop();
+    if (irq >= 0) perfmon_sample_stop();
+    perfmon_thread_stop();
+    misc_deregister(&perfmon_counts_dev);
+    perfmon_counts_stop(nevents);
+    on_each_cpu(perfmon_unload_ipi, NULL, 1);
+}
+
+module_init(perfmon_init);
+module_exit(perfmon_exit);
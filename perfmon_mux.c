@@ -0,0 +1,326 @@
+#include "perfmon.h"
+
+//Event multiplexing
+//Groups are scheduled round-robin: each rotation programs as many whole groups
+//as fit in the event counters, starting after the last group that ran
+//State is global, for the one CPU the multiplexer runs on. Start, rotate and stop
+//bump mux_seq around their changes, so a read they interrupt retries
+
+//Internal state
+
+    struct pmu_mux_event {
+        unsigned event;
+        unsigned flags;
+        struct pmu_event_handle handle; //Valid while scheduled
+        unsigned long long count; //Events counted in completed intervals
+        unsigned long long enabled; //Cycles in completed intervals
+        unsigned long long running; //Cycles scheduled in completed intervals
+    };
+
+    struct pmu_mux_group {
+        unsigned first; //Index of first event in mux_events
+        unsigned n; //Number of events
+        unsigned width; //Number of counters needed, chained events take two
+        unsigned added; //Bit per event (from first) programmed by mux_group_program
+    };
+
+    static struct pmu_mux_event mux_events[PMU_MUX_MAX_EVENTS];
+    static struct pmu_mux_group mux_groups[PMU_MUX_MAX_GROUPS];
+    static unsigned mux_nevents;
+    static unsigned mux_ngroups;
+
+    static unsigned mux_started;
+    static unsigned mux_next; //Next group to schedule
+    static unsigned mux_sched_first; //First group currently scheduled
+    static unsigned mux_sched_n; //Number of groups currently scheduled
+    static unsigned long long mux_last; //Cycle count at start of current interval
+    static unsigned mux_seq; //Odd while start, rotate or stop are changing the above
+
+
+//Helper Functions
+
+    //Cycles since the current interval started
+    //The 32-bit cycle counter wraps, so take the difference modulo 2^32
+    static unsigned long long mux_elapsed(unsigned long long now) {
+        if (pmcr_isset(PMCR_CYCLE_COUNTER_64_BITS)) return now - mux_last;
+        return (unsigned) (now - mux_last);
+    }
+
+    //Scale raw count by enabled/running without overflowing 64 bits
+    static unsigned long long mux_scale(unsigned long long raw, unsigned long long enabled, unsigned long long running) {
+
+        if (!running) return 0;
+        if (running == enabled) return raw;
+
+        //Keep the remainder product below 2^64
+        while (enabled >> 32) {
+            enabled >>= 1;
+            running >>= 1;
+        }
+        if (!running) return 0;
+
+        unsigned long long q = pmu_div64(raw, running);
+        unsigned long long r = raw - q * running;
+        return q * enabled + pmu_div64(r * enabled, running);
+
+    }
+
+    //Is group g currently scheduled?
+    static int mux_group_scheduled(unsigned g) {
+        if (!mux_started) return 0;
+        unsigned offset = (g + mux_ngroups - mux_sched_first) % mux_ngroups;
+        return offset < mux_sched_n;
+    }
+
+    //Writers hold mux_seq odd around their changes
+    static void mux_write_begin(void) {
+        __atomic_add_fetch(&mux_seq, 1, __ATOMIC_SEQ_CST);
+    }
+
+    static void mux_write_end(void) {
+        __atomic_add_fetch(&mux_seq, 1, __ATOMIC_SEQ_CST);
+    }
+
+    //Remove the events a group programmed from the counters
+    //Events it didn't add (not reached, or already monitored by someone else) are left alone
+    static void mux_group_unprogram(unsigned g) {
+        struct pmu_mux_group * group = &mux_groups[g];
+        for (unsigned added = group->added; added; added &= added - 1) {
+            struct pmu_mux_event * e = &mux_events[group->first + __builtin_ctz(added)];
+            pmu_event_remove(e->event, e->flags);
+        }
+        group->added = 0;
+    }
+
+    //Program all of a group's events, or none of them
+    //Chained events go first so they get aligned pairs before single counters fragment them
+    static int mux_group_program(unsigned g) {
+
+        struct pmu_mux_group * group = &mux_groups[g];
+        int ret = PMU_RETURN_SUCCESS;
+
+        group->added = 0;
+        for (unsigned pass = 0; pass < 2 && ret == PMU_RETURN_SUCCESS; pass++) {
+            for (unsigned i = group->first; i < group->first + group->n; i++) {
+                struct pmu_mux_event * e = &mux_events[i];
+                unsigned chained = e->flags & PMU_EVENTFLAG_64BIT ? 1 : 0;
+                if (chained != !pass) continue;
+                ret = pmu_event_add_handle(e->event, e->flags, &e->handle);
+                if (ret < 0) break;
+                group->added |= 1u << (i - group->first);
+            }
+        }
+
+        if (ret < 0) mux_group_unprogram(g);
+        return ret;
+
+    }
+
+    //Schedule whole groups starting at mux_next until one doesn't fit
+    //Return the error programming the first group if none could be scheduled
+    static int mux_schedule(void) {
+
+        int ret = PMU_RETURN_SUCCESS;
+
+        mux_sched_first = mux_next;
+        mux_sched_n = 0;
+
+        for (unsigned i = 0; i < mux_ngroups; i++) {
+            ret = mux_group_program((mux_next + i) % mux_ngroups);
+            if (ret < 0) break;
+            mux_sched_n++;
+        }
+
+        mux_next = (mux_sched_first + mux_sched_n) % mux_ngroups;
+
+        return mux_sched_n ? PMU_RETURN_SUCCESS : ret;
+
+    }
+
+    //Fold the current interval into every event's totals and unschedule
+    static void mux_unschedule(unsigned long long elapsed) {
+
+        for (unsigned i = 0; i < mux_nevents; i++) {
+            mux_events[i].enabled += elapsed;
+        }
+
+        for (unsigned s = 0; s < mux_sched_n; s++) {
+            unsigned g = (mux_sched_first + s) % mux_ngroups;
+            struct pmu_mux_group * group = &mux_groups[g];
+            for (unsigned i = group->first; i < group->first + group->n; i++) {
+                mux_events[i].count += pmu_handle_read(&mux_events[i].handle);
+                mux_events[i].running += elapsed;
+            }
+            mux_group_unprogram(g);
+        }
+
+        mux_sched_n = 0;
+
+    }
+
+
+//Public Functions
+
+    //Forget all groups
+    void pmu_mux_init(void) {
+        if (mux_started) pmu_mux_stop();
+        mux_nevents = 0;
+        mux_ngroups = 0;
+        mux_next = 0;
+    }
+
+    //Add a group of n events that must always be counted together
+    //flags may be null, otherwise gives flags for each event
+    //On success, return group index
+    int pmu_mux_group_add(const unsigned * events, const unsigned * flags, unsigned n) {
+
+        if (!events) return PMU_RETURN_BAD_PTR;
+        //Groups are fixed while the multiplexer is running
+        if (mux_started) return PMU_RETURN_MUX_FULL;
+        if (mux_ngroups >= PMU_MUX_MAX_GROUPS) return PMU_RETURN_MUX_FULL;
+        if (mux_nevents + n > PMU_MUX_MAX_EVENTS) return PMU_RETURN_MUX_FULL;
+
+        unsigned width = 0;
+        for (unsigned i = 0; i < n; i++) {
+
+            if (!pmu_event_available(events[i])) return PMU_RETURN_EVENT_NO_AVAIL;
+
+            //Events are looked up by code, so each may only appear once
+            for (unsigned j = 0; j < mux_nevents; j++) {
+                if (mux_events[j].event == events[i]) return PMU_RETURN_EVENT_ALREADY;
+            }
+            for (unsigned j = 0; j < i; j++) {
+                if (events[j] == events[i]) return PMU_RETURN_EVENT_ALREADY;
+            }
+
+            width += flags && (flags[i] & PMU_EVENTFLAG_64BIT) ? 2 : 1;
+        }
+
+        //A group that can never be scheduled whole is an error now, not a silent zero later
+        if (width > pmu_nevents()) return PMU_RETURN_GROUP_TOO_LARGE;
+
+        struct pmu_mux_group * group = &mux_groups[mux_ngroups];
+        group->first = mux_nevents;
+        group->n = n;
+        group->width = width;
+
+        for (unsigned i = 0; i < n; i++) {
+            struct pmu_mux_event * e = &mux_events[mux_nevents++];
+            e->event = events[i];
+            e->flags = flags ? flags[i] : 0;
+            e->count = 0;
+            e->enabled = 0;
+            e->running = 0;
+        }
+
+        return mux_ngroups++;
+
+    }
+
+    //Start counting, scheduling the first groups
+    //Fails, leaving the multiplexer stopped, if not even the first group fits
+    int pmu_mux_start(void) {
+
+        if (mux_started) return PMU_RETURN_SUCCESS;
+        if (!mux_ngroups) return PMU_RETURN_EVENT_NO_WATCH;
+
+        pmccntr_enable();
+        pmu_enable();
+
+        mux_write_begin();
+        mux_next = 0;
+        int ret = mux_schedule();
+        mux_started = ret == PMU_RETURN_SUCCESS;
+        mux_last = pmccntr_get();
+        mux_write_end();
+
+        return ret;
+
+    }
+
+    //Rotate the next groups onto the counters
+    //Call from a periodic tick
+    //If no group fits, return its error: the interval still counts as enabled time for every event,
+    //and the next rotation tries again
+    int pmu_mux_rotate(void) {
+
+        if (!mux_started) return PMU_RETURN_EVENT_NO_WATCH;
+
+        //A signal can land between the interrupted code's PMSELR write and its access
+        unsigned select = pmu_select_save();
+
+        mux_write_begin();
+        mux_unschedule(mux_elapsed(pmccntr_get()));
+        int ret = mux_schedule();
+        mux_last = pmccntr_get();
+        mux_write_end();
+
+        pmu_select_restore(select);
+
+        return ret;
+
+    }
+
+    //Stop counting, keeping totals for pmu_mux_read
+    int pmu_mux_stop(void) {
+
+        if (!mux_started) return PMU_RETURN_SUCCESS;
+
+        mux_write_begin();
+        mux_unschedule(mux_elapsed(pmccntr_get()));
+        mux_started = 0;
+        mux_write_end();
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    //Get scaled count for a multiplexed event
+    //Includes the current interval if the event is scheduled
+    //Retries if a rotation lands during the read, giving up with PMU_RETURN_CONFIG_BUSY
+    //if the read interrupted one (e.g. from a signal handler)
+    int pmu_mux_read(unsigned event, struct pmu_mux_count * count) {
+
+        if (!count) return PMU_RETURN_BAD_PTR;
+
+        for (unsigned g = 0; g < mux_ngroups; g++) {
+
+            struct pmu_mux_group * group = &mux_groups[g];
+
+            for (unsigned i = group->first; i < group->first + group->n; i++) {
+
+                struct pmu_mux_event * e = &mux_events[i];
+                if (e->event != event) continue;
+
+                for (unsigned attempt = 0; attempt < PMU_CONFIG_RETRIES; attempt++) {
+
+                    unsigned seq = __atomic_load_n(&mux_seq, __ATOMIC_ACQUIRE);
+                    if (seq & 1) continue;
+
+                    count->raw = e->count;
+                    count->enabled = e->enabled;
+                    count->running = e->running;
+
+                    if (mux_started) {
+                        unsigned long long elapsed = mux_elapsed(pmccntr_get());
+                        count->enabled += elapsed;
+                        if (mux_group_scheduled(g)) {
+                            count->raw += pmu_handle_read(&e->handle);
+                            count->running += elapsed;
+                        }
+                    }
+
+                    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                    if (__atomic_load_n(&mux_seq, __ATOMIC_RELAXED) != seq) continue;
+
+                    count->value = mux_scale(count->raw, count->enabled, count->running);
+                    return PMU_RETURN_SUCCESS;
+                }
+
+                return PMU_RETURN_CONFIG_BUSY;
+            }
+        }
+
+        return PMU_RETURN_EVENT_NO_WATCH;
+
+    }
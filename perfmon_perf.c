@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "perfmon.h"
+
+//perf_event_open backend, see perfmon_perf.h
+
+//Internal state
+
+    struct pmu_perf_counter pmu_perf_counters[NEVENTS_ARCH_MAX + 1] = {
+        [0 ... NEVENTS_ARCH_MAX] = { .fd = -1 }
+    };
+
+    static unsigned perf_pmcr; //Writable PMCR bits
+    static unsigned perf_pmcnten;
+    static unsigned perf_pminten;
+    static unsigned perf_pmuserenr;
+    static unsigned perf_pmceid[2]; //Events perf accepts, probed on first use
+    static unsigned perf_pmceid_probed;
+
+#if !defined(__arm__) && !defined(__aarch64__)
+
+    #define PERF_CACHE( ID, RESULT ) ( (ID) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((RESULT) << 16) )
+
+    //Architectural events with a generic perf equivalent
+    static const struct {
+        unsigned event;
+        unsigned type;
+        unsigned long long config;
+    } perf_generic_events[] = {
+        { 0x01 /*L1I_CACHE_REFILL*/, PERF_TYPE_HW_CACHE, PERF_CACHE(PERF_COUNT_HW_CACHE_L1I, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+        { 0x02 /*L1I_TLB_REFILL*/, PERF_TYPE_HW_CACHE, PERF_CACHE(PERF_COUNT_HW_CACHE_ITLB, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+        { 0x03 /*L1D_CACHE_REFILL*/, PERF_TYPE_HW_CACHE, PERF_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+        { 0x04 /*L1D_CACHE*/, PERF_TYPE_HW_CACHE, PERF_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_ACCESS) },
+        { 0x05 /*L1D_TLB_REFILL*/, PERF_TYPE_HW_CACHE, PERF_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+        { 0x08 /*INST_RETIRED*/, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { 0x10 /*BR_MIS_PRED*/, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { 0x11 /*CPU_CYCLES*/, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { 0x12 /*BR_PRED*/, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+        { 0x16 /*L2D_CACHE*/, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+        { 0x17 /*L2D_CACHE_REFILL*/, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { 0x1D /*BUS_CYCLES*/, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES },
+    };
+
+#endif
+
+
+//Helper Functions
+
+    //Translate an event type register value into a perf event
+    //Return 0 if perf has no equivalent
+    static int perf_attr_set(struct perf_event_attr * attr, unsigned type) {
+
+        unsigned event = type & PMEVTYPER_EVENT;
+
+        memset(attr, 0, sizeof(*attr));
+        attr->size = sizeof(*attr);
+        attr->disabled = 1;
+        attr->exclude_kernel = type & PMEVTYPER_P ? 1 : 0;
+        attr->exclude_user = type & PMEVTYPER_U ? 1 : 0;
+        attr->exclude_hv = type & PMEVTYPER_NSH ? 0 : 1;
+
+#if defined(__arm__) || defined(__aarch64__)
+        attr->type = PERF_TYPE_RAW;
+        attr->config = event;
+#if defined(__aarch64__)
+        attr->config1 = 1 << 1; //Ask for userspace counter access (rdpmc format bit)
+#endif
+        return 1;
+#else
+        for (unsigned i = 0; i < sizeof(perf_generic_events) / sizeof(perf_generic_events[0]); i++) {
+            if (perf_generic_events[i].event == event) {
+                attr->type = perf_generic_events[i].type;
+                attr->config = perf_generic_events[i].config;
+                return 1;
+            }
+        }
+        return 0;
+#endif
+
+    }
+
+    //Open a perf event for the calling thread
+    //Falls back to user-only counting if the kernel won't count itself for us (perf_event_paranoid)
+    static int perf_open(struct perf_event_attr * attr) {
+        int fd = syscall(__NR_perf_event_open, attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0 && (errno == EACCES || errno == EPERM) && !attr->exclude_kernel) {
+            attr->exclude_kernel = 1;
+            attr->exclude_hv = 1;
+            fd = syscall(__NR_perf_event_open, attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        }
+        return fd;
+    }
+
+    //Close counter c's perf event, keeping its value in the bias
+    static void perf_close(struct pmu_perf_counter * c) {
+        if (c->fd < 0) return;
+        c->bias = perf_value(c);
+        if (c->page) munmap(c->page, sysconf(_SC_PAGESIZE));
+        close(c->fd);
+        c->fd = -1;
+        c->page = 0;
+        c->enabled = 0;
+    }
+
+    //Open a perf event for counter c, carrying its value over
+    static void perf_attach(struct pmu_perf_counter * c, struct perf_event_attr * attr) {
+
+        perf_close(c);
+
+        c->fd = perf_open(attr);
+        if (c->fd < 0) return;
+
+        //Without the page every read goes through read(2)
+        void * page = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, c->fd, 0);
+        c->page = page == MAP_FAILED ? 0 : page;
+
+    }
+
+    //Counter behind PMCNTEN bit n, null if there is none
+    static struct pmu_perf_counter * perf_counter(unsigned n) {
+        if (n == 31) return &pmu_perf_counters[PMU_PERF_CYCLE_CTR];
+        if (n < NEVENTS_ARCH_MAX) return &pmu_perf_counters[n];
+        return 0;
+    }
+
+    //Start or stop counter n's perf event to match PMCR.E and PMCNTEN
+    static void perf_apply(unsigned n) {
+        struct pmu_perf_counter * c = perf_counter(n);
+        if (!c || c->fd < 0) return;
+        unsigned enabled = (perf_pmcr & PMCR_ENABLE_COUNTERS) && (perf_pmcnten >> n) & 1;
+        if (enabled == c->enabled) return;
+        ioctl(c->fd, enabled ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+        c->enabled = enabled;
+    }
+
+    static void perf_apply_mask(unsigned mask) {
+        while (mask) {
+            perf_apply(__builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    //Set counter c's value, keeping its overflow flag
+    static void perf_value_set(struct pmu_perf_counter * c, unsigned long long value) {
+        unsigned long long old = perf_value(c);
+        unsigned overflowed = (unsigned) (old >> 32) != c->epoch;
+        c->bias += value - old;
+        c->epoch = (unsigned) (value >> 32) - overflowed;
+    }
+
+    //Open the cycle counter on first use
+    static void perf_cycle_open(void) {
+        struct pmu_perf_counter * c = &pmu_perf_counters[PMU_PERF_CYCLE_CTR];
+        if (c->fd >= 0) return;
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+#if defined(__aarch64__)
+        attr.config1 = 1 << 1;
+#endif
+        perf_attach(c, &attr);
+    }
+
+    //Find which of the 64 common events perf accepts
+    static void perf_pmceid_probe(void) {
+
+        struct perf_event_attr attr;
+
+        for (unsigned event = 0; event < 64; event++) {
+
+            //Emulated, not opened
+            int available = event == EVT_CHAIN;
+
+            if (!available && perf_attr_set(&attr, event)) {
+                int fd = perf_open(&attr);
+                if (fd >= 0) {
+                    available = 1;
+                    close(fd);
+                }
+            }
+
+            if (available) perf_pmceid[event >> 5] |= 1u << (event & 31);
+        }
+
+        perf_pmceid_probed = 1;
+
+    }
+
+
+//Public Functions
+
+    int perf_probe(void) {
+        struct pmu_perf_counter * c = &pmu_perf_counters[PMU_PERF_CYCLE_CTR];
+        if (c->fd >= 0) return 1;
+        perf_cycle_open();
+        return c->fd >= 0;
+    }
+
+    unsigned long long perf_count_syscall(const struct pmu_perf_counter * c) {
+        unsigned long long count = 0;
+        if (read(c->fd, &count, sizeof(count)) != sizeof(count)) return 0;
+        return count;
+    }
+
+    unsigned perf_pmcr_read(void) {
+        return perf_pmcr | (NEVENTS_ARCH_MAX << PMCR_NEVENTS_SHIFT);
+    }
+
+    void perf_pmcr_write(unsigned x) {
+
+        //Reset bits act on write and read as zero
+        if (x & PMCR_EVENT_COUNTER_RESET) {
+            for (unsigned n = 0; n < NEVENTS_ARCH_MAX; n++) {
+                if (!pmu_perf_counters[n].high) perf_value_set(&pmu_perf_counters[n], 0);
+            }
+        }
+        if (x & PMCR_CYCLE_COUNTER_RESET) perf_value_set(&pmu_perf_counters[PMU_PERF_CYCLE_CTR], 0);
+
+        unsigned changed = (perf_pmcr ^ x) & PMCR_ENABLE_COUNTERS;
+        perf_pmcr = x & PMCR_WRITABLE & ~(PMCR_EVENT_COUNTER_RESET | PMCR_CYCLE_COUNTER_RESET);
+        if (changed) perf_apply_mask(perf_pmcnten);
+
+    }
+
+    unsigned perf_pmcnten_read(void) {
+        return perf_pmcnten;
+    }
+
+    void perf_pmcntenset_write(unsigned x) {
+        if (x & PMCNTEN_CYCLE_CTR) perf_cycle_open();
+        unsigned changed = x & ~perf_pmcnten;
+        perf_pmcnten |= x;
+        perf_apply_mask(changed);
+    }
+
+    void perf_pmcntenclr_write(unsigned x) {
+        unsigned changed = x & perf_pmcnten;
+        perf_pmcnten &= ~x;
+        perf_apply_mask(changed);
+    }
+
+    //Writing a new event opens a perf event for it, keeping the count as the hardware does
+    void perf_pmevtyper_write(unsigned n, unsigned type) {
+
+        if (n >= NEVENTS_ARCH_MAX) return;
+        struct pmu_perf_counter * c = &pmu_perf_counters[n];
+        if (type == c->type && (c->fd >= 0 || c->high)) return;
+
+        //Split a chained pair, the high word stays with this counter
+        if (c->high) c->bias = perf_value(c - 1) >> 32;
+        c->type = type;
+        c->high = 0;
+
+        //The chain counter becomes the high word of the counter below
+        if ((type & PMEVTYPER_EVENT) == EVT_CHAIN) {
+            perf_close(c);
+            if (n % 2 == 0) return;
+            struct pmu_perf_counter * low = c - 1;
+            perf_value_set(low, (unsigned) perf_value(low) | ((unsigned long long) (unsigned) c->bias << 32));
+            c->high = 1;
+            return;
+        }
+
+        //The counter below stops being chained, taking only its low word
+        if (n + 1 < NEVENTS_ARCH_MAX && c[1].high) {
+            c[1].high = 0;
+            c[1].bias = perf_value(c) >> 32;
+            c[1].epoch = 0;
+            perf_value_set(c, (unsigned) perf_value(c));
+        }
+
+        struct perf_event_attr attr;
+        if (perf_attr_set(&attr, type)) perf_attach(c, &attr);
+        else perf_close(c);
+        perf_apply(n);
+
+    }
+
+    void perf_pmevcntr_write(unsigned n, unsigned count) {
+        if (n >= NEVENTS_ARCH_MAX) return;
+        struct pmu_perf_counter * c = &pmu_perf_counters[n];
+        if (c->high) {
+            unsigned long long low = (unsigned) perf_value(c - 1);
+            perf_value_set(c - 1, low | ((unsigned long long) count << 32));
+        }
+        else if (n + 1 < NEVENTS_ARCH_MAX && c[1].high) {
+            unsigned long long high = perf_value(c) >> 32;
+            perf_value_set(c, (high << 32) | count);
+        }
+        else perf_value_set(c, count);
+    }
+
+    void perf_pmccntr_write(unsigned long long count) {
+        perf_cycle_open();
+        perf_value_set(&pmu_perf_counters[PMU_PERF_CYCLE_CTR], count);
+    }
+
+    //A counter has overflowed if its count has crossed a multiple of 2^32 since its flag was cleared
+    //The cycle counter overflows at 2^64 when PMCR.LC is set, which doesn't happen
+    unsigned perf_pmovsr_read(void) {
+
+        unsigned ovs = 0;
+
+        for (unsigned n = 0; n < NEVENTS_ARCH_MAX; n++) {
+            const struct pmu_perf_counter * c = &pmu_perf_counters[n];
+            if (c->fd < 0 || c->high) continue;
+            if ((unsigned) (perf_value(c) >> 32) != c->epoch) ovs |= 1 << n;
+        }
+
+        const struct pmu_perf_counter * cycles = &pmu_perf_counters[PMU_PERF_CYCLE_CTR];
+        if (cycles->fd >= 0 && !(perf_pmcr & PMCR_CYCLE_COUNTER_64_BITS)
+            && (unsigned) (perf_value(cycles) >> 32) != cycles->epoch) {
+            ovs |= PMCNTEN_CYCLE_CTR;
+        }
+
+        return ovs;
+
+    }
+
+    void perf_pmovsr_write(unsigned x) {
+        while (x) {
+            struct pmu_perf_counter * c = perf_counter(__builtin_ctz(x));
+            if (c) c->epoch = perf_value(c) >> 32;
+            x &= x - 1;
+        }
+    }
+
+    void perf_pmovsset_write(unsigned x) {
+        while (x) {
+            struct pmu_perf_counter * c = perf_counter(__builtin_ctz(x));
+            if (c) c->epoch = (unsigned) (perf_value(c) >> 32) - 1;
+            x &= x - 1;
+        }
+    }
+
+    unsigned perf_pminten_read(void) {
+        return perf_pminten;
+    }
+
+    void perf_pmintenset_write(unsigned x) {
+        perf_pminten |= x;
+    }
+
+    void perf_pmintenclr_write(unsigned x) {
+        perf_pminten &= ~x;
+    }
+
+    unsigned perf_pmuserenr_read(void) {
+        return perf_pmuserenr;
+    }
+
+    void perf_pmuserenr_write(unsigned x) {
+        perf_pmuserenr = x;
+    }
+
+    //PMCEID0 for n = 0, PMCEID1 for n = 1
+    unsigned perf_pmceid_read(unsigned n) {
+        if (!perf_pmceid_probed) perf_pmceid_probe();
+        return perf_pmceid[n & 1];
+    }
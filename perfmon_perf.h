@@ -0,0 +1,180 @@
+#ifndef __PERFMON_PERF_H
+#define __PERFMON_PERF_H
+
+/******************************************************************************
+*
+* perfmon_perf.h
+*
+* perf_event_open backend for perfmon.h.
+*
+* Selected with -DPMU_BACKEND_PERF, or at runtime with PMU_BACKEND_RUNTIME,
+* the register functions in perfmon.h are emulated on perf events opened
+* for the calling thread instead of accessing CP15, so the library works
+* where the kernel's PMU driver owns the hardware, and on other Linux
+* hosts (e.g. x86).
+*
+* Emulation:
+*	Writing an event type register opens a perf event for that counter,
+*	with the PMEVTYPER P/U/NSH filter bits mapped to perf's exclude bits.
+*	On ARM the event number is passed to the PMU driver as a raw event,
+*	elsewhere the common architectural events map to perf's generic ones.
+*	EVT_CHAIN opens nothing: perf counts are 64 bits, so the chain counter
+*	reads as the high word of the counter below it.
+*	PMCR.E and PMCNTEN enable and disable the events. Counter writes and
+*	PMCR resets are emulated with an offset added to the perf count.
+*	Overflow flags are set when bit 32 and up of the count change.
+*	PMCEID reports the events perf accepts. PMINTEN and PMUSERENR are
+*	plain variables: no overflow interrupts are raised.
+*
+* Reads:
+*	Counters are read from the perf_event_mmap_page with its seqlock,
+*	adding the hardware counter read directly (rdpmc on x86, PMU registers
+*	on AArch64) to the kernel's offset. read(2) is only used when the kernel
+*	doesn't allow direct access (cap_user_rdpmc clear, always the case on
+*	32-bit ARM) or the event isn't on a hardware counter at that moment.
+*	AArch64 kernels only allow it with the perf_user_access sysctl set.
+*
+* Events count the thread that programs them, on any CPU, and must be read
+* from that thread. There is a single PMU context: pmu_cpu() is always 0.
+*
+******************************************************************************/
+
+#include <linux/perf_event.h>
+
+//Counter of the cycle counter in pmu_perf_counters
+#define PMU_PERF_CYCLE_CTR NEVENTS_ARCH_MAX
+
+	//Emulated counter
+	struct pmu_perf_counter {
+		int fd; //perf event, -1 if none is open
+		struct perf_event_mmap_page * page; //Self-monitoring page, null if it couldn't be mapped
+		unsigned type; //Value of the event type register
+		unsigned high; //Nonzero if this counter is the chained high word of the one below
+		unsigned enabled; //Nonzero while the perf event is enabled
+		unsigned epoch; //Bits 63:32 of the count when the overflow flag was last clear
+		unsigned long long bias; //Added to the perf count to emulate counter writes
+	};
+
+	//Event counters, then the cycle counter
+	extern struct pmu_perf_counter pmu_perf_counters[NEVENTS_ARCH_MAX + 1];
+
+	//Count of a perf event through read(2)
+	unsigned long long perf_count_syscall(const struct pmu_perf_counter * c);
+
+	//Read hardware counter idx, as given by perf_event_mmap_page.index - 1
+	static inline unsigned long long perf_rdpmc(unsigned idx) {
+#if defined(__x86_64__) || defined(__i386__)
+		unsigned low, high;
+		asm volatile ("rdpmc\t\n" : "=a" (low), "=d" (high) : "c" (idx));
+		return ( (unsigned long long) high << 32 ) | low;
+#elif defined(__aarch64__)
+		unsigned long long x;
+		if (idx == 31) {
+			asm volatile ("mrs %0, pmccntr_el0\t\n" : "=r" (x));
+		}
+		else {
+			asm volatile ("msr pmselr_el0, %1\t\n"
+						  "isb\t\n"
+						  "mrs %0, pmxevcntr_el0\t\n" : "=r" (x) : "r" ((unsigned long long) idx));
+		}
+		return x;
+#else
+		(void) idx;
+		return 0;
+#endif
+	}
+
+	//Count of a perf event, read without a system call when the kernel allows it
+	//Follows the seqlock protocol documented in linux/perf_event.h
+	static inline unsigned long long perf_count(const struct pmu_perf_counter * c) {
+		struct perf_event_mmap_page * page = c->page;
+		unsigned seq, idx;
+		unsigned long long count;
+
+		if (!page) return perf_count_syscall(c);
+
+		do {
+			seq = __atomic_load_n(&page->lock, __ATOMIC_ACQUIRE);
+			__atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+			idx = page->index;
+			if (!page->cap_user_rdpmc || !idx) return perf_count_syscall(c);
+
+			//The hardware counter is pmc_width bits wide and sign-extended
+			unsigned shift = 64 - page->pmc_width;
+			long long pmc = (long long) (perf_rdpmc(idx - 1) << shift) >> shift;
+			count = page->offset + pmc;
+
+			__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		} while (__atomic_load_n(&page->lock, __ATOMIC_ACQUIRE) != seq);
+
+		return count;
+	}
+
+	//Emulated 64-bit value of a counter
+	static inline unsigned long long perf_value(const struct pmu_perf_counter * c) {
+		if (c->fd < 0) return c->bias;
+		return perf_count(c) + c->bias;
+	}
+
+	//Backend operations, see struct pmu_backend in perfmon.h
+
+	unsigned perf_pmcr_read(void);
+	void perf_pmcr_write(unsigned x);
+
+	unsigned perf_pmcnten_read(void);
+	void perf_pmcntenset_write(unsigned x);
+	void perf_pmcntenclr_write(unsigned x);
+
+	static inline unsigned perf_pmevtyper_read(unsigned n) {
+		if (n >= NEVENTS_ARCH_MAX) return 0;
+		return pmu_perf_counters[n].type;
+	}
+
+	void perf_pmevtyper_write(unsigned n, unsigned type);
+
+	static inline unsigned perf_pmevcntr_read(unsigned n) {
+		if (n >= NEVENTS_ARCH_MAX) return 0;
+		const struct pmu_perf_counter * c = &pmu_perf_counters[n];
+		if (c->high) return perf_value(c - 1) >> 32;
+		return perf_value(c);
+	}
+
+	void perf_pmevcntr_write(unsigned n, unsigned count);
+
+	static inline unsigned long long perf_pmccntr_read(void) {
+		return perf_value(&pmu_perf_counters[PMU_PERF_CYCLE_CTR]);
+	}
+
+	void perf_pmccntr_write(unsigned long long count);
+
+	unsigned perf_pmovsr_read(void);
+	void perf_pmovsr_write(unsigned x);
+	void perf_pmovsset_write(unsigned x);
+
+	unsigned perf_pminten_read(void);
+	void perf_pmintenset_write(unsigned x);
+	void perf_pmintenclr_write(unsigned x);
+
+	unsigned perf_pmuserenr_read(void);
+	void perf_pmuserenr_write(unsigned x);
+
+	unsigned perf_pmceid_read(unsigned n);
+
+	//A single PMU context, whichever CPU the thread is on
+	static inline unsigned perf_mpidr_read(void) {
+		return 0;
+	}
+
+	static inline unsigned perf_cpu(void) {
+		return 0;
+	}
+
+	static inline unsigned perf_midr_read(void) {
+		return pmu_midr_user();
+	}
+
+	//Nonzero if perf events can be opened here
+	int perf_probe(void);
+
+#endif
@@ -0,0 +1,158 @@
+#include "perfmon_presets.h"
+
+//Preset event groups, see perfmon_presets.h
+
+#define WIDE( i ) ( 1u << (i) )
+
+//Internal state
+
+    static const struct pmu_preset presets[] = {
+        { "memory", 10, {
+            EVT_L1D_CACHE, EVT_L1D_CACHE_REFILL, EVT_L2D_CACHE, EVT_L2D_CACHE_REFILL, EVT_MEM_ACCESS,
+            EVT_L1D_CACHE_WB, EVT_L2D_CACHE_WB, EVT_LD_RETIRED, EVT_ST_RETIRED, EVT_UNALIGNED_LDST_RETIRED,
+        }, WIDE(0) | WIDE(4) },
+        { "branch", 7, {
+            EVT_INST_RETIRED, EVT_BR_PRED, EVT_BR_MIS_PRED, EVT_PC_WRITE_RETIRED, EVT_BR_IMMED_RETIRED,
+            EVT_BR_RETURN_RETIRED, EVT_EXC_TAKEN,
+        }, WIDE(0) },
+        { "frontend", 8, {
+            EVT_INST_RETIRED, EVT_L1I_CACHE, EVT_L1I_CACHE_REFILL, EVT_L1I_TLB_REFILL, EVT_L2D_CACHE_REFILL,
+            EVT_BR_MIS_PRED, EVT_EXC_TAKEN, EVT_EXC_RETURN,
+        }, WIDE(0) | WIDE(1) },
+        { "tlb", 7, {
+            EVT_INST_RETIRED, EVT_L1D_TLB_REFILL, EVT_L1I_TLB_REFILL, EVT_MEM_ACCESS, EVT_TTBR_WRITE_RETIRED,
+            EVT_CID_WRITE_RETIRED, EVT_EXC_TAKEN,
+        }, WIDE(0) | WIDE(3) },
+        { "bus", 6, {
+            EVT_BUS_CYCLES, EVT_BUS_ACCESS, EVT_L2D_CACHE_REFILL, EVT_L2D_CACHE_WB, EVT_L1D_CACHE_WB,
+            EVT_MEMORY_ERROR,
+        }, WIDE(0) },
+    };
+
+    #define NPRESETS ( sizeof(presets) / sizeof(presets[0]) )
+
+
+//Helper Functions
+
+    static int preset_name_eq(const char * a, const char * b) {
+        while (*a && *a == *b) {
+            a++;
+            b++;
+        }
+        return *a == *b;
+    }
+
+
+//Public Functions
+
+    const struct pmu_preset * pmu_preset_find(const char * name) {
+        if (!name) return 0;
+        for (unsigned i = 0; i < NPRESETS; i++) {
+            if (preset_name_eq(presets[i].name, name)) return &presets[i];
+        }
+        return 0;
+    }
+
+    const struct pmu_preset * pmu_preset_get(unsigned i) {
+        return i < NPRESETS ? &presets[i] : 0;
+    }
+
+    int pmu_preset_init(struct pmu_preset_set * set, const char * name) {
+
+        if (!set || !name) return PMU_RETURN_BAD_PTR;
+
+        const struct pmu_preset * preset = pmu_preset_find(name);
+        if (!preset) return PMU_RETURN_EVENT_NO_AVAIL;
+
+        set->preset = preset;
+        set->n = 0;
+        set->unavailable = 0;
+        set->dropped = 0;
+        set->added = 0;
+
+        //Counters free on this CPU, and how many aligned pairs of them are free for chaining
+        unsigned nevents = pmu_nevents();
+        if (nevents > NEVENTS_ARCH_MAX) nevents = NEVENTS_ARCH_MAX;
+        unsigned open = ((1u << nevents) - 1) & ~pmcntenset_read();
+        unsigned nfree = __builtin_popcount(open);
+        unsigned pairs = __builtin_popcount(open & (open >> 1) & 0x55555555);
+
+        //Most useful events first, one counter each, sharing events already being counted
+        unsigned used = 0;
+        for (unsigned i = 0; i < preset->n; i++) {
+
+            unsigned event = preset->events[i];
+            struct pmu_event_handle handle;
+
+            if (!pmu_event_available(event)) {
+                set->unavailable |= 1 << i;
+                continue;
+            }
+
+            if (pmu_event_handle_get(event, &handle) == PMU_RETURN_SUCCESS) set->flags[set->n] = 0;
+            else if (used < nfree) {
+                set->flags[set->n] = (preset->wide >> i) & 1 ? PMU_EVENTFLAG_64BIT_SW : 0;
+                used++;
+            }
+            else {
+                set->dropped |= 1 << i;
+                continue;
+            }
+
+            set->events[set->n++] = event;
+        }
+
+        //Then chain wide events, in the same order, while counters are left over
+        //Chained pairs are programmed first, into aligned pairs, and single counters fill the rest,
+        //so chaining fits while chained <= pairs and chained + used <= nfree
+        unsigned chained = 0;
+        for (unsigned i = 0; i < set->n && chained < pairs && chained + used < nfree; i++) {
+            if (set->flags[i] != PMU_EVENTFLAG_64BIT_SW) continue;
+            set->flags[i] = PMU_EVENTFLAG_64BIT;
+            chained++;
+        }
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    int pmu_preset_apply(struct pmu_preset_set * set) {
+
+        if (!set) return PMU_RETURN_BAD_PTR;
+
+        pmu_preset_remove(set);
+
+        //Chained events go first so they get aligned pairs before single counters fragment them
+        for (unsigned pass = 0; pass < 2; pass++) {
+            for (unsigned i = 0; i < set->n; i++) {
+
+                unsigned chained = set->flags[i] & PMU_EVENTFLAG_64BIT ? 1 : 0;
+                if (chained != !pass) continue;
+
+                //Share events that are already being counted
+                int ret = pmu_event_add_handle(set->events[i], set->flags[i], &set->handles[i]);
+                if (ret == PMU_RETURN_SUCCESS) set->added |= 1 << i;
+                else if (ret == PMU_RETURN_EVENT_ALREADY) ret = pmu_event_handle_get(set->events[i], &set->handles[i]);
+
+                if (ret < 0) {
+                    pmu_preset_remove(set);
+                    return ret;
+                }
+            }
+        }
+
+        pmccntr_enable();
+        pmu_enable();
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    void pmu_preset_remove(struct pmu_preset_set * set) {
+        if (!set) return;
+        for (unsigned pending = set->added; pending; pending &= pending - 1) {
+            unsigned i = __builtin_ctz(pending);
+            pmu_event_remove(set->events[i], set->flags[i]);
+        }
+        set->added = 0;
+    }
@@ -0,0 +1,84 @@
+#ifndef __PERFMON_PRESETS_H
+#define __PERFMON_PRESETS_H
+
+/******************************************************************************
+*
+* perfmon_presets.h
+*
+* Named event groups, fitted to the counters this PMU has.
+*
+* Presets:
+*	memory		L1D and L2 accesses, refills and write-backs, loads and stores
+*	branch		predicted and mispredicted branches, by kind
+*	frontend	instruction fetch: L1I accesses and refills, L1I TLB refills
+*	tlb			L1I and L1D TLB refills, translation table changes
+*	bus			bus accesses and cycles, L2 refills and write-backs
+* Each lists its events most useful first, for the Cortex-A53's 6 counters.
+*
+* Fitting:
+*	pmu_preset_init drops events PMCEID0/1 say aren't implemented, then
+*	takes events in order while they fit in the counters free on the
+*	calling CPU (pmu_nevents less those already enabled), one counter
+*	each. Events already being counted are shared and take none. Events
+*	that count fast enough to wrap 32 bits within seconds (instructions,
+*	accesses, bus cycles) are then chained, most useful first, while
+*	counters are left over, and otherwise extended in software
+*	(PMU_EVENTFLAG_64BIT_SW), so chaining never costs an event. Whatever
+*	fits is counted together by pmu_preset_apply, with no
+*	PMU_RETURN_NO_OPEN_SLOT to work around. Events left out are
+*	reported, so a second run can cover them.
+*
+* A fitted set's events and flags can also go to pmu_mux_group_add.
+*
+******************************************************************************/
+
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	#define PMU_PRESET_MAX_EVENTS 12
+
+	//A preset
+	struct pmu_preset {
+		const char * name;
+		unsigned n; //Number of events
+		unsigned events[PMU_PRESET_MAX_EVENTS]; //Most useful first
+		unsigned wide; //Bit per event that needs a 64-bit range
+	};
+
+	//A preset fitted to the counters
+	struct pmu_preset_set {
+		const struct pmu_preset * preset;
+		unsigned n; //Events that fit
+		unsigned events[NEVENTS_ARCH_MAX];
+		unsigned flags[NEVENTS_ARCH_MAX]; //PMU_EVENTFLAG_64BIT for chained pairs, PMU_EVENTFLAG_64BIT_SW for extended counters
+		unsigned unavailable; //Bit per preset event this PMU doesn't implement
+		unsigned dropped; //Bit per preset event that was available but didn't fit
+		unsigned added; //Bit per set event added by pmu_preset_apply, rather than already counted
+		struct pmu_event_handle handles[NEVENTS_ARCH_MAX]; //Valid once applied
+	};
+
+	//Get a preset by name, or null
+	const struct pmu_preset * pmu_preset_find(const char * name);
+
+	//Enumerate presets, null past the last
+	const struct pmu_preset * pmu_preset_get(unsigned i);
+
+	//Fit a preset to the counters free on the calling CPU
+	//Returns PMU_RETURN_EVENT_NO_AVAIL for an unknown name
+	int pmu_preset_init(struct pmu_preset_set * set, const char * name);
+
+	//Count a fitted set's events on the calling CPU, and enable the cycle counter
+	//All events are counted or none
+	int pmu_preset_apply(struct pmu_preset_set * set);
+
+	//Stop counting the events pmu_preset_apply added
+	void pmu_preset_remove(struct pmu_preset_set * set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
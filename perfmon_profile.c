@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "perfmon_profile.h"
+
+//Timer sampling profiler, see perfmon_profile.h
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+//Internal state
+
+    //Sampling state of a thread
+    static __thread struct pmu_profile_ring * profile_ring; //Read by the signal handler
+    static __thread unsigned profile_tid;
+    static __thread timer_t profile_timer;
+
+    //Samples collected from the ring
+    static __thread struct pmu_profile_sample * profile_samples;
+    static __thread unsigned profile_nsamples;
+    static __thread unsigned profile_capacity;
+    static __thread unsigned profile_dropped; //By rings already freed
+
+    //Samples of one function, see profile_aggregate
+    struct profile_entry {
+        unsigned long key; //Function address, or the PC if it has no symbol
+        const char * name; //Null if it has no symbol
+        unsigned tid;
+        unsigned samples;
+        unsigned long long cycles;
+        unsigned long long delta[NEVENTS_ARCH_MAX];
+    };
+
+
+//Helper Functions
+
+    static unsigned long profile_pc(const void * context) {
+        const ucontext_t * uc = context;
+#if defined(__aarch64__)
+        return uc->uc_mcontext.pc;
+#elif defined(__arm__)
+        return uc->uc_mcontext.arm_pc;
+#elif defined(__x86_64__)
+        return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+        return uc->uc_mcontext.gregs[REG_EIP];
+#else
+        (void) uc;
+        return 0;
+#endif
+    }
+
+    //SIGPROF handler, runs on the sampled thread
+    static void profile_signal(int sig, siginfo_t * info, void * context) {
+        struct pmu_profile_ring * ring = profile_ring;
+        if (!ring) return;
+
+        int saved = errno;
+        pmu_profile_tick(ring, profile_pc(context), profile_tid);
+        errno = saved;
+    }
+
+    static int profile_key_cmp(const void * a, const void * b) {
+        const struct profile_entry * x = a, * y = b;
+        return x->key < y->key ? -1 : x->key > y->key;
+    }
+
+    static int profile_cycles_cmp(const void * a, const void * b) {
+        const struct profile_entry * x = a, * y = b;
+        return x->cycles > y->cycles ? -1 : x->cycles < y->cycles;
+    }
+
+    //Sum the collected samples per function, hottest first
+    //Return the number of entries, or 0 if there are none or memory ran out
+    static unsigned profile_aggregate(struct profile_entry ** entries) {
+
+        if (!profile_nsamples) return 0;
+        struct profile_entry * e = malloc(profile_nsamples * sizeof(*e));
+        if (!e) return 0;
+
+        //One entry per sample, keyed by the function it landed in
+        for (unsigned i = 0; i < profile_nsamples; i++) {
+            const struct pmu_profile_sample * sample = &profile_samples[i];
+            Dl_info info;
+
+            e[i].key = sample->pc;
+            e[i].name = 0;
+            if (dladdr((void *) sample->pc, &info) && info.dli_sname) {
+                e[i].key = (unsigned long) info.dli_saddr;
+                e[i].name = info.dli_sname;
+            }
+            e[i].tid = sample->tid;
+            e[i].samples = 1;
+            e[i].cycles = sample->cycles;
+            for (int n = 0; n < NEVENTS_ARCH_MAX; n++) e[i].delta[n] = sample->delta[n];
+        }
+
+        //Merge entries of the same function
+        qsort(e, profile_nsamples, sizeof(*e), profile_key_cmp);
+        unsigned n = 0;
+        for (unsigned i = 0; i < profile_nsamples; i++) {
+            if (n && e[n - 1].key == e[i].key) {
+                struct profile_entry * to = &e[n - 1];
+                to->samples++;
+                to->cycles += e[i].cycles;
+                for (int c = 0; c < NEVENTS_ARCH_MAX; c++) to->delta[c] += e[i].delta[c];
+            }
+            else e[n++] = e[i];
+        }
+
+        qsort(e, n, sizeof(*e), profile_cycles_cmp);
+        *entries = e;
+        return n;
+
+    }
+
+    //Counters that counted throughout, and the same event in every collected sample,
+    //filling in event with what each of them counted
+    static unsigned profile_columns(unsigned short * event) {
+
+        unsigned columns = (1 << NEVENTS_ARCH_MAX) - 1;
+        for (unsigned i = 0; i < profile_nsamples; i++) columns &= profile_samples[i].enabled;
+        if (!profile_nsamples) return 0;
+
+        for (unsigned c = 0; c < NEVENTS_ARCH_MAX; c++) {
+            if (!((columns >> c) & 1)) continue;
+            event[c] = profile_samples[0].event[c];
+            for (unsigned i = 1; i < profile_nsamples; i++) {
+                if (profile_samples[i].event[c] != event[c]) {
+                    columns &= ~(1 << c);
+                    break;
+                }
+            }
+        }
+
+        return columns;
+
+    }
+
+    static void profile_name(FILE * out, const struct profile_entry * e) {
+        if (e->name) fprintf(out, "%s", e->name);
+        else fprintf(out, "0x%lx", e->key);
+    }
+
+
+//Public Functions
+
+    int pmu_profile_start(unsigned hz, unsigned nsamples) {
+
+        if (profile_ring) pmu_profile_stop();
+        if (!hz) hz = PMU_PROFILE_HZ;
+        if (!nsamples) nsamples = PMU_PROFILE_RING_SAMPLES;
+
+        unsigned n = 1;
+        while (n < nsamples) n <<= 1;
+
+        //Touch every page now, so ticks don't fault them in
+        struct pmu_profile_ring * ring = malloc(PMU_PROFILE_RING_BYTES(n));
+        if (!ring) return PMU_RETURN_NO_MEMORY;
+        memset(ring, 0, PMU_PROFILE_RING_BYTES(n));
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = profile_signal;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, 0)) {
+            free(ring);
+            return PMU_RETURN_TIMER;
+        }
+
+        //The timer signals this thread only, on its own CPU time
+        profile_tid = syscall(SYS_gettid);
+        struct sigevent event;
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+        event.sigev_notify_thread_id = profile_tid;
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &profile_timer)) {
+            free(ring);
+            return PMU_RETURN_TIMER;
+        }
+
+        pmu_profile_ring_init(ring, n);
+        __atomic_store_n(&profile_ring, ring, __ATOMIC_RELEASE);
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+        struct itimerspec period = {
+            .it_interval = { .tv_sec = 0, .tv_nsec = 1000000000 / hz },
+            .it_value = { .tv_sec = 0, .tv_nsec = 1000000000 / hz },
+        };
+        if (hz == 1) period.it_interval = period.it_value = (struct timespec) { .tv_sec = 1 };
+        if (timer_settime(profile_timer, 0, &period, 0)) {
+            pmu_profile_stop();
+            return PMU_RETURN_TIMER;
+        }
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    int pmu_profile_stop(void) {
+
+        struct pmu_profile_ring * ring = profile_ring;
+        if (!ring) return PMU_RETURN_SUCCESS;
+
+        timer_delete(profile_timer);
+        pmu_profile_collect();
+        profile_dropped += ring->dropped;
+
+        //A signal still pending finds no ring
+        __atomic_store_n(&profile_ring, 0, __ATOMIC_RELAXED);
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        free(ring);
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    unsigned pmu_profile_collect(void) {
+
+        struct pmu_profile_ring * ring = profile_ring;
+        if (!ring) return 0;
+
+        unsigned moved = 0;
+        for (;;) {
+
+            if (profile_nsamples == profile_capacity) {
+                unsigned capacity = profile_capacity ? profile_capacity * 2 : ring->mask + 1;
+                struct pmu_profile_sample * samples = realloc(profile_samples, capacity * sizeof(*samples));
+                if (!samples) break;
+                profile_samples = samples;
+                profile_capacity = capacity;
+            }
+
+            if (pmu_profile_ring_pop(ring, &profile_samples[profile_nsamples]) != PMU_RETURN_SUCCESS) break;
+            profile_nsamples++;
+            moved++;
+        }
+
+        return moved;
+
+    }
+
+    void pmu_profile_report(FILE * out, unsigned top) {
+
+        pmu_profile_collect();
+
+        struct profile_entry * e;
+        unsigned n = profile_aggregate(&e);
+        if (!n) {
+            fprintf(out, "no samples\n");
+            return;
+        }
+
+        //Events of the counters that counted one event throughout, as recorded by the ticks
+        unsigned short event[NEVENTS_ARCH_MAX];
+        unsigned enabled = profile_columns(event);
+        unsigned nevents = NEVENTS_ARCH_MAX;
+        unsigned long long cycles = 0;
+        for (unsigned i = 0; i < n; i++) cycles += e[i].cycles;
+
+        unsigned dropped = profile_dropped + (profile_ring ? profile_ring->dropped : 0);
+        fprintf(out, "%u samples", profile_nsamples);
+        if (dropped) fprintf(out, ", %u dropped", dropped);
+        fprintf(out, "\n%7s %8s %14s", "cycles%", "samples", "cycles");
+        for (unsigned c = 0; c < nevents; c++) {
+            if ((enabled >> c) & 1) fprintf(out, "    event 0x%02x", event[c]);
+        }
+        fprintf(out, "  function\n");
+
+        if (top && top < n) n = top;
+        for (unsigned i = 0; i < n; i++) {
+            fprintf(out, "%6.2f%% %8u %14llu", cycles ? 100.0 * e[i].cycles / cycles : 0.0,
+                e[i].samples, e[i].cycles);
+            for (unsigned c = 0; c < nevents; c++) {
+                if ((enabled >> c) & 1) fprintf(out, " %14llu", e[i].delta[c]);
+            }
+            fprintf(out, "  ");
+            profile_name(out, &e[i]);
+            fprintf(out, "\n");
+        }
+
+        free(e);
+
+    }
+
+    void pmu_profile_folded(FILE * out, int counter) {
+
+        pmu_profile_collect();
+
+        //A counter's values only add up if it counted one event throughout
+        unsigned short event[NEVENTS_ARCH_MAX];
+        if (counter >= 0 && (counter >= NEVENTS_ARCH_MAX || !((profile_columns(event) >> counter) & 1))) return;
+
+        struct profile_entry * e;
+        unsigned n = profile_aggregate(&e);
+
+        for (unsigned i = 0; i < n; i++) {
+            unsigned long long value = e[i].cycles;
+            if (counter >= 0) value = e[i].delta[counter];
+            fprintf(out, "thread-%u;", e[i].tid);
+            profile_name(out, &e[i]);
+            fprintf(out, " %llu\n", value);
+        }
+
+        if (n) free(e);
+
+    }
+
+    void pmu_profile_clear(void) {
+        free(profile_samples);
+        profile_samples = 0;
+        profile_nsamples = 0;
+        profile_capacity = 0;
+        profile_dropped = 0;
+    }
@@ -0,0 +1,71 @@
+#ifndef __PERFMON_PROFILE_H
+#define __PERFMON_PROFILE_H
+
+/******************************************************************************
+*
+* perfmon_profile.h
+*
+* Timer sampling profiler for userspace threads, on top of pmu_profile_tick.
+*
+* pmu_profile_start arms a POSIX timer on the calling thread's CPU time,
+* delivering SIGPROF to that thread hz times a second. Each tick records
+* the interrupted PC, the thread id and what every enabled counter counted
+* since the previous tick into the thread's own preallocated ring, so the
+* signal handler never allocates or locks. Counters are set up as usual
+* beforehand, e.g. with pmu_event_add(EVT_L1D_CACHE_REFILL, 0).
+*
+* Reports:
+*	pmu_profile_report prints the hottest functions by cycles, with the
+*	events counted in them, labelled with the events the ticks recorded.
+*	pmu_profile_folded prints one "thread;function value" line per
+*	function in the folded-stack format taken by flame graph tools.
+*	No call stacks are unwound, so each stack is the one function a
+*	sample landed in: it is a flat hot-spot report, and a flame graph of
+*	it shows hot functions, not the paths that led to them.
+*	Functions are named with dladdr, so only exported symbols have names
+*	(link with -rdynamic), others are reported by PC.
+*
+* Each thread profiles and reports itself: the rings and collected samples
+* are per thread. The thread should stay on one CPU (see pmu_cpu).
+*
+******************************************************************************/
+
+#include <stdio.h>
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	#define PMU_PROFILE_HZ 1000 //Default tick rate
+	#define PMU_PROFILE_RING_SAMPLES 4096 //Default ring size, drained by pmu_profile_collect
+
+	//Start sampling the calling thread hz times a second of its CPU time (0 for PMU_PROFILE_HZ),
+	//into a ring of nsamples records (0 for PMU_PROFILE_RING_SAMPLES, rounded up to a power of two)
+	//Restarts if already sampling, keeping the samples collected so far
+	int pmu_profile_start(unsigned hz, unsigned nsamples);
+
+	//Stop sampling the calling thread, collecting what's left in its ring
+	int pmu_profile_stop(void);
+
+	//Move samples from the calling thread's ring to its collected samples
+	//Call at least every ring size ticks while sampling, or samples are dropped
+	//Return the number of samples moved
+	unsigned pmu_profile_collect(void);
+
+	//Print the top functions by cycles of the calling thread's collected samples
+	void pmu_profile_report(FILE * out, unsigned top);
+
+	//Print the calling thread's collected samples as one-frame folded stacks (a flat profile)
+	//Values are cycles for a negative counter, else that event counter's counts,
+	//and nothing is printed for a counter that didn't count one event throughout
+	void pmu_profile_folded(FILE * out, int counter);
+
+	//Forget the calling thread's collected samples
+	void pmu_profile_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,271 @@
+#include "perfmon.h"
+
+//Event-based sampling
+//A sampled event's counter is preloaded so it overflows after period events
+//Chained events preload the high register to all ones and interrupt on its overflow
+//Timer sampling records counter deltas between ticks
+
+//Internal state
+
+    struct pmu_sample_config {
+        unsigned period; //Events between samples, 0 if not sampling
+        unsigned slot; //Low event counter of the event
+        unsigned chained; //Nonzero if slot+1 holds the high word
+        unsigned event; //Event being sampled
+    };
+
+    //Sampling configuration of one CPU's PMU, padded like pmu_state
+    struct pmu_sample_cpu {
+        unsigned mask; //Counters raising sampling interrupts
+        struct pmu_sample_config config[NEVENTS_ARCH_MAX]; //Indexed by the counter that raises the interrupt
+    } __attribute__((aligned(PMU_CACHE_LINE)));
+
+    static struct pmu_sample_cpu sample_cpu[PMU_MAX_CPUS];
+
+
+//Helper Functions
+
+    //Preload counters so the next overflow comes period events after the last one
+    //Events counted since the overflow (interrupt latency) are carried over
+    static void sample_preload(const struct pmu_sample_config * config) {
+        unsigned low = pmevcntr_read(config->slot);
+        if (config->chained) pmevcntr_write(config->slot + 1, ~0u);
+        pmevcntr_write(config->slot, low - config->period);
+    }
+
+    //Append a sample, dropping it if the consumer has fallen behind
+    static void sample_push(struct pmu_sample_ring * ring, const struct pmu_sample_config * config,
+        const struct pmu_snapshot * snap, unsigned long pc) {
+
+        unsigned head = ring->head;
+        unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        if (head - tail >= PMU_SAMPLE_RING_SIZE) {
+            ring->dropped++;
+            return;
+        }
+
+        struct pmu_sample * sample = &ring->records[head & (PMU_SAMPLE_RING_SIZE - 1)];
+        sample->pc = pc;
+        sample->slot = config->slot;
+        sample->event = config->event;
+        sample->cycles = snap->cycles;
+        for (int i = 0; i < NEVENTS_ARCH_MAX; i++) {
+            sample->count[i] = i < snap->nevents ? snap->count[i] : 0;
+        }
+
+        //Publish the record before the new head
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    }
+
+    //Read the counters' events into ring if the event set changed since they were last read
+    //Return the counters now counting a different event
+    static unsigned profile_events(struct pmu_profile_ring * ring, unsigned nevents) {
+
+        unsigned config = pmu_config_read_begin(pmu_state_this());
+        if (config == ring->config) return 0;
+
+        unsigned changed = 0;
+        for (unsigned i = 0; i < nevents; i++) {
+            unsigned short event = pmevtyper_get(i);
+            if (event != ring->event[i]) changed |= 1 << i;
+            ring->event[i] = event;
+        }
+        ring->config = config;
+
+        return changed;
+
+    }
+
+
+//Public Functions
+
+    //Raise an overflow interrupt every period occurrences of a monitored event
+    //A period of 0 stops sampling
+    int pmu_sample_period_set(const struct pmu_event_handle * handle, unsigned period) {
+
+        if (!handle) return PMU_RETURN_BAD_PTR;
+        if (!period) return pmu_sample_period_clear(handle);
+
+        unsigned irq = handle->chained ? handle->slot + 1 : handle->slot;
+        if (irq >= NEVENTS_ARCH_MAX) return PMU_RETURN_EVENT_NO_WATCH;
+
+        struct pmu_sample_cpu * cpu = &sample_cpu[pmu_cpu()];
+        struct pmu_sample_config * config = &cpu->config[irq];
+
+        pminten_disable(irq);
+        config->period = period;
+        config->slot = handle->slot;
+        config->chained = handle->chained;
+        config->event = handle->event;
+
+        pmevcntr_write(handle->slot, 0);
+        sample_preload(config);
+        pmovsr_write((handle->chained ? 0b11 : 0b1) << handle->slot);
+        cpu->mask |= 1 << irq;
+        pminten_enable(irq);
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    //Stop sampling an event
+    int pmu_sample_period_clear(const struct pmu_event_handle * handle) {
+
+        if (!handle) return PMU_RETURN_BAD_PTR;
+
+        unsigned irq = handle->chained ? handle->slot + 1 : handle->slot;
+        if (irq >= NEVENTS_ARCH_MAX) return PMU_RETURN_EVENT_NO_WATCH;
+
+        struct pmu_sample_cpu * cpu = &sample_cpu[pmu_cpu()];
+        pminten_disable(irq);
+        cpu->mask &= ~(1 << irq);
+        cpu->config[irq].period = 0;
+        pmovsr_write((handle->chained ? 0b11 : 0b1) << handle->slot);
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    //Handle a PMU overflow interrupt on this CPU
+    //Records one sample per overflowed sampling counter into ring, which may be null,
+    //and preloads those counters for the next period
+    //Returns the overflow flags handled, 0 if the interrupt was not ours
+    unsigned pmu_overflow_handler(struct pmu_sample_ring * ring, unsigned long pc) {
+
+        struct pmu_sample_cpu * cpu = &sample_cpu[pmu_cpu()];
+        struct pmu_ext_state * ext_state = &pmu_state_this()->ext;
+        unsigned ext = ext_state->interrupt ? ext_state->mask : 0;
+        unsigned ovs = pmovsr_read() & (cpu->mask | ext);
+        if (!ovs) return 0;
+        unsigned handled = ovs;
+
+        //Software-extended counters only need their high word bumped
+        //An odd seqcount means the interrupt landed in pmu_ext_start or pmu_context_restore
+        //on this CPU: readers are already retrying, so fold in place and let its release publish it
+        //(polled folds don't overlap, as counters the interrupt folds aren't polled)
+        if (ovs & ext) {
+            unsigned seq = __atomic_load_n(&ext_state->seq, __ATOMIC_RELAXED);
+            if (seq & 1) pmu_ext_fold_locked(ext_state, ovs & ext);
+            else pmu_ext_fold(ext_state, seq, ovs & ext);
+            ovs &= ~ext;
+            if (!ovs) return handled;
+        }
+
+        //Capture the other counters before anything else disturbs them
+        struct pmu_snapshot snap;
+        pmu_snapshot(&snap, 0);
+
+        pmovsr_write(ovs);
+
+        unsigned pending = ovs;
+        while (pending) {
+
+            unsigned irq = __builtin_ctz(pending);
+            pending &= pending - 1;
+
+            const struct pmu_sample_config * config = &cpu->config[irq];
+            sample_preload(config);
+
+            //The low word of a chained pair overflows too, but doesn't interrupt
+            if (config->chained) pmovsr_clear(config->slot);
+
+            if (ring) sample_push(ring, config, &snap, pc);
+        }
+
+        return handled;
+
+    }
+
+    //Take the oldest sample from a ring
+    //Returns PMU_RETURN_RING_EMPTY if there is none
+    int pmu_sample_ring_pop(struct pmu_sample_ring * ring, struct pmu_sample * sample) {
+
+        if (!ring || !sample) return PMU_RETURN_BAD_PTR;
+
+        unsigned tail = ring->tail;
+        unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == head) return PMU_RETURN_RING_EMPTY;
+
+        *sample = ring->records[tail & (PMU_SAMPLE_RING_SIZE - 1)];
+
+        //Release the slot only after copying it out
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    //Start a timer sample ring of n records, n a power of two
+    //Counts from here on go to the first sample
+    void pmu_profile_ring_init(struct pmu_profile_ring * ring, unsigned n) {
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        ring->mask = n - 1;
+        pmu_snapshot(&ring->last, 0);
+        ring->config = ~pmu_config_read_begin(pmu_state_this());
+        profile_events(ring, ring->last.nevents);
+    }
+
+    //Record a timer sample: what the counters counted since the previous tick
+    //Called from the tick (signal handler, hrtimer), on the CPU whose counters are read
+    void pmu_profile_tick(struct pmu_profile_ring * ring, unsigned long pc, unsigned tid) {
+
+        //A signal can land between the interrupted code's PMSELR write and its access
+        unsigned select = pmu_select_save();
+
+        struct pmu_snapshot snap;
+        pmu_snapshot(&snap, 0);
+
+        //Events are labelled as they are counted, not when the samples are read,
+        //and a counter moved to another event mid-tick counted neither
+        unsigned changed = profile_events(ring, snap.nevents);
+
+        unsigned head = ring->head;
+        unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        if (head - tail > ring->mask) ring->dropped++;
+        else {
+            const struct pmu_snapshot * last = &ring->last;
+            struct pmu_profile_sample * sample = &ring->records[head & ring->mask];
+            sample->pc = pc;
+            sample->tid = tid;
+            sample->enabled = snap.enabled & last->enabled & ~changed;
+            //Without PMCR.LC the cycle counter is read as 32 bits and can wrap between ticks
+            sample->cycles = snap.cycles >= last->cycles ? snap.cycles - last->cycles
+                : (unsigned) (snap.cycles - last->cycles);
+            for (int i = 0; i < NEVENTS_ARCH_MAX; i++) {
+                sample->delta[i] = i < snap.nevents ? snap.count[i] - last->count[i] : 0;
+                sample->event[i] = ring->event[i];
+            }
+
+            //Publish the record before the new head
+            __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+        }
+
+        ring->last = snap;
+
+        pmu_select_restore(select);
+
+    }
+
+    //Take the oldest timer sample from a ring
+    //Returns PMU_RETURN_RING_EMPTY if there is none
+    int pmu_profile_ring_pop(struct pmu_profile_ring * ring, struct pmu_profile_sample * sample) {
+
+        if (!ring || !sample) return PMU_RETURN_BAD_PTR;
+
+        unsigned tail = ring->tail;
+        unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == head) return PMU_RETURN_RING_EMPTY;
+
+        *sample = ring->records[tail & ring->mask];
+
+        //Release the slot only after copying it out
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+        return PMU_RETURN_SUCCESS;
+
+    }
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "perfmon_shm.h"
+
+//Shared-memory rings, see perfmon_shm.h
+
+//Helper Functions
+
+    static inline unsigned long shm_bytes(unsigned size) {
+        return sizeof(struct pmu_shm_header) + (unsigned long) size * sizeof(struct pmu_shm_record);
+    }
+
+    //Map a ring's descriptor and set up shm around it
+    static int shm_map(struct pmu_shm * shm, int fd, unsigned long bytes) {
+        void * map = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) return PMU_RETURN_SHM;
+
+        memset(shm, 0, sizeof(*shm));
+        shm->header = map;
+        shm->records = (struct pmu_shm_record *) (shm->header + 1);
+        shm->bytes = bytes;
+        shm->fd = fd;
+        return PMU_RETURN_SUCCESS;
+    }
+
+    //Whether a named ring belongs to a live thread other than the caller
+    //A ring still being set up (no magic yet) counts as live
+    static int shm_owner_alive(const char * name) {
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) return errno != ENOENT;
+
+        int alive = 1;
+        struct stat st;
+        if (!fstat(fd, &st) && (unsigned long) st.st_size >= sizeof(struct pmu_shm_header)) {
+            const struct pmu_shm_header * header = mmap(0, sizeof(*header), PROT_READ, MAP_SHARED, fd, 0);
+            if (header != MAP_FAILED) {
+                if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == PMU_SHM_MAGIC) {
+                    pid_t tid = header->tid;
+                    alive = tid != syscall(SYS_gettid) && (!kill(tid, 0) || errno == EPERM);
+                }
+                munmap((void *) header, sizeof(*header));
+            }
+        }
+
+        close(fd);
+        return alive;
+    }
+
+    //Copy the values of a record that are in use
+    static inline void shm_copy(struct pmu_shm_record * to, const struct pmu_shm_record * from, unsigned nevents) {
+        to->seq = from->seq;
+        to->cpu = from->cpu;
+        to->cycles = from->cycles;
+        for (unsigned i = 0; i < nevents; i++) to->value[i] = from->value[i];
+    }
+
+
+//Public Functions
+
+    int pmu_shm_create(struct pmu_shm * shm, const char * name, unsigned nrecords, unsigned policy,
+        const unsigned * events, unsigned nevents) {
+
+        if (!shm || (nevents && !events)) return PMU_RETURN_BAD_PTR;
+        if (nevents > NEVENTS_ARCH_MAX) return PMU_RETURN_GROUP_TOO_LARGE;
+
+        //Records are read through handles, so the events must be monitored already
+        struct pmu_event_handle handles[NEVENTS_ARCH_MAX];
+        for (unsigned i = 0; i < nevents; i++) {
+            int ret = pmu_event_handle_get(events[i], &handles[i]);
+            if (ret < 0) return ret;
+        }
+
+        unsigned size = 1;
+        while (size < nrecords) size <<= 1;
+        unsigned long bytes = shm_bytes(size);
+
+        int fd;
+        if (name) {
+            //Replace a ring left behind by a producer that died, never a live one's
+            fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd < 0 && errno == EEXIST && !shm_owner_alive(name)) {
+                shm_unlink(name);
+                fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+            }
+        }
+        else fd = memfd_create("perfmon", MFD_CLOEXEC);
+        if (fd < 0) return PMU_RETURN_SHM;
+
+        if (ftruncate(fd, bytes) || shm_map(shm, fd, bytes) < 0) {
+            close(fd);
+            if (name) shm_unlink(name);
+            return PMU_RETURN_SHM;
+        }
+
+        //Touch every page now, so pushes don't fault them in
+        memset(shm->header, 0, bytes);
+
+        struct pmu_shm_header * header = shm->header;
+        header->version = PMU_SHM_VERSION;
+        header->size = size;
+        header->policy = policy;
+        header->tid = syscall(SYS_gettid);
+        header->nevents = nevents;
+        for (unsigned i = 0; i < nevents; i++) {
+            header->events[i] = events[i];
+            shm->handles[i] = handles[i];
+        }
+        shm->mask = size - 1;
+        shm->policy = policy;
+        shm->nevents = nevents;
+
+        //A collector only trusts the header once the magic is there
+        __atomic_store_n(&header->magic, PMU_SHM_MAGIC, __ATOMIC_RELEASE);
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    int pmu_shm_open(struct pmu_shm * shm, const char * name) {
+
+        if (!shm || !name) return PMU_RETURN_BAD_PTR;
+
+        int fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0) return PMU_RETURN_SHM;
+
+        int ret = pmu_shm_open_fd(shm, fd);
+        if (ret < 0) close(fd);
+        return ret;
+
+    }
+
+    int pmu_shm_open_fd(struct pmu_shm * shm, int fd) {
+
+        if (!shm) return PMU_RETURN_BAD_PTR;
+
+        struct stat st;
+        if (fstat(fd, &st) || (unsigned long) st.st_size < sizeof(struct pmu_shm_header)) return PMU_RETURN_SHM;
+
+        int ret = shm_map(shm, fd, st.st_size);
+        if (ret < 0) return ret;
+
+        //Check the producer finished setting the ring up and that it fits the mapping
+        const struct pmu_shm_header * header = shm->header;
+        unsigned size = header->size;
+        if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != PMU_SHM_MAGIC || header->version != PMU_SHM_VERSION
+            || !size || (size & (size - 1)) || shm_bytes(size) > shm->bytes || header->nevents > NEVENTS_ARCH_MAX) {
+            munmap(shm->header, shm->bytes);
+            shm->header = 0;
+            return PMU_RETURN_SHM;
+        }
+        shm->mask = size - 1;
+        shm->policy = header->policy;
+        shm->nevents = header->nevents;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    int pmu_shm_pop(struct pmu_shm * shm, struct pmu_shm_record * record) {
+
+        if (!shm || !record) return PMU_RETURN_BAD_PTR;
+
+        struct pmu_shm_header * header = shm->header;
+        unsigned nevents = shm->nevents;
+        unsigned tail = header->tail;
+        unsigned head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        if (head == tail) return PMU_RETURN_RING_EMPTY;
+
+        if (shm->policy != PMU_SHM_OVERWRITE) {
+            shm_copy(record, &shm->records[tail & shm->mask], nevents);
+            __atomic_store_n(&header->tail, tail + 1, __ATOMIC_RELEASE);
+            return PMU_RETURN_SUCCESS;
+        }
+
+        for (;;) {
+
+            //Skip what the producer lapped
+            if (head - tail > shm->mask) {
+                shm->lost += head - tail - shm->mask - 1;
+                tail = head - shm->mask - 1;
+            }
+
+            //Keep the record only if it was the one at tail throughout the copy
+            const struct pmu_shm_record * slot = &shm->records[tail & shm->mask];
+            unsigned seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            if (seq == 2 * tail + 2) {
+                shm_copy(record, slot, nevents);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) break;
+            }
+
+            shm->lost++;
+            tail++;
+            head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+            if (head == tail) {
+                __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+                return PMU_RETURN_RING_EMPTY;
+            }
+        }
+
+        __atomic_store_n(&header->tail, tail + 1, __ATOMIC_RELEASE);
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    void pmu_shm_close(struct pmu_shm * shm) {
+        if (!shm || !shm->header) return;
+        munmap(shm->header, shm->bytes);
+        close(shm->fd);
+        shm->header = 0;
+        shm->records = 0;
+        shm->fd = -1;
+    }
+
+    int pmu_shm_unlink(const char * name) {
+        if (!name) return PMU_RETURN_BAD_PTR;
+        return shm_unlink(name) ? PMU_RETURN_SHM : PMU_RETURN_SUCCESS;
+    }
@@ -0,0 +1,159 @@
+#ifndef __PERFMON_SHM_H
+#define __PERFMON_SHM_H
+
+/******************************************************************************
+*
+* perfmon_shm.h
+*
+* Shared-memory rings for handing counter values to a collector process.
+*
+* A monitored thread creates a ring with the events it exports
+* (pmu_shm_create), and pushes records of their pmu_event_get values and
+* pmccntr_get into it, either read by pmu_shm_sample or passed to
+* pmu_shm_push. A collector process maps the same ring (pmu_shm_open) and
+* pops records at its own pace. The producer never formats or writes
+* anything: a push is the value stores plus a release store of the head.
+*
+* Sharing:
+*	A named ring is a POSIX shared memory object (shm_open), so the
+*	collector can find it by name, e.g. "/perfmon.<pid>.<tid>". An
+*	unnamed ring is a memfd, whose descriptor (pmu_shm.fd) is passed to
+*	the collector, e.g. over a Unix socket, and opened with pmu_shm_open_fd.
+*	Creating a named ring replaces one left by a producer thread that has
+*	exited, and fails with PMU_RETURN_SHM while that thread is alive.
+*	Each side keeps its own copy of the ring's shape (size, policy,
+*	nevents) from create or open, so the other can't make it write or
+*	read past a record by rewriting the header.
+*
+* When full:
+*	PMU_SHM_DROP: new records are dropped and counted in the header.
+*	PMU_SHM_OVERWRITE: the oldest records are overwritten. Each record
+*	carries a sequence number, so the collector skips records overwritten
+*	under it and counts them as lost.
+*
+* Layout: the header's head and tail each sit on their own cache line, so
+* the producer and the collector don't false-share; records follow.
+* One ring per thread: a ring has a single producer and a single consumer.
+*
+******************************************************************************/
+
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	#define PMU_SHM_MAGIC 0x504d5348 //"PMSH"
+	#define PMU_SHM_VERSION 1
+
+	//Policies when the ring is full
+	const static unsigned PMU_SHM_DROP = 0;
+	const static unsigned PMU_SHM_OVERWRITE = 1;
+
+	//One sample of a thread's exported counters
+	struct pmu_shm_record {
+		unsigned seq; //PMU_SHM_OVERWRITE: 2 * index + 2 once written, odd while being written
+		unsigned cpu; //CPU the producer runs on, as cached by pmu_cpu_core
+		unsigned long long cycles; //pmccntr_get
+		unsigned long long value[NEVENTS_ARCH_MAX]; //pmu_event_get of each event in the header
+	};
+
+	//Shared ring header, followed by the records
+	struct pmu_shm_header {
+		unsigned magic;
+		unsigned version;
+		unsigned size; //Number of records, a power of two
+		unsigned policy;
+		unsigned tid; //Producing thread
+		unsigned nevents; //Values per record
+		unsigned events[NEVENTS_ARCH_MAX]; //Event of each value
+		//Producer's cache line
+		unsigned head __attribute__((aligned(PMU_CACHE_LINE))); //Next record to write
+		unsigned dropped; //PMU_SHM_DROP: records dropped because the ring was full
+		//Consumer's cache line
+		unsigned tail __attribute__((aligned(PMU_CACHE_LINE))); //Next record to read
+	} __attribute__((aligned(PMU_CACHE_LINE)));
+
+	//A process's mapping of a ring
+	struct pmu_shm {
+		struct pmu_shm_header * header;
+		struct pmu_shm_record * records;
+		unsigned long bytes; //Size of the mapping
+		int fd;
+		unsigned mask; //Number of records - 1
+		unsigned policy; //Copied from the header at create or open
+		unsigned nevents; //Values per record, copied from the header at create or open
+		unsigned tail_cache; //Producer: last tail seen, reloaded only when the ring looks full
+		unsigned long long lost; //Consumer: records overwritten before they could be read
+		struct pmu_event_handle handles[NEVENTS_ARCH_MAX]; //Producer: handles of the events
+	};
+
+	//Producer: create a ring of nrecords records (rounded up to a power of two)
+	//exporting the given monitored events, named (shm_open) or not (memfd) with a null name
+	int pmu_shm_create(struct pmu_shm * shm, const char * name, unsigned nrecords, unsigned policy,
+		const unsigned * events, unsigned nevents);
+
+	//Consumer: map a ring by name or descriptor
+	int pmu_shm_open(struct pmu_shm * shm, const char * name);
+	int pmu_shm_open_fd(struct pmu_shm * shm, int fd);
+
+	//Consumer: take the oldest record
+	//Returns PMU_RETURN_RING_EMPTY if there is none
+	int pmu_shm_pop(struct pmu_shm * shm, struct pmu_shm_record * record);
+
+	//Unmap a ring, on either side
+	void pmu_shm_close(struct pmu_shm * shm);
+
+	//Remove a named ring, once both sides are done with it
+	int pmu_shm_unlink(const char * name);
+
+	//Producer: append a record of nevents values
+	//Returns PMU_RETURN_RING_FULL if the record was dropped
+	static inline int pmu_shm_push(struct pmu_shm * shm, unsigned long long cycles, const unsigned long long * value) {
+
+		struct pmu_shm_header * header = shm->header;
+		unsigned head = header->head;
+		unsigned overwrite = shm->policy == PMU_SHM_OVERWRITE;
+
+		if (!overwrite && head - shm->tail_cache > shm->mask) {
+			shm->tail_cache = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+			if (head - shm->tail_cache > shm->mask) {
+				__atomic_store_n(&header->dropped, header->dropped + 1, __ATOMIC_RELAXED);
+				return PMU_RETURN_RING_FULL;
+			}
+		}
+
+		struct pmu_shm_record * record = &shm->records[head & shm->mask];
+
+		//Mark the record as being written before touching it
+		if (overwrite) {
+			__atomic_store_n(&record->seq, 2 * head + 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+		}
+
+		//A thread-local load, no system register or system call
+		record->cpu = pmu_cpu_core();
+		record->cycles = cycles;
+		for (unsigned i = 0; i < shm->nevents; i++) record->value[i] = value[i];
+
+		if (overwrite) __atomic_store_n(&record->seq, 2 * head + 2, __ATOMIC_RELEASE);
+
+		//Publish the record before the new head
+		__atomic_store_n(&header->head, head + 1, __ATOMIC_RELEASE);
+
+		return PMU_RETURN_SUCCESS;
+
+	}
+
+	//Producer: read the exported events and the cycle counter and push them
+	static inline int pmu_shm_sample(struct pmu_shm * shm) {
+		unsigned long long value[NEVENTS_ARCH_MAX];
+		for (unsigned i = 0; i < shm->nevents; i++) value[i] = pmu_handle_read(&shm->handles[i]);
+		return pmu_shm_push(shm, pmccntr_get(), value);
+	}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
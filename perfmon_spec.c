@@ -0,0 +1,192 @@
+#include "perfmon_spec.h"
+#include "perfmon_event_names.h"
+
+//Event specs, see perfmon_spec.h
+
+//Privilege levels listed by modifiers
+#define SPEC_EL0 ( 1 << 0 )
+#define SPEC_EL1 ( 1 << 1 )
+#define SPEC_EL2 ( 1 << 2 )
+
+//Helper Functions
+
+    static inline char spec_upper(char c) {
+        return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+    }
+
+    static inline int spec_is_name(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+
+    static inline const char * spec_skip(const char * p) {
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+        return p;
+    }
+
+    //Does s, of length characters, match the upper-case name in any case?
+    static int spec_name_eq(const char * s, unsigned length, const char * name) {
+        for (unsigned i = 0; i < length; i++) {
+            if (!name[i] || spec_upper(s[i]) != name[i]) return 0;
+        }
+        return !name[length];
+    }
+
+    //Event number, hex with 0x or decimal
+    static int spec_number(const char * s, unsigned length) {
+
+        unsigned value = 0, base = 10, i = 0;
+        if (length > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+            base = 16;
+            i = 2;
+        }
+
+        for (; i < length; i++) {
+            char c = spec_upper(s[i]);
+            unsigned digit;
+            if (c >= '0' && c <= '9') digit = c - '0';
+            else if (base == 16 && c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+            else return PMU_RETURN_SPEC_SYNTAX;
+
+            //Event numbers are 10 bits
+            value = value * base + digit;
+            if (value > PMEVTYPER_EVENT) return PMU_RETURN_SPEC_SYNTAX;
+        }
+
+        return value;
+
+    }
+
+    //Apply a modifier to an event
+    static int spec_modifier(const char * s, unsigned length, struct pmu_event_spec * e, unsigned * levels) {
+
+        if (spec_name_eq(s, length, "64BIT")) {
+            if (e->flags & PMU_EVENTFLAG_64BIT_SW) return PMU_RETURN_SPEC_SYNTAX;
+            e->flags |= PMU_EVENTFLAG_64BIT;
+        }
+        else if (spec_name_eq(s, length, "EXT")) {
+            if (e->flags & PMU_EVENTFLAG_64BIT) return PMU_RETURN_SPEC_SYNTAX;
+            e->flags |= PMU_EVENTFLAG_64BIT_SW;
+        }
+        else if (spec_name_eq(s, length, "U") || spec_name_eq(s, length, "USER")) *levels |= SPEC_EL0;
+        else if (spec_name_eq(s, length, "K") || spec_name_eq(s, length, "KERNEL")) *levels |= SPEC_EL1;
+        else if (spec_name_eq(s, length, "H") || spec_name_eq(s, length, "HYP")) *levels |= SPEC_EL2;
+        else return PMU_RETURN_SPEC_SYNTAX;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    static int spec_fail(int ret, const char ** error, const char * at) {
+        if (error) *error = at;
+        return ret;
+    }
+
+    //Start of the i-th event in spec
+    static const char * spec_event_at(const char * spec, unsigned i) {
+        const char * p = spec;
+        while (i && *p) {
+            if (*p++ == ',') i--;
+        }
+        return spec_skip(p);
+    }
+
+
+//Public Functions
+
+    int pmu_spec_lookup(const char * name, unsigned length) {
+
+        if (!name) return PMU_RETURN_BAD_PTR;
+
+        if (length > 4 && spec_name_eq(name, 4, "EVT_")) {
+            name += 4;
+            length -= 4;
+        }
+
+        unsigned h = PMU_EVENT_NAMES_SEED;
+        for (unsigned i = 0; i < length; i++) {
+            h = (h ^ (unsigned char) spec_upper(name[i])) * PMU_EVENT_NAMES_PRIME;
+        }
+
+        //A perfect hash: the name can only be in this entry
+        unsigned i = h >> (32 - PMU_EVENT_NAMES_BITS);
+        if (pmu_event_names[i].name && spec_name_eq(name, length, pmu_event_names[i].name)) return pmu_event_names[i].event;
+
+        return PMU_RETURN_EVENT_NO_AVAIL;
+
+    }
+
+    int pmu_spec_parse(const char * spec, struct pmu_event_spec * specs, unsigned max, unsigned * n, const char ** error) {
+
+        if (!spec || !n || (max && !specs)) return PMU_RETURN_BAD_PTR;
+
+        *n = 0;
+        const char * p = spec_skip(spec);
+        if (!*p) return PMU_RETURN_SUCCESS;
+
+        for (;;) {
+
+            //Name or number
+            const char * token = p;
+            while (spec_is_name(*p)) p++;
+            unsigned length = p - token;
+            if (!length) return spec_fail(PMU_RETURN_SPEC_SYNTAX, error, token);
+            if (*n >= max) return spec_fail(PMU_RETURN_GROUP_TOO_LARGE, error, token);
+
+            int event = token[0] >= '0' && token[0] <= '9' ? spec_number(token, length) : pmu_spec_lookup(token, length);
+            if (event < 0) return spec_fail(event, error, token);
+
+            struct pmu_event_spec * e = &specs[*n];
+            e->event = event;
+            e->flags = 0;
+            e->filter = 0;
+
+            //Modifiers
+            unsigned levels = 0;
+            p = spec_skip(p);
+            while (*p == ':') {
+                p = spec_skip(p + 1);
+                token = p;
+                while (spec_is_name(*p)) p++;
+                if (spec_modifier(token, p - token, e, &levels) < 0) return spec_fail(PMU_RETURN_SPEC_SYNTAX, error, token);
+                p = spec_skip(p);
+            }
+
+            //Only count at the levels listed
+            if (levels) {
+                if (!(levels & SPEC_EL0)) e->filter |= PMEVTYPER_U;
+                if (!(levels & SPEC_EL1)) e->filter |= PMEVTYPER_P;
+                if (levels & SPEC_EL2) e->filter |= PMEVTYPER_NSH;
+            }
+
+            (*n)++;
+
+            if (!*p) return PMU_RETURN_SUCCESS;
+            if (*p != ',') return spec_fail(PMU_RETURN_SPEC_SYNTAX, error, p);
+            p = spec_skip(p + 1);
+        }
+
+    }
+
+    int pmu_spec_add(const char * spec, struct pmu_event_handle * handles, unsigned * n, const char ** error) {
+
+        struct pmu_event_spec specs[NEVENTS_ARCH_MAX];
+        unsigned count;
+
+        if (error) *error = 0;
+        int ret = pmu_spec_parse(spec, specs, NEVENTS_ARCH_MAX, &count, error);
+        if (ret < 0) return ret;
+
+        for (unsigned i = 0; i < count; i++) {
+            if (!pmu_event_available(specs[i].event)) {
+                return spec_fail(PMU_RETURN_EVENT_NO_AVAIL, error, spec_event_at(spec, i));
+            }
+        }
+
+        ret = pmu_event_add_batch(specs, count, handles);
+        if (ret < 0) return ret;
+
+        if (n) *n = count;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
@@ -0,0 +1,57 @@
+#ifndef __PERFMON_SPEC_H
+#define __PERFMON_SPEC_H
+
+/******************************************************************************
+*
+* perfmon_spec.h
+*
+* Event specs: counters described by a string, e.g. from a config file.
+*
+* Syntax:
+*	spec		event [, event]...
+*	event		name-or-number [:modifier]...
+*	name		an EVT_* constant, with or without the EVT_ prefix, in any case
+*	number		an event number, hex with 0x or decimal, e.g. 0xC0
+*	modifiers:
+*		64bit		chain a pair of counters (PMU_EVENTFLAG_64BIT)
+*		ext			extend one counter in software (PMU_EVENTFLAG_64BIT_SW)
+*		u, user		count at EL0
+*		k, kernel	count at EL1
+*		h, hyp		count at EL2
+*	Without u/k/h an event counts at EL0 and EL1; with any of them, only
+*	at the levels listed.
+*	Spaces around names, numbers and modifiers are ignored.
+*	e.g. "L1D_CACHE_REFILL:64bit, INST_RETIRED, 0xC0:user"
+*
+* Names are looked up in a perfect hash table generated from perfmon.h
+* (perfmon_event_names.h, see perfmon_event_names.py), so each costs one
+* hash and one compare. Parsing works in place on the string and the
+* caller's arrays, and never allocates.
+*
+******************************************************************************/
+
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	//Event number of a name of length characters, with or without the EVT_ prefix, in any case
+	//Returns PMU_RETURN_EVENT_NO_AVAIL for an unknown name
+	int pmu_spec_lookup(const char * name, unsigned length);
+
+	//Parse a spec into at most max events, setting *n to the number parsed
+	//On PMU_RETURN_SPEC_SYNTAX, or PMU_RETURN_GROUP_TOO_LARGE past max events,
+	//*error (if not null) points at the offending part of spec
+	int pmu_spec_parse(const char * spec, struct pmu_event_spec * specs, unsigned max, unsigned * n, const char ** error);
+
+	//Parse a spec, check its events are available, and add them all (pmu_event_add_batch)
+	//handles, if not null, has room for NEVENTS_ARCH_MAX and gets one per event in spec order
+	//On error, *error (if not null) points at the offending part of spec, if any
+	int pmu_spec_add(const char * spec, struct pmu_event_handle * handles, unsigned * n, const char ** error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,36 +1,116 @@
+#ifndef __KERNEL__
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#endif
+
 #include "perfmon.h"
 
-unsigned state_pmcr;
-unsigned state_pmcnten;
-unsigned state_pmuserenr;
-unsigned state_pmevtype[NEVENTS_ARCH_MAX];
+struct pmu_state pmu_state[PMU_MAX_CPUS];
+
+#ifndef __KERNEL__
+__thread int pmu_cpu_cached = -1;
+
+unsigned pmu_cpu_update(void) {
+    int cpu = sched_getcpu();
+    if (cpu < 0) cpu = 0;
+    pmu_cpu_cached = cpu;
+    return cpu;
+}
+
+static unsigned midr_user; //Found or set on first use
+static unsigned midr_user_probed;
+
+//The MIDR fields Linux lists for the first processor in /proc/cpuinfo, 0 if it doesn't
+static unsigned midr_cpuinfo(void) {
+    FILE * f = fopen("/proc/cpuinfo", "r");
+    if (!f) return 0;
+
+    char line[128];
+    unsigned implementer = 0, variant = 0, part = 0, revision = 0, value;
+    while (fgets(line, sizeof(line), f)) {
+        char * colon = strchr(line, ':');
+        if (!colon) {
+            if (part) break; //End of the first processor
+            continue;
+        }
+        if (sscanf(colon + 1, "%i", &value) != 1) continue;
+        if (!strncmp(line, "CPU implementer", 15)) implementer = value;
+        else if (!strncmp(line, "CPU variant", 11)) variant = value;
+        else if (!strncmp(line, "CPU part", 8)) part = value;
+        else if (!strncmp(line, "CPU revision", 12)) revision = value;
+    }
+    fclose(f);
+
+    //Architecture 0xF: features are in the ID registers, as on every ARMv7 and ARMv8 core
+    if (!implementer || !part) return 0;
+    return implementer << MIDR_IMPLEMENTER_SHIFT | variant << 20 | 0xF << 16
+        | part << MIDR_PARTNUM_SHIFT | revision;
+}
+
+unsigned pmu_midr_user(void) {
 
-void pmu_load(void) {
-    state_pmcr = pmcr_read();
+    if (midr_user_probed) return midr_user;
+
+    //arm64 kernels export MIDR_EL1, for 32-bit processes too
+    FILE * f = fopen("/sys/devices/system/cpu/cpu0/regs/identification/midr_el1", "r");
+    unsigned long long midr = 0;
+    if (f) {
+        if (fscanf(f, "%llx", &midr) != 1) midr = 0;
+        fclose(f);
+    }
+    midr_user = midr ? (unsigned) midr : midr_cpuinfo();
+
+    midr_user_probed = 1;
+    return midr_user;
+
+}
+
+void pmu_midr_set(unsigned midr) {
+    midr_user = midr;
+    midr_user_probed = 1;
+    for (unsigned i = 0; i < PMU_MAX_CPUS; i++) __atomic_store_n(&pmu_state[i].available_init, 0, __ATOMIC_RELEASE);
+}
+#endif
+
+//Returns PMU_RETURN_NO_BACKEND, touching nothing, if there is no PMU to load
+int pmu_load(void) {
+    int ret = pmu_backend_check();
+    if (ret < 0) return ret;
+    struct pmu_state * state = pmu_state_this();
+    state->pmcr = pmcr_read();
     pmu_enable();
-    state_pmuserenr = pmuserenr_read();
-    state_pmcnten = pmcntenset_read();
+    state->pmcnten = pmcntenset_read();
     unsigned nevents = pmu_nevents();
     for (unsigned i = 0; i < nevents; i++) {
-        state_pmevtype[i] = pmevtyper_read(i);
+        state->pmevtype[i] = pmevtyper_read(i);
     }
+    return PMU_RETURN_SUCCESS;
 }
 
-void pmu_load_reset(void) {
-    pmu_load();
+int pmu_load_reset(void) {
+    int ret = pmu_load();
+    if (ret < 0) return ret;
     pmevcntr_reset_all();
     pmccntr_reset();
+    return PMU_RETURN_SUCCESS;
 }
 
 void pmu_unload(void) {
+    struct pmu_state * state = pmu_state_this();
     unsigned nevents = pmu_nevents();
+    pmu_config_write_begin(state);
     for (unsigned i = 0; i < nevents; i++) {
-        pmevtyper_write(i, state_pmevtype[i]);
+        pmevtyper_write(i, state->pmevtype[i]);
     }
-    pmcntenset_write(state_pmcnten);
-    pmcntenclr_write(~state_pmcnten);
-    pmuserenr_write(state_pmuserenr);
-    pmcr_write(state_pmcr);
+    pmcntenset_write(state->pmcnten);
+    pmcntenclr_write(~state->pmcnten);
+    //Counters the library reserved since pmu_load are now disabled, so hand them out again
+    state->ext.mask &= state->pmcnten;
+    __atomic_fetch_and(&state->slots, state->pmcnten, __ATOMIC_RELEASE);
+    pmu_config_write_end(state);
+    pmcr_write(state->pmcr);
 }
 
 void pmu_unload_reset(void) {
@@ -39,3 +119,102 @@ void pmu_unload_reset(void) {
     pmccntr_reset();
 }
 
+//Take ownership of the counters currently enabled on this CPU, with counts of zero
+//Counters the library reserved (pmu_event_add) stay system-wide and are left out
+void pmu_context_init(struct pmu_context * ctx) {
+    struct pmu_state * state = pmu_state_this();
+    unsigned nevents = pmu_nevents();
+    if (nevents > NEVENTS_ARCH_MAX) nevents = NEVENTS_ARCH_MAX;
+
+    ctx->enabled = pmcntenset_read() & (((1 << nevents) - 1) | PMCNTEN_CYCLE_CTR);
+    ctx->enabled &= ~__atomic_load_n(&state->slots, __ATOMIC_ACQUIRE);
+    ctx->active = 0;
+    ctx->ovs = 0;
+    ctx->inten = pmintenset_read() & ctx->enabled;
+    ctx->pmccntr = 0;
+    ctx->ext_mask = state->ext.mask & ctx->enabled;
+    for (unsigned i = 0; i < NEVENTS_ARCH_MAX; i++) {
+        ctx->pmevtype[i] = (ctx->enabled >> i) & 1 ? pmevtyper_read(i) : 0;
+        ctx->pmevcntr[i] = 0;
+        ctx->ext_high[i] = 0;
+    }
+}
+
+//Stop this context's counters and save their values
+void pmu_context_save(struct pmu_context * ctx) {
+    struct pmu_state * state = pmu_state_this();
+    unsigned active = ctx->active;
+    unsigned events = active & ~PMCNTEN_CYCLE_CTR;
+
+    pmu_config_write_begin(state);
+
+    //Stop counting first, so other threads aren't counted
+    pmcntenclr_write(active);
+
+    for (unsigned pending = events; pending; pending &= pending - 1) {
+        unsigned n = __builtin_ctz(pending);
+        ctx->pmevcntr[n] = pmevcntr_read(n);
+    }
+
+    if (active & PMCNTEN_CYCLE_CTR) {
+        if (pmcr_isset(PMCR_CYCLE_COUNTER_64_BITS)) ctx->pmccntr = pmccntr_read_64();
+        else ctx->pmccntr = pmccntr_read_32();
+    }
+
+    //Unfolded overflows, interrupt enables and high words move with the thread
+    unsigned ovs = pmovsr_read() & active;
+    pmovsr_write(ovs);
+    ctx->ovs = (ctx->ovs & ~active) | ovs;
+    unsigned inten = pmintenset_read() & active;
+    pmintenclr_write(inten);
+    ctx->inten = (ctx->inten & ~active) | inten;
+    for (unsigned pending = ctx->ext_mask & active; pending; pending &= pending - 1) {
+        unsigned n = __builtin_ctz(pending);
+        ctx->ext_high[n] = state->ext.high[n];
+    }
+
+    ctx->active = 0;
+    pmu_config_write_end(state);
+}
+
+//Program this context's counters on the current CPU and start them
+//Counters the library reserved on this CPU keep their system-wide events:
+//the context's counts for those registers pause until it runs on a CPU where they are free
+void pmu_context_restore(struct pmu_context * ctx) {
+    struct pmu_state * state = pmu_state_this();
+    unsigned active = ctx->enabled & ~__atomic_load_n(&state->slots, __ATOMIC_ACQUIRE);
+    unsigned events = active & ~PMCNTEN_CYCLE_CTR;
+
+    pmu_config_write_begin(state);
+
+    for (unsigned pending = events; pending; pending &= pending - 1) {
+        unsigned n = __builtin_ctz(pending);
+        pmevtyper_write(n, ctx->pmevtype[n]);
+        pmevcntr_write(n, ctx->pmevcntr[n]);
+    }
+
+    if (active & PMCNTEN_CYCLE_CTR) {
+        if (pmcr_isset(PMCR_CYCLE_COUNTER_64_BITS)) pmccntr_write_64(ctx->pmccntr);
+        else pmccntr_write_32(ctx->pmccntr);
+    }
+
+    //High words first: a pending overflow set below can interrupt straight away,
+    //and the handler must fold it into this context's high word, not the previous one's
+    unsigned ext_mask = ctx->ext_mask & active;
+    if (ext_mask) {
+        struct pmu_ext_state * ext = &state->ext;
+        __atomic_add_fetch(&ext->seq, 1, __ATOMIC_ACQUIRE);
+        for (unsigned pending = ext_mask; pending; pending &= pending - 1) {
+            unsigned n = __builtin_ctz(pending);
+            ext->high[n] = ctx->ext_high[n];
+        }
+        ext->mask |= ext_mask;
+        __atomic_add_fetch(&ext->seq, 1, __ATOMIC_RELEASE);
+    }
+    if (ctx->ovs & active) pmovsset_write(ctx->ovs & active);
+    if (ctx->inten & active) pmintenset_write(ctx->inten & active);
+
+    pmcntenset_write(active);
+    ctx->active = active;
+    pmu_config_write_end(state);
+}
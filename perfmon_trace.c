@@ -0,0 +1,205 @@
+#include "perfmon_trace.h"
+
+//Delta/varint trace, see perfmon_trace.h
+
+#define TRACE_MAGIC "PMT1"
+
+//Largest record: the cycle counter and every event counter at their longest varints
+#define TRACE_RECORD_MAX ( 10 + 5 * NEVENTS_ARCH_MAX )
+
+//Helper Functions
+
+    static inline unsigned long long zigzag_encode(long long x) {
+        return ( (unsigned long long) x << 1 ) ^ (unsigned long long) (x >> 63);
+    }
+
+    static inline long long zigzag_decode(unsigned long long x) {
+        return (long long) (x >> 1) ^ -(long long) (x & 1);
+    }
+
+    //Append a varint to buf, returning the bytes written
+    static inline unsigned varint_put(unsigned char * buf, unsigned long long x) {
+        unsigned n = 0;
+        while (x >= 0x80) {
+            buf[n++] = (unsigned char) x | 0x80;
+            x >>= 7;
+        }
+        buf[n++] = (unsigned char) x;
+        return n;
+    }
+
+    //Read a varint from in, counting the bytes read into *length if not null
+    //Return 0 at the end of the stream or on a varint longer than 64 bits
+    static int varint_get(FILE * in, unsigned long long * x, unsigned * length) {
+        unsigned long long value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            int c = getc(in);
+            if (c == EOF) return 0;
+            if (length) (*length)--;
+            value |= (unsigned long long) (c & 0x7f) << shift;
+            if (!(c & 0x80)) {
+                *x = value;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    //Event counters of a layout
+    static inline unsigned trace_events(unsigned nevents, unsigned enabled) {
+        return enabled & ((1u << nevents) - 1);
+    }
+
+    //Start a block with the layout of snap
+    static void trace_block_open(struct pmu_trace_writer * w, const struct pmu_snapshot * snap, unsigned config) {
+        w->open = 1;
+        w->config = config;
+        w->nevents = snap->nevents;
+        w->enabled = snap->enabled;
+        for (unsigned pending = trace_events(w->nevents, w->enabled); pending; pending &= pending - 1) {
+            unsigned n = __builtin_ctz(pending);
+            w->types[n] = pmevtyper_get(n);
+        }
+        w->records = 0;
+        w->length = 0;
+        w->cycles = 0;
+        w->cycles_delta = 0;
+        for (int i = 0; i < NEVENTS_ARCH_MAX; i++) w->count[i] = 0;
+    }
+
+
+//Public Functions
+
+    void pmu_trace_writer_init(struct pmu_trace_writer * w, FILE * out) {
+        w->out = out;
+        w->open = 0;
+    }
+
+    int pmu_trace_write(struct pmu_trace_writer * w, const struct pmu_snapshot * snap) {
+
+        if (!w || !snap) return PMU_RETURN_BAD_PTR;
+
+        //Records in a block share one layout
+        unsigned config = pmu_config_read_begin(pmu_state_this());
+        if (w->open && (w->config != config || w->nevents != snap->nevents || w->enabled != snap->enabled
+            || w->length + TRACE_RECORD_MAX > PMU_TRACE_BLOCK_BYTES)) {
+            int ret = pmu_trace_flush(w);
+            if (ret < 0) return ret;
+        }
+        if (!w->open) trace_block_open(w, snap, config);
+
+        unsigned char * buf = w->block + w->length;
+        unsigned n = 0;
+
+        if (w->enabled & PMCNTEN_CYCLE_CTR) {
+            unsigned long long delta = snap->cycles - w->cycles;
+            n += varint_put(buf + n, zigzag_encode((long long) (delta - w->cycles_delta)));
+            w->cycles = snap->cycles;
+            w->cycles_delta = delta;
+        }
+
+        for (unsigned pending = trace_events(w->nevents, w->enabled); pending; pending &= pending - 1) {
+            unsigned i = __builtin_ctz(pending);
+            int delta = (int) (snap->count[i] - w->count[i]);
+            n += varint_put(buf + n, zigzag_encode(delta));
+            w->count[i] = snap->count[i];
+        }
+
+        w->length += n;
+        w->records++;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    int pmu_trace_flush(struct pmu_trace_writer * w) {
+
+        if (!w) return PMU_RETURN_BAD_PTR;
+        if (!w->open) return PMU_RETURN_SUCCESS;
+        w->open = 0;
+        if (!w->records) return PMU_RETURN_SUCCESS;
+
+        unsigned char header[4 + 10 * (4 + NEVENTS_ARCH_MAX)];
+        unsigned n = 4;
+        header[0] = TRACE_MAGIC[0];
+        header[1] = TRACE_MAGIC[1];
+        header[2] = TRACE_MAGIC[2];
+        header[3] = TRACE_MAGIC[3];
+        n += varint_put(header + n, w->length);
+        n += varint_put(header + n, w->records);
+        n += varint_put(header + n, w->nevents);
+        n += varint_put(header + n, w->enabled);
+        for (unsigned pending = trace_events(w->nevents, w->enabled); pending; pending &= pending - 1) {
+            n += varint_put(header + n, w->types[__builtin_ctz(pending)]);
+        }
+
+        if (fwrite(header, 1, n, w->out) != n) return PMU_RETURN_TRACE_IO;
+        if (fwrite(w->block, 1, w->length, w->out) != w->length) return PMU_RETURN_TRACE_IO;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
+
+    void pmu_trace_reader_init(struct pmu_trace_reader * r, FILE * in) {
+        r->in = in;
+        r->records = 0;
+        r->length = 0;
+    }
+
+    int pmu_trace_read(struct pmu_trace_reader * r, struct pmu_trace_record * record) {
+
+        if (!r || !record) return PMU_RETURN_BAD_PTR;
+
+        struct pmu_trace_record * last = &r->last;
+        unsigned long long x;
+
+        //Next block
+        if (!r->records) {
+
+            //Every record byte must have been used
+            if (r->length) return PMU_RETURN_TRACE_CORRUPT;
+
+            char magic[4];
+            size_t got = fread(magic, 1, sizeof(magic), r->in);
+            if (!got) return ferror(r->in) ? PMU_RETURN_TRACE_IO : PMU_RETURN_TRACE_END;
+            if (got != sizeof(magic) || magic[0] != TRACE_MAGIC[0] || magic[1] != TRACE_MAGIC[1]
+                || magic[2] != TRACE_MAGIC[2] || magic[3] != TRACE_MAGIC[3]) return PMU_RETURN_TRACE_CORRUPT;
+
+            unsigned long long length, records, nevents, enabled;
+            if (!varint_get(r->in, &length, 0) || !varint_get(r->in, &records, 0)
+                || !varint_get(r->in, &nevents, 0) || !varint_get(r->in, &enabled, 0)) return PMU_RETURN_TRACE_CORRUPT;
+            if (!records || nevents > NEVENTS_ARCH_MAX) return PMU_RETURN_TRACE_CORRUPT;
+
+            r->length = length;
+            r->records = records;
+            last->nevents = nevents;
+            last->enabled = enabled;
+            for (unsigned pending = trace_events(last->nevents, last->enabled); pending; pending &= pending - 1) {
+                if (!varint_get(r->in, &x, 0)) return PMU_RETURN_TRACE_CORRUPT;
+                last->types[__builtin_ctz(pending)] = x;
+            }
+
+            last->cycles = 0;
+            r->cycles_delta = 0;
+            for (int i = 0; i < NEVENTS_ARCH_MAX; i++) last->count[i] = 0;
+        }
+
+        if (last->enabled & PMCNTEN_CYCLE_CTR) {
+            if (!varint_get(r->in, &x, &r->length)) return PMU_RETURN_TRACE_CORRUPT;
+            r->cycles_delta += zigzag_decode(x);
+            last->cycles += r->cycles_delta;
+        }
+
+        for (unsigned pending = trace_events(last->nevents, last->enabled); pending; pending &= pending - 1) {
+            if (!varint_get(r->in, &x, &r->length)) return PMU_RETURN_TRACE_CORRUPT;
+            last->count[__builtin_ctz(pending)] += (unsigned) zigzag_decode(x);
+        }
+
+        //A length that went negative means a record ran past its block
+        if (r->length > PMU_TRACE_BLOCK_BYTES) return PMU_RETURN_TRACE_CORRUPT;
+        r->records--;
+        *record = *last;
+
+        return PMU_RETURN_SUCCESS;
+
+    }
@@ -0,0 +1,57 @@
+/******************************************************************************
+*
+* perfmon_user.c
+*
+* Companion kernel module that opens the PMU to userspace on every core.
+*
+* PMUSERENR can only be written from the kernel and only affects the
+* core it is written on. While this module is loaded every online core
+* has EN, CR and ER set, so userspace can read the counters with bare
+* MRC instructions and no system calls:
+*	insmod perfmon_user_mod.ko
+*
+* Each core's previous PMUSERENR is kept in pmu_state and written back
+* when the core goes offline or the module is unloaded. Cores that come
+* online while the module is loaded get the setting applied on the way up.
+*
+******************************************************************************/
+
+#include <linux/module.h>
+#include <linux/cpuhotplug.h>
+
+#include "perfmon.h"
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("ARM Cortex-A53 performance monitor userspace access");
+
+static enum cpuhp_state perfmon_user_state;
+
+//Hotplug callbacks run on the CPU coming up or going down
+
+static int perfmon_user_online(unsigned int cpu) {
+    pmu_state_this()->pmuserenr = pmuserenr_read();
+    pmu_user_enable();
+    return 0;
+}
+
+static int perfmon_user_offline(unsigned int cpu) {
+    pmuserenr_write(pmu_state_this()->pmuserenr);
+    return 0;
+}
+
+//Registering the state also runs the online callback on every online CPU,
+//and removing it runs the offline callback on them
+static int __init perfmon_user_init(void) {
+    int ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "perfmon/user:online",
+        perfmon_user_online, perfmon_user_offline);
+    if (ret < 0) return ret;
+    perfmon_user_state = ret;
+    return 0;
+}
+
+static void __exit perfmon_user_exit(void) {
+    cpuhp_remove_state(perfmon_user_state);
+}
+
+module_init(perfmon_user_init);
+module_exit(perfmon_user_exit);